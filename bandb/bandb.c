@@ -31,8 +31,10 @@
 #include "setup.h"
 #include <ratbox_lib.h>
 #include <stdio.h>
+#include <sys/stat.h>
 #include "rsdb.h"
 #include "common.h"
+#include "bandb_snapshot.h"
 
 
 #define MAXPARA 10
@@ -57,18 +59,51 @@ static const char *bandb_table[LAST_BANDB_TYPE] = {
 };
 
 
+
 static rb_helper *bandb_helper;
 static int in_transaction;
 
+static char snapshot_path[PATH_MAX];
+static int snapshot_valid = 1;	/* a snapshot on disk may be current */
+
+/* bans read from the helper queue, inserted a batch at a time */
+static struct rsdb_batch ban_batch[LAST_BANDB_TYPE];
+
 static void check_schema(void);
 
+/* anything that reads or deletes bans must see the queued inserts first */
+static void
+flush_bans(void)
+{
+	int i;
+
+	for(i = 0; i < LAST_BANDB_TYPE; i++)
+		rsdb_batch_flush(&ban_batch[i]);
+}
+
 static void
 bandb_commit(void *unused)
 {
+	flush_bans();
+
+	if(!in_transaction)
+		return;
+
 	rsdb_transaction(RSDB_TRANS_END);
 	in_transaction = 0;
 }
 
+/* the database is about to change, so any snapshot of it is stale */
+static void
+invalidate_snapshot(void)
+{
+	if(!snapshot_valid)
+		return;
+
+	unlink(snapshot_path);
+	snapshot_valid = 0;
+}
+
 static void
 parse_ban(bandb_type type, char *parv[], int parc)
 {
@@ -78,6 +113,7 @@ parse_ban(bandb_type type, char *parv[], int parc)
 	const char *curtime = NULL;
 	const char *reason = NULL;
 	const char *perm = NULL;
+	const char *row[6];
 	int para = 1;
 
 	if(type == BANDB_KLINE)
@@ -98,6 +134,8 @@ parse_ban(bandb_type type, char *parv[], int parc)
 	perm = parv[para++];
 	reason = parv[para++];
 
+	invalidate_snapshot();
+
 	if(!in_transaction)
 	{
 		rsdb_transaction(RSDB_TRANS_START);
@@ -106,16 +144,19 @@ parse_ban(bandb_type type, char *parv[], int parc)
 				COMMIT_INTERVAL);
 	}
 
-	rsdb_exec(NULL,
-		  "INSERT INTO %s (mask1, mask2, oper, time, perm, reason) VALUES('%Q', '%Q', '%Q', %s, %s, '%Q')",
-		  bandb_table[type], mask1, mask2 ? mask2 : "", oper, curtime, perm, reason);
+	row[0] = mask1;
+	row[1] = mask2;
+	row[2] = oper;
+	row[3] = curtime;
+	row[4] = perm;
+	row[5] = reason;
+	rsdb_batch_add(&ban_batch[type], row);
 }
 
 static void
 parse_unban(bandb_type type, char *parv[], int parc)
 {
-	const char *mask1 = NULL;
-	const char *mask2 = NULL;
+	const char *args[2];
 
 	if(type == BANDB_KLINE)
 	{
@@ -125,10 +166,11 @@ parse_unban(bandb_type type, char *parv[], int parc)
 	else if(parc != 2)
 		return;
 
-	mask1 = parv[1];
+	args[0] = parv[1];
+	args[1] = type == BANDB_KLINE ? parv[2] : "";
 
-	if(type == BANDB_KLINE)
-		mask2 = parv[2];
+	invalidate_snapshot();
+	flush_bans();
 
 	if(!in_transaction)
 	{
@@ -138,24 +180,159 @@ parse_unban(bandb_type type, char *parv[], int parc)
 				COMMIT_INTERVAL);
 	}
 
-	rsdb_exec(NULL, "DELETE FROM %s WHERE mask1='%Q' AND mask2='%Q'",
-		  bandb_table[type], mask1, mask2 ? mask2 : "");
+	rsdb_stmt_exec(rsdb_prepare("DELETE FROM %s WHERE mask1=? AND mask2=?",
+				    bandb_table[type]), 2, args);
 }
 
 static void
-list_bans(void)
+fetch_bans(struct rsdb_table *table, bandb_type type)
+{
+	rsdb_stmt_fetch(table, rsdb_prepare("SELECT mask1,mask2,oper,reason FROM %s",
+					    bandb_table[type]), 0, NULL);
+}
+
+#ifndef WINDOWS
+static int
+snapshot_write_string(FILE *f, const char *str)
+{
+	uint16_t len = strlen(str);
+
+	if(fwrite(&len, sizeof(len), 1, f) != 1 || fwrite(str, 1, len + 1, f) != len + 1)
+		return 0;
+
+	return 1;
+}
+
+/*
+ * write_snapshot()
+ *
+ * Dumps every ban into the snapshot file, through a temporary file
+ * so the ircd never sees a partial one.  Returns 1 on success.
+ */
+static int
+write_snapshot(void)
+{
+	char tmppath[PATH_MAX];
+	struct rsdb_table table;
+	uint32_t header[2];
+	uint32_t count = 0;
+	uint8_t type;
+	FILE *f;
+	int i, j, ok = 1;
+
+	/* make sure the snapshot never holds anything the database
+	 * could still lose */
+	bandb_commit(NULL);
+
+	rb_snprintf(tmppath, sizeof(tmppath), "%s.%d", snapshot_path, (int) getpid());
+
+	if((f = fopen(tmppath, "w")) == NULL)
+		return 0;
+
+	header[0] = SNAPSHOT_VERSION;
+	header[1] = 0;
+
+	if(fwrite(SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_LEN, 1, f) != 1 ||
+	   fwrite(header, sizeof(header), 1, f) != 1)
+		ok = 0;
+
+	for(i = 0; ok && i < LAST_BANDB_TYPE; i++)
+	{
+		fetch_bans(&table, i);
+
+		type = bandb_letter[i];
+
+		for(j = 0; ok && j < table.row_count; j++, count++)
+		{
+			if(fwrite(&type, 1, 1, f) != 1 ||
+			   !snapshot_write_string(f, i == BANDB_KLINE ? table.row[j][0] : "") ||
+			   !snapshot_write_string(f, i == BANDB_KLINE ? table.row[j][1] : table.row[j][0]) ||
+			   !snapshot_write_string(f, table.row[j][2]) ||
+			   !snapshot_write_string(f, table.row[j][3]))
+				ok = 0;
+		}
+
+		rsdb_exec_fetch_end(&table);
+	}
+
+	/* fill in the record count now we know it */
+	header[1] = count;
+	if(ok && (fseek(f, SNAPSHOT_MAGIC_LEN, SEEK_SET) ||
+		  fwrite(header, sizeof(header), 1, f) != 1))
+		ok = 0;
+
+	if(fclose(f) != 0)
+		ok = 0;
+
+	if(!ok || rename(tmppath, snapshot_path) == -1)
+	{
+		unlink(tmppath);
+		return 0;
+	}
+
+	snapshot_valid = 1;
+	return 1;
+}
+
+/*
+ * snapshot_current()
+ *
+ * Returns 1 if the snapshot on disk matches the database.  Our own
+ * changes remove the snapshot; the mtime check catches anything else
+ * that touched the database (or its write-ahead log) since it was
+ * written.  A snapshot from the same second is treated as stale.
+ */
+static int
+snapshot_current(void)
+{
+	char walpath[PATH_MAX];
+	struct stat snapst, dbst;
+
+	if(!snapshot_valid)
+		return 0;
+
+	if(stat(snapshot_path, &snapst) == -1 || stat(rsdb_path(), &dbst) == -1)
+		return 0;
+
+	if(snapst.st_mtime <= dbst.st_mtime)
+		return 0;
+
+	rb_snprintf(walpath, sizeof(walpath), "%s-wal", rsdb_path());
+	if(stat(walpath, &dbst) == 0 && snapst.st_mtime <= dbst.st_mtime)
+		return 0;
+
+	return 1;
+}
+#endif
+
+static void
+list_bans(int text)
 {
 	static char buf[512];
 	struct rsdb_table table;
 	int i, j;
 
+	flush_bans();
+
 	/* schedule a clear of anything already pending */
 	rb_helper_write_queue(bandb_helper, "C");
 
+#ifndef WINDOWS
+	if(text)
+		invalidate_snapshot();
+	else if(snapshot_current() || write_snapshot())
+	{
+		/* the ircd finishes the listing itself once the snapshot is
+		 * loaded, or asks for it as text with its own C ... F
+		 */
+		rb_helper_write(bandb_helper, "S :%s", snapshot_path);
+		return;
+	}
+#endif
+
 	for(i = 0; i < LAST_BANDB_TYPE; i++)
 	{
-		rsdb_exec_fetch(&table, "SELECT mask1,mask2,oper,reason FROM %s WHERE 1",
-				bandb_table[i]);
+		fetch_bans(&table, i);
 
 		for(j = 0; j < table.row_count; j++)
 		{
@@ -228,18 +405,28 @@ parse_request(rb_helper *helper)
 			break;
 
 		case 'L':
-			list_bans();
+			list_bans(0);
+			break;
+
+		/* the snapshot could not be loaded, send the bans as text */
+		case 'T':
+			list_bans(1);
 			break;
 		default:
 			break;
 		}
 	}
+
+	/* the helper queue is drained, don't sit on a partial batch */
+	flush_bans();
 }
 
 
 static void
 error_cb(rb_helper *helper)
 {
+	flush_bans();
+
 	if(in_transaction)
 		rsdb_transaction(RSDB_TRANS_END);
 	exit(1);
@@ -296,6 +483,8 @@ db_error_cb(const char *errstr)
 int
 main(int argc, char *argv[])
 {
+	int i;
+
 	setup_signals();
 	bandb_helper = rb_helper_child(parse_request, error_cb, NULL, NULL, NULL, 256, 256, 256, 256);	/* XXX fix me */
 	if(bandb_helper == NULL)
@@ -306,7 +495,13 @@ main(int argc, char *argv[])
 		exit(1);
 	}
 	rsdb_init(db_error_cb);
+	rb_snprintf(snapshot_path, sizeof(snapshot_path), "%s%s", rsdb_path(), RSDB_SNAPSHOT_SUFFIX);
 	check_schema();
+
+	for(i = 0; i < LAST_BANDB_TYPE; i++)
+		rsdb_batch_init(&ban_batch[i], bandb_table[i],
+				"mask1, mask2, oper, time, perm, reason", 6);
+
 	rb_helper_loop(bandb_helper, 0);
 
 	return 0;
@@ -330,5 +525,9 @@ check_schema(void)
 			rsdb_exec(NULL,
 				  "CREATE TABLE %s (mask1 TEXT, mask2 TEXT, oper TEXT, time INTEGER, perm INTEGER, reason TEXT)",
 				  bandb_table[i]);
+
+		/* unbans look rows up by mask */
+		rsdb_exec(NULL, "CREATE INDEX IF NOT EXISTS %s_mask ON %s (mask1, mask2)",
+			  bandb_table[i], bandb_table[i]);
 	}
 }
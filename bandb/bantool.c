@@ -79,6 +79,9 @@ static const char *bandb_suffix[LAST_BANDB_TYPE] = {
 
 static char me[PATH_MAX];
 
+/* page cache used while importing, in kilobytes */
+#define BULK_CACHE_KB	65536
+
 /* *INDENT-OFF* */
 /* report counters */
 struct counter
@@ -122,7 +125,8 @@ static void import_config(const char *conf, int id);
 static void check_schema(void);
 static void print_help(int i_exit);
 static void wipe_schema(void);
-static void drop_dupes(const char *user, const char *host, const char *t);
+static void drop_dupes(const char *t);
+static void create_index(const char *t);
 
 /**
  *  swing your pants 
@@ -210,6 +214,17 @@ main(int argc, char *argv[])
 		}
 		check_schema();
 
+		/* bandb rebuilds its ban snapshot when it is missing */
+		if(flag.import)
+		{
+			rb_snprintf(conf, sizeof(conf), "%s%s", rsdb_path(), RSDB_SNAPSHOT_SUFFIX);
+			unlink(conf);
+
+			/* bulk load: keep the index pages of a large import
+			 * in memory instead of spilling them to the log */
+			rsdb_exec(NULL, "PRAGMA cache_size=-%d", BULK_CACHE_KB);
+		}
+
 		if(flag.vacuum)
 			db_reclaim_slack();
 
@@ -230,6 +245,14 @@ main(int argc, char *argv[])
 	if(flag.verbose && flag.dupes_ok == YES)
 		fprintf(stdout, "* Allowing duplicate bans...\n");
 
+	/* building the indexes once at the end beats updating
+	 * them a row at a time */
+	if(flag.import && flag.pretend == NO)
+	{
+		for(i = 0; i < LAST_BANDB_TYPE; i += 2)
+			rsdb_exec(NULL, "DROP INDEX IF EXISTS %s_mask", bandb_table[i]);
+	}
+
 	/* checking for our files to import or export */
 	for(i = 0; i < LAST_BANDB_TYPE; i++)
 	{
@@ -249,6 +272,21 @@ main(int argc, char *argv[])
 			rsdb_transaction(RSDB_TRANS_END);
 	}
 
+	/* rebuild the indexes and weed out duplicates in one pass per
+	 * table, rather than a lookup for every imported line */
+	if(flag.import && flag.pretend == NO)
+	{
+		rsdb_transaction(RSDB_TRANS_START);
+		for(i = 0; i < LAST_BANDB_TYPE; i += 2)
+		{
+			create_index(bandb_table[i]);
+
+			if(flag.dupes_ok == NO)
+				drop_dupes(bandb_table[i]);
+		}
+		rsdb_transaction(RSDB_TRANS_END);
+	}
+
 	if(flag.import)
 	{
 		if(count.error && flag.verbose)
@@ -393,6 +431,9 @@ import_config(const char *conf, int id)
 	const char *f_reason = NULL;
 	const char *f_oreason = NULL;
 	char newreason[REASONLEN];
+	char f_permstr[2];
+	const char *row[6];
+	struct rsdb_batch batch;
 
 	if(flag.verbose)
 		fprintf(stdout, "* checking for %s: ", conf);	/* debug  */
@@ -410,6 +451,8 @@ import_config(const char *conf, int id)
 	if(strstr(conf, ".perm") != 0)
 		f_perm = 1;
 
+	rb_snprintf(f_permstr, sizeof(f_permstr), "%d", f_perm);
+	rsdb_batch_init(&batch, bandb_table[id], "mask1, mask2, oper, time, perm, reason", 6);
 
 	/* xline
 	 * "SYSTEM","0","banned","stevoo!stevoo@efnet.port80.se{stevoo}",1111080437
@@ -500,13 +543,13 @@ import_config(const char *conf, int id)
 
 		if(flag.pretend == NO)
 		{
-			if(flag.dupes_ok == NO)
-				drop_dupes(f_mask1, f_mask2, bandb_table[id]);
-
-			rsdb_exec(NULL,
-				  "INSERT INTO %s (mask1, mask2, oper, time, perm, reason) VALUES('%Q','%Q','%Q','%Q','%d','%Q')",
-				  bandb_table[id], f_mask1, f_mask2, f_oper, f_time, f_perm,
-				  newreason);
+			row[0] = f_mask1;
+			row[1] = f_mask2;
+			row[2] = f_oper;
+			row[3] = f_time;
+			row[4] = f_permstr;
+			row[5] = newreason;
+			rsdb_batch_add(&batch, row);
 		}
 
 		if(flag.pretend && flag.verbose)
@@ -518,6 +561,11 @@ import_config(const char *conf, int id)
 		i++;
 	}
 
+	if(flag.pretend == NO)
+		rsdb_batch_flush(&batch);
+
+	fclose(fd);
+
 	switch (bandb_letter[id])
 	{
 	case 'K':
@@ -769,6 +817,8 @@ check_schema(void)
 			}
 		}
 
+		create_index(bandb_table[i]);
+
 		i++;		/* skip over .perm */
 	}
 }
@@ -826,12 +876,28 @@ wipe_schema(void)
 
 /**
  * remove pre-existing duplicate bans from the database.
- * we favor the new, imported ban over the one in the database
+ * we favor the new, imported ban over the one in the database,
+ * which is always the one inserted last.
  */
-void
-drop_dupes(const char *user, const char *host, const char *t)
+static void
+drop_dupes(const char *t)
+{
+	/* walks the mask index once, only masks that occur more than
+	 * once get looked at again */
+	rsdb_exec(NULL,
+		  "DELETE FROM %s WHERE rowid IN (SELECT a.rowid FROM %s a JOIN "
+		  "(SELECT mask1, mask2, MAX(rowid) newest FROM %s GROUP BY mask1, mask2 HAVING COUNT(*) > 1) d "
+		  "ON a.mask1=d.mask1 AND a.mask2=d.mask2 AND a.rowid < d.newest)",
+		  t, t, t);
+}
+
+/**
+ * index bans by mask, as bandb looks them up for removal
+ */
+static void
+create_index(const char *t)
 {
-	rsdb_exec(NULL, "DELETE FROM %s WHERE mask1='%Q' AND mask2='%Q'", t, user, host);
+	rsdb_exec(NULL, "CREATE INDEX IF NOT EXISTS %s_mask ON %s (mask1, mask2)", t, t);
 }
 
 static void
@@ -21,8 +21,32 @@ struct rsdb_table
 	void *arg;
 };
 
+/* milliseconds to wait on a database locked by another process */
+#define RSDB_BUSY_TIMEOUT	2500
+
+struct rsdb_stmt;
+
+/* rows queued for a multi-row INSERT */
+#define RSDB_BATCH_ROWS		64
+#define RSDB_BATCH_MAXCOLS	8
+
+struct rsdb_batch
+{
+	const char *table;
+	const char *columns;
+	int ncols;
+	int rows;
+	struct rsdb_stmt *full;
+	struct rsdb_stmt *single;
+	char *args[RSDB_BATCH_ROWS * RSDB_BATCH_MAXCOLS];
+};
+
 int rsdb_init(rsdb_error_cb *);
 void rsdb_shutdown(void);
+const char *rsdb_path(void);
+
+/* binary ban snapshot written by bandb next to the database */
+#define RSDB_SNAPSHOT_SUFFIX	".snap"
 
 const char *rsdb_quote(const char *src);
 
@@ -31,6 +55,14 @@ void rsdb_exec(rsdb_callback cb, const char *format, ...);
 void rsdb_exec_fetch(struct rsdb_table *data, const char *format, ...);
 void rsdb_exec_fetch_end(struct rsdb_table *data);
 
+struct rsdb_stmt *rsdb_prepare(const char *format, ...);
+void rsdb_stmt_exec(struct rsdb_stmt *stmt, int argc, const char **argv);
+void rsdb_stmt_fetch(struct rsdb_table *data, struct rsdb_stmt *stmt, int argc, const char **argv);
+
+void rsdb_batch_init(struct rsdb_batch *batch, const char *table, const char *columns, int ncols);
+void rsdb_batch_add(struct rsdb_batch *batch, const char **row);
+void rsdb_batch_flush(struct rsdb_batch *batch);
+
 void rsdb_transaction(rsdb_transtype type);
 /* rsdb_snprintf.c */
 
@@ -35,6 +35,19 @@
 #include <sqlite3.h>
 
 struct sqlite3 *rb_bandb;
+static char dbpath[PATH_MAX];
+
+/* prepared statements, cached by their sql text.  there are only ever
+ * a handful, and bantool runs without the block heap that rb_dictionary
+ * needs, so a plain list does */
+struct rsdb_stmt
+{
+	char *sql;
+	sqlite3_stmt *stmt;
+	struct rsdb_stmt *next;
+};
+
+static struct rsdb_stmt *stmt_cache;
 
 rsdb_error_cb *error_cb;
 
@@ -58,7 +71,6 @@ int
 rsdb_init(rsdb_error_cb * ecb)
 {
 	const char *bandb_dpath;
-	char dbpath[PATH_MAX];
 	char errbuf[128];
 	error_cb = ecb;
 
@@ -83,12 +95,37 @@ rsdb_init(rsdb_error_cb * ecb)
 		mlog(errbuf);
 		return -1;			
 	}
+
+	/* bandb and bantool may both have the database open, let sqlite
+	 * do the waiting rather than failing straight away */
+	sqlite3_busy_timeout(rb_bandb, RSDB_BUSY_TIMEOUT);
+
+	/* the write-ahead log lets a commit append rather than rewrite
+	 * pages, and keeps readers off the writer's back */
+	rsdb_exec(NULL, "PRAGMA journal_mode=WAL");
+	rsdb_exec(NULL, "PRAGMA synchronous=NORMAL");
 	return 0;
 }
 
+const char *
+rsdb_path(void)
+{
+	return dbpath;
+}
+
 void
 rsdb_shutdown(void)
 {
+	struct rsdb_stmt *rstmt;
+
+	while((rstmt = stmt_cache) != NULL)
+	{
+		stmt_cache = rstmt->next;
+		sqlite3_finalize(rstmt->stmt);
+		rb_free(rstmt->sql);
+		rb_free(rstmt);
+	}
+
 	if(rb_bandb)
 		sqlite3_close(rb_bandb);
 }
@@ -243,15 +280,263 @@ rsdb_exec_fetch(struct rsdb_table *table, const char *format, ...)
 void
 rsdb_exec_fetch_end(struct rsdb_table *table)
 {
-	int i;
+	int i, j;
 
 	for(i = 0; i < table->row_count; i++)
 	{
+		/* rows stepped out of a prepared statement own their values */
+		if(table->arg == NULL)
+		{
+			for(j = 0; j < table->col_count; j++)
+				rb_free(table->row[i][j]);
+		}
+
 		rb_free(table->row[i]);
 	}
 	rb_free(table->row);
 
-	sqlite3_free_table((char **)table->arg);
+	if(table->arg != NULL)
+		sqlite3_free_table((char **)table->arg);
+}
+
+static struct rsdb_stmt *
+rsdb_prepare_sql(const char *sql)
+{
+	struct rsdb_stmt *rstmt;
+	sqlite3_stmt *stmt;
+
+	for(rstmt = stmt_cache; rstmt != NULL; rstmt = rstmt->next)
+	{
+		if(!strcmp(rstmt->sql, sql))
+			return rstmt;
+	}
+
+	if(sqlite3_prepare_v2(rb_bandb, sql, -1, &stmt, NULL) != SQLITE_OK)
+	{
+		mlog("fatal error: problem with db file: %s", sqlite3_errmsg(rb_bandb));
+		return NULL;
+	}
+
+	rstmt = rb_malloc(sizeof(struct rsdb_stmt));
+	rstmt->sql = rb_strdup(sql);
+	rstmt->stmt = stmt;
+	rstmt->next = stmt_cache;
+	stmt_cache = rstmt;
+	return rstmt;
+}
+
+/*
+ * rsdb_prepare()
+ *
+ * Returns the prepared statement for the given sql, compiling it the
+ * first time it is seen.  Values are passed as '?' parameters when the
+ * statement is run, the format is only for table names and the like.
+ */
+struct rsdb_stmt *
+rsdb_prepare(const char *format, ...)
+{
+	static char buf[BUFSIZE * 4];
+	va_list args;
+	unsigned int i;
+
+	va_start(args, format);
+	i = rs_vsnprintf(buf, sizeof(buf), format, args);
+	va_end(args);
+
+	if(i >= sizeof(buf))
+	{
+		mlog("fatal error: length problem with compiling sql");
+		return NULL;
+	}
+
+	return rsdb_prepare_sql(buf);
+}
+
+static int
+rsdb_stmt_bind(struct rsdb_stmt *rstmt, int argc, const char **argv)
+{
+	int i;
+
+	for(i = 0; i < argc; i++)
+	{
+		if(sqlite3_bind_text(rstmt->stmt, i + 1, argv[i] ? argv[i] : "", -1,
+				     SQLITE_STATIC) != SQLITE_OK)
+		{
+			mlog("fatal error: problem with db file: %s", sqlite3_errmsg(rb_bandb));
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/* resets the statement so it holds neither locks nor our strings */
+static void
+rsdb_stmt_done(struct rsdb_stmt *rstmt)
+{
+	sqlite3_reset(rstmt->stmt);
+	sqlite3_clear_bindings(rstmt->stmt);
+}
+
+void
+rsdb_stmt_exec(struct rsdb_stmt *rstmt, int argc, const char **argv)
+{
+	int retval;
+
+	if(rstmt == NULL || !rsdb_stmt_bind(rstmt, argc, argv))
+		return;
+
+	while((retval = sqlite3_step(rstmt->stmt)) == SQLITE_ROW)
+		;
+
+	if(retval != SQLITE_DONE)
+		mlog("fatal error: problem with db file: %s", sqlite3_errmsg(rb_bandb));
+
+	rsdb_stmt_done(rstmt);
+}
+
+void
+rsdb_stmt_fetch(struct rsdb_table *table, struct rsdb_stmt *rstmt, int argc, const char **argv)
+{
+	const char *value;
+	int retval;
+	int alloc = 0;
+	int j;
+
+	table->row = NULL;
+	table->row_count = 0;
+	table->col_count = 0;
+	table->arg = NULL;
+
+	if(rstmt == NULL || !rsdb_stmt_bind(rstmt, argc, argv))
+		return;
+
+	table->col_count = sqlite3_column_count(rstmt->stmt);
+
+	while((retval = sqlite3_step(rstmt->stmt)) == SQLITE_ROW)
+	{
+		if(table->row_count == alloc)
+		{
+			alloc = alloc ? alloc * 2 : 64;
+			table->row = rb_realloc(table->row, sizeof(char **) * alloc);
+		}
+
+		table->row[table->row_count] = rb_malloc(sizeof(char *) * table->col_count);
+
+		for(j = 0; j < table->col_count; j++)
+		{
+			value = (const char *)sqlite3_column_text(rstmt->stmt, j);
+			table->row[table->row_count][j] = rb_strdup(value ? value : "");
+		}
+
+		table->row_count++;
+	}
+
+	if(retval != SQLITE_DONE)
+		mlog("fatal error: problem with db file: %s", sqlite3_errmsg(rb_bandb));
+
+	rsdb_stmt_done(rstmt);
+}
+
+void
+rsdb_batch_init(struct rsdb_batch *batch, const char *table, const char *columns, int ncols)
+{
+	lrb_assert(ncols <= RSDB_BATCH_MAXCOLS);
+
+	batch->table = table;
+	batch->columns = columns;
+	batch->ncols = ncols;
+	batch->rows = 0;
+	batch->full = NULL;
+	batch->single = NULL;
+}
+
+/*
+ * rsdb_batch_add()
+ *
+ * Queues a row for insertion, the values are copied.  Full batches go
+ * out as a single multi-row INSERT.
+ */
+void
+rsdb_batch_add(struct rsdb_batch *batch, const char **row)
+{
+	char **args = &batch->args[batch->rows * batch->ncols];
+	int i;
+
+	for(i = 0; i < batch->ncols; i++)
+		args[i] = rb_strdup(row[i] ? row[i] : "");
+
+	if(++batch->rows == RSDB_BATCH_ROWS)
+		rsdb_batch_flush(batch);
+}
+
+static struct rsdb_stmt *
+rsdb_batch_stmt(struct rsdb_batch *batch, int rows)
+{
+	char sql[BUFSIZE * 4];
+	char *p;
+	int i, j;
+
+	p = sql + rb_snprintf(sql, sizeof(sql), "INSERT INTO %s (%s) VALUES ",
+			      batch->table, batch->columns);
+
+	/* 64 rows of 8 placeholders is well inside the buffer */
+	for(i = 0; i < rows; i++)
+	{
+		if(i > 0)
+			*p++ = ',';
+
+		*p++ = '(';
+		for(j = 0; j < batch->ncols; j++)
+		{
+			if(j > 0)
+				*p++ = ',';
+			*p++ = '?';
+		}
+		*p++ = ')';
+	}
+	*p = '\0';
+
+	return rsdb_prepare_sql(sql);
+}
+
+/*
+ * rsdb_batch_flush()
+ *
+ * Inserts everything queued.  A full batch goes out in one statement,
+ * a partial one a row at a time, so each table only ever needs the
+ * two statements.
+ */
+void
+rsdb_batch_flush(struct rsdb_batch *batch)
+{
+	int i;
+
+	if(batch->rows == 0)
+		return;
+
+	if(batch->rows == RSDB_BATCH_ROWS)
+	{
+		if(batch->full == NULL)
+			batch->full = rsdb_batch_stmt(batch, RSDB_BATCH_ROWS);
+
+		rsdb_stmt_exec(batch->full, batch->rows * batch->ncols,
+			       (const char **)batch->args);
+	}
+	else
+	{
+		if(batch->single == NULL)
+			batch->single = rsdb_batch_stmt(batch, 1);
+
+		for(i = 0; i < batch->rows; i++)
+			rsdb_stmt_exec(batch->single, batch->ncols,
+				       (const char **)&batch->args[i * batch->ncols]);
+	}
+
+	for(i = 0; i < batch->rows * batch->ncols; i++)
+		rb_free(batch->args[i]);
+
+	batch->rows = 0;
 }
 
 void
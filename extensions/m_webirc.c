@@ -53,6 +53,7 @@
 #include "hash.h"
 #include "s_conf.h"
 #include "reject.h"
+#include "intern.h"
 
 static int mr_webirc(struct Client *, struct Client *, int, const char **);
 
@@ -119,9 +120,9 @@ mr_webirc(struct Client *client_p, struct Client *source_p, int parc, const char
 	rb_strlcpy(source_p->sockhost, parv[4], sizeof(source_p->sockhost));
 
 	if(strlen(parv[3]) <= HOSTLEN)
-		rb_strlcpy(source_p->host, parv[3], sizeof(source_p->host));
+		intern_set(&source_p->host, parv[3], HOSTLEN);
 	else
-		rb_strlcpy(source_p->host, source_p->sockhost, sizeof(source_p->host));
+		intern_set(&source_p->host, source_p->sockhost, HOSTLEN);
 	
 	rb_inet_pton_sock(parv[4], (struct sockaddr *)&source_p->localClient->ip);
 
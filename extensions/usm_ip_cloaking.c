@@ -41,6 +41,7 @@
 #include "s_user.h"
 #include "s_serv.h"
 #include "numeric.h"
+#include "intern.h"
 
 static int
 _modinit(void)
@@ -204,7 +205,7 @@ check_umode_change(void *vdata)
 		}
 		if (strcmp(source_p->host, source_p->localClient->mangledhost))
 		{
-			rb_strlcpy(source_p->host, source_p->localClient->mangledhost, HOSTLEN + 1);
+			intern_set(&source_p->host, source_p->localClient->mangledhost, HOSTLEN);
 			distribute_hostchange(source_p);
 		}
 		else /* not really nice, but we need to send this numeric here */
@@ -216,7 +217,7 @@ check_umode_change(void *vdata)
 		if (source_p->localClient->mangledhost != NULL &&
 				!strcmp(source_p->host, source_p->localClient->mangledhost))
 		{
-			rb_strlcpy(source_p->host, source_p->orighost, HOSTLEN + 1);
+			intern_set(&source_p->host, source_p->orighost, HOSTLEN);
 			distribute_hostchange(source_p);
 		}
 	}
@@ -241,7 +242,7 @@ check_new_user(void *vdata)
 		source_p->umodes &= ~user_modes['x'];
 	if (source_p->umodes & user_modes['x'])
 	{
-		rb_strlcpy(source_p->host, source_p->localClient->mangledhost, sizeof(source_p->host));
+		intern_set(&source_p->host, source_p->localClient->mangledhost, HOSTLEN);
 		if (irccmp(source_p->host, source_p->orighost))
 			SetDynSpoof(source_p);
 	}
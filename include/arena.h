@@ -0,0 +1,32 @@
+/*
+ * SporksIRCD: the ircd for discerning transsexual quilting bees.
+ * arena.h: scratch memory for command processing
+ *
+ * Copyright (C) 2011 SporksIRCD development team
+ */
+
+#ifndef INCLUDED_arena_h
+#define INCLUDED_arena_h
+
+/*
+ * The arena hands out short-lived scratch memory that never has to be
+ * freed individually.  parse() takes a mark before running a command
+ * handler and releases back to it afterwards, so anything a handler
+ * allocates here is gone once the command is done.  Code that runs
+ * outside of command processing must take its own mark.
+ */
+struct arena_mark
+{
+	void *chunk;
+	size_t used;
+};
+
+extern void init_arena(void);
+extern void *arena_alloc(size_t len);
+extern char *arena_strdup(const char *s);
+extern char *arena_sprintf(const char *format, ...) AFP(1, 2);
+extern void arena_mark(struct arena_mark *mark);
+extern void arena_release(const struct arena_mark *mark);
+extern void count_arena_memory(size_t *count, size_t *memory);
+
+#endif
@@ -0,0 +1,27 @@
+/*
+ * SporksIRCD: the ircd for discerning transsexual quilting bees.
+ * bandb_snapshot.h: binary ban snapshot shared by bandb and the ircd
+ *
+ * Copyright (C) 2011 SporksIRCD development team
+ */
+
+#ifndef INCLUDED_bandb_snapshot_h
+#define INCLUDED_bandb_snapshot_h
+
+/*
+ * Snapshot file layout, written by bandb/bandb.c and read by
+ * src/bandbi.c.  All integers are in host byte order, the file is only
+ * ever read back on the same host.
+ *
+ *   header:  magic, uint32 version, uint32 record count
+ *   record:  uint8 type letter, then mask1, mask2, oper and reason,
+ *            each as a uint16 length followed by the string and a NUL
+ */
+#define SNAPSHOT_MAGIC		"BNDB"
+#define SNAPSHOT_MAGIC_LEN	4
+#define SNAPSHOT_VERSION	1
+
+/* magic plus the version and record count */
+#define SNAPSHOT_HEADER_LEN	(SNAPSHOT_MAGIC_LEN + 2 * 4)
+
+#endif
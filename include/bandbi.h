@@ -16,4 +16,18 @@ void bandb_add(bandb_type, struct Client *source_p, const char *mask1,
 	       const char *mask2, const char *reason, const char *oper_reason, int perm);
 void bandb_del(bandb_type, const char *mask1, const char *mask2);
 void bandb_rehash_bans(void);
+
+struct bandb_rehash_stats
+{
+	time_t started;
+	time_t finished;		/* 0 while changes are still being applied */
+	unsigned long added;
+	unsigned long removed;
+	unsigned long updated;		/* reason changed, updated in place */
+	unsigned long unchanged;
+	unsigned long pending;		/* queued additions and removals */
+	unsigned long rehashes;
+};
+
+extern struct bandb_rehash_stats bandb_stats;
 #endif
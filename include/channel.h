@@ -38,6 +38,7 @@
 typedef bool (*is_valid_item)(struct Channel *, char *);
 
 struct Client;
+struct split_channel;
 
 /* mode structure for channels */
 struct Mode
@@ -82,6 +83,8 @@ struct Channel
 	unsigned long bants;
 	time_t channelts;
 	char *chname;
+
+	struct split_channel *split;	/* departing members during a netsplit */
 };
 
 struct membership
@@ -275,9 +278,12 @@ extern int get_channel_access(struct Client *source_p, struct membership *msptr)
 extern void add_user_to_channel(struct Channel *, struct Client *, int flags);
 extern void remove_user_from_channel(struct membership *);
 extern void remove_user_from_channels(struct Client *);
+extern void split_add_user(struct Client *);
+extern int split_remove_users(const char *comment);
 extern void invalidate_bancache_user(struct Client *);
 
 extern void free_channel_list(rb_dlink_list *);
+extern uint64_t channel_list_digest(rb_dlink_list *, uint64_t salt);
 
 extern int check_channel_name(const char *name);
 
@@ -342,5 +348,10 @@ extern struct Metadata *channel_metadata_find(struct Channel *target, const char
 extern void channel_metadata_clear(struct Channel *target);
 
 extern void send_channel_join(struct Channel *chptr, struct Client *client_p);
+extern void start_netjoin(struct Channel *chptr, struct Client *server_p);
+extern void send_netjoin(struct Channel *chptr, struct Client *client_p);
+extern void send_netjoin_mode(struct Channel *chptr, struct Client *source_p,
+			      const char *modes, const char *params);
+extern void end_netjoin(struct Channel *chptr);
 
 #endif /* INCLUDED_channel_h */
@@ -30,6 +30,15 @@ struct ConfItem;
 struct Client;
 struct _patricia_tree_t;
 
+/* number of subnet sizes a class may limit per address family */
+#define CIDR_LEVELS	4
+
+struct cidr_limit
+{
+	int bitlen;
+	int amount;
+};
+
 struct Class
 {
 	struct Class *next;
@@ -41,12 +50,17 @@ struct Class
 	int max_sendq;
 	int con_freq;
 	int ping_freq;
+	int ident_budget;
 	int total;
 	rb_patricia_tree_t *ip_limits;
 	int cidr_ipv4_bitlen;
 	int cidr_ipv6_bitlen;
 	int cidr_amount;
-
+	/* cidr_ipv*_bitlen/number_per_cidr plus class::cidr_ipv*_limits */
+	struct cidr_limit cidr_ipv4_limits[CIDR_LEVELS];
+	struct cidr_limit cidr_ipv6_limits[CIDR_LEVELS];
+	int cidr_ipv4_levels;
+	int cidr_ipv6_levels;
 };
 
 extern rb_dlink_list class_list;
@@ -59,12 +73,15 @@ extern struct Class *default_class;
 #define MaxIdent(x)	((x)->max_ident)
 #define MaxUsers(x)	((x)->max_total)
 #define PingFreq(x)     ((x)->ping_freq)
+#define IdentBudget(x)  ((x)->ident_budget)
 #define MaxSendq(x)     ((x)->max_sendq)
 #define CurrUsers(x)    ((x)->total)
 #define IpLimits(x)     ((x)->ip_limits)
 #define CidrIpv4Bitlen(x)   ((x)->cidr_ipv4_bitlen)
 #define CidrIpv6Bitlen(x)   ((x)->cidr_ipv6_bitlen)
 #define CidrAmount(x)	((x)->cidr_amount)
+#define CidrIpv4Levels(x)   ((x)->cidr_ipv4_levels)
+#define CidrIpv6Levels(x)   ((x)->cidr_ipv6_levels)
 #define ClassPtr(x)      ((x)->c_class)
 
 #define ConfClassName(x) (ClassPtr(x)->class_name)
@@ -74,6 +91,7 @@ extern struct Class *default_class;
 #define ConfMaxIdent(x)  (ClassPtr(x)->max_ident)
 #define ConfMaxUsers(x)  (ClassPtr(x)->max_total)
 #define ConfPingFreq(x)  (ClassPtr(x)->ping_freq)
+#define ConfIdentBudget(x) (ClassPtr(x)->ident_budget)
 #define ConfMaxSendq(x)  (ClassPtr(x)->max_sendq)
 #define ConfCurrUsers(x) (ClassPtr(x)->total)
 #define ConfIpLimits(x) (ClassPtr(x)->ip_limits)
@@ -95,5 +113,6 @@ extern void initclass(void);
 extern void free_class(struct Class *);
 extern void fix_class(struct ConfItem *, struct ConfItem *);
 extern void report_classes(struct Client *);
+extern struct cidr_limit *get_cidr_limits(struct Class *, int, int *);
 
 #endif /* INCLUDED_class_h */
@@ -72,6 +72,8 @@ struct AuthRequest;
 struct PreClient;
 struct ListClient;
 struct scache_entry;
+struct burst_state;
+struct burst_record;
 
 /*
  * Client structures
@@ -84,6 +86,7 @@ struct User
 	int refcnt;		/* Number of times this block is referenced */
 
 	struct rb_dictionary *metadata;
+	struct burst_record *burst;	/* serialized introduction, see burst_user() */
 
 	char suser[NICKLEN+1];
 };
@@ -130,6 +133,7 @@ struct Client
 	unsigned short status;	/* Client type */
 	unsigned char handler;	/* Handler index */
 	unsigned long serial;	/* used to enforce 1 send per nick */
+	unsigned long introduced;	/* introduce_count when it became a user */
 
 	/* client->name is the unique name for a client nick or host */
 	char name[HOSTLEN + 1];
@@ -146,11 +150,13 @@ struct Client
 	/*
 	 * client->host contains the resolved name or ip address
 	 * as a string for the user, it may be fiddled with for oper spoofing etc.
+	 * host, orighost and info are interned (see intern.h), never write
+	 * through them; use intern_set().
 	 */
-	char host[HOSTLEN + 1];	/* client's hostname */
-	char orighost[HOSTLEN + 1]; /* original hostname (before dynamic spoofing) */
+	const char *host;	/* client's hostname */
+	const char *orighost;	/* original hostname (before dynamic spoofing) */
 	char sockhost[HOSTIPLEN + 1]; /* clients ip */
-	char info[REALLEN + 1];	/* Free form additional client info */
+	const char *info;	/* Free form additional client info */
 
 	char id[IDLEN];	/* UID/SID, unique on the network */
 
@@ -194,6 +200,8 @@ struct LocalUser
 	/* Send and receive linebuf queues .. */
 	buf_head_t buf_sendq;
 	buf_head_t buf_recvq;
+	buf_head_t buf_sendq_control;	/* servers only, written before buf_sendq */
+	unsigned int eob_pong_left;	/* buf_sendq bytes ahead of our first PONG */
 	/*
 	 * we want to use unsigned int here so the sizes have a better chance of
 	 * staying the same on 64 bit machines. The current trend is to use
@@ -270,6 +278,7 @@ struct LocalUser
 	time_t target_last;		/* last time we cleared a slot */
 
 	struct ListClient *safelist_data;
+	struct burst_state *burst;	/* non-NULL while we burst to this server */
 
 	char *mangledhost; /* non-NULL if host mangling module loaded and
 			      applicable to this client */
@@ -408,6 +417,8 @@ struct ListClient
 #define LFLAGS_SSL		0x00000001
 #define LFLAGS_FLUSH		0x00000002
 #define LFLAGS_CORK		0x00000004
+#define LFLAGS_EOBPONG		0x00000008	/* our first PONG is in buf_sendq */
+#define LFLAGS_EOBPONGSENT	0x00000010	/* ... and written, PONGs may overtake */
 
 /* umodes, settable flags */
 /* lots of this moved to snomask -- jilles */
@@ -448,6 +459,7 @@ struct ListClient
 #define CLICAP_SASL		0x0002
 #define CLICAP_ACCOUNT_NOTIFY	0x0004
 #define CLICAP_EXTENDED_JOIN	0x0008
+#define CLICAP_BATCH		0x0010
 
 /*
  * flags macros.
@@ -496,6 +508,11 @@ struct ListClient
 #define SetFlush(x)		((x)->localClient->localflags |= LFLAGS_FLUSH)
 #define ClearFlush(x)		((x)->localClient->localflags &= ~LFLAGS_FLUSH)
 
+#define IsEobPong(x)		((x)->localClient->localflags & LFLAGS_EOBPONG)
+#define SetEobPong(x)		((x)->localClient->localflags |= LFLAGS_EOBPONG)
+#define IsEobPongSent(x)	((x)->localClient->localflags & LFLAGS_EOBPONGSENT)
+#define SetEobPongSent(x)	((x)->localClient->localflags |= LFLAGS_EOBPONGSENT)
+
 /* oper flags */
 #define MyOper(x)               (MyConnect(x) && IsOper(x))
 
@@ -565,11 +582,14 @@ struct ListClient
 #define SHOW_IP 1
 #define MASK_IP 2
 
+extern unsigned long introduce_count;
+
 extern void check_banned_lines(void);
 extern void check_klines_event(void *unused);
 extern void check_klines(void);
 extern void check_dlines(void);
 extern void check_xlines(void);
+extern void check_new_bans(rb_dlink_list *bans);
 
 extern const char *get_client_name(struct Client *client, int show_ip);
 extern const char *log_client_name(struct Client *, int);
@@ -66,6 +66,7 @@
 #define PPATH    ETCPATH "/ircd.pid"		   /* pid file */
 #define OPATH    ETCPATH "/opers.motd"		   /* oper MOTD file */
 #define DBPATH   ETCPATH "/ban.db"                 /* bandb file */
+#define WWPATH   ETCPATH "/whowas.db"              /* whowas history */
 
 /* IGNORE_BOGUS_TS
  * Ignore bogus timestamps from other servers. Yes this will desync
@@ -30,7 +30,6 @@ struct rb_dictionary;
 
 extern rb_dlink_list *clientTable;
 extern rb_dlink_list *channelTable;
-extern rb_dlink_list *idTable;
 extern rb_dlink_list *resvTable;
 extern rb_dlink_list *hostTable;
 extern rb_dlink_list *helpTable;
@@ -44,6 +43,9 @@ extern struct rb_dictionary *nd_dict;
 #define U_MAX_BITS 17
 #define U_MAX 131072 /* 2^17 */
 
+/* most ids reserve_id_hash() makes room for at once */
+#define ID_RESERVE_MAX (1 << 21)
+
 /* Client fd hash table size, used in hash.c */
 #define CLI_FD_MAX 4096
 
@@ -84,6 +86,7 @@ extern struct Client *find_named_client(const char *name);
 extern struct Client *find_server(struct Client *source_p, const char *name);
 
 extern void add_to_id_hash(const char *, struct Client *);
+extern void reserve_id_hash(unsigned long count);
 extern void del_from_id_hash(const char *name, struct Client *client);
 extern struct Client *find_id(const char *name);
 
@@ -43,6 +43,7 @@ void add_conf_by_address(const char *, int, const char *, const char *, struct C
 void delete_one_address_conf(const char *, struct ConfItem *);
 void clear_out_address_conf(void);
 void clear_out_address_conf_bans(void);
+void foreach_address_conf_ban(void (*)(struct ConfItem *, void *), void *);
 void init_host_hash(void);
 struct ConfItem *find_address_conf(const char *host, const char *sockhost, 
 				const char *, const char *, struct sockaddr *,
@@ -0,0 +1,23 @@
+/*
+ * SporksIRCD: the ircd for discerning transsexual quilting bees.
+ * intern.h: shared, reference counted strings
+ *
+ * Copyright (C) 2011 SporksIRCD development team
+ */
+
+#ifndef INCLUDED_intern_h
+#define INCLUDED_intern_h
+
+/*
+ * Interned strings are stored once no matter how many clients carry
+ * them, and two interned strings are equal exactly when their pointers
+ * are.  They are read-only; change a field by interning the new value
+ * with intern_set(), which also drops the reference to the old one.
+ */
+extern void init_intern(void);
+extern const char *intern_add(const char *str, size_t maxlen);
+extern void intern_del(const char *str);
+extern void intern_set(const char **field, const char *str, size_t maxlen);
+extern void count_intern_memory(size_t *count, size_t *memory, size_t *saved);
+
+#endif
@@ -31,5 +31,9 @@ void clear_monitor(struct Client *);
 
 void monitor_signon(struct Client *);
 void monitor_signoff(struct Client *);
+void monitor_signon_burst(struct Client *);
+
+/* introduced over a link still bursting, signed on when it is done */
+#define MonitorDeferred(x)	(!MyConnect(x) && !HasSentEob((x)->from))
 
 #endif
@@ -24,10 +24,14 @@ struct DNSReply
   struct rb_sockaddr_storage addr;
 };
 
+struct reslist;
+
 struct DNSQuery
 {
   void *ptr; /* pointer used by callback to identify request */
   void (*callback)(void* vptr, struct DNSReply *reply); /* callback to call */
+  struct reslist *request; /* private to res.c: lookup we're waiting on */
+  rb_dlink_node node;
 };
 
 extern struct rb_sockaddr_storage irc_nsaddr_list[];
@@ -35,7 +39,7 @@ extern int irc_nscount;
 
 extern void init_resolver(void);
 extern void restart_resolver(void);
-extern void delete_resolver_queries(const struct DNSQuery *);
+extern void delete_resolver_queries(struct DNSQuery *);
 extern void gethost_byname_type(const char *, struct DNSQuery *, int);
 extern void gethost_byaddr(const struct rb_sockaddr_storage *, struct DNSQuery *);
 extern void add_local_domain(char *, size_t);
@@ -183,6 +183,7 @@ struct config_file_entry
 	int kline_delay;
 	bool warn_no_nline;
 	int nick_delay;
+	int netsplit_slice;
 	bool non_redundant_klines;
 	bool stats_e_disabled;
 	bool stats_c_oper_only;
@@ -218,11 +219,14 @@ struct config_file_entry
 	bool disable_auth;
 	int connect_timeout;
 	bool burst_away;
+	bool burst_cache;
+	bool burst_cache_verify;
 	int reject_ban_time;
 	int reject_after_count;
 	int reject_duration;
 	int throttle_count;
 	int throttle_duration;
+	bool throttle_sketch;
 	bool target_change;
 	bool collision_fnc;
 	int default_umodes;
@@ -44,6 +44,7 @@
 struct Client;
 struct server_conf;
 struct Channel;
+struct User;
 
 /* Capabilities */
 struct Capability
@@ -76,6 +77,7 @@ struct Capability
 #define CAP_BAN		0x200000 /* supports propagated bans */
 #define CAP_MLOCK	0x400000 /* supports MLOCK messages */
 #define CAP_MS		0x800000 /* supports MODESUPPORT message */
+#define CAP_BDIG	0x1000000 /* supports BDIG and BREQ (ban list digests) */
 
 #ifdef HAVE_LIBZ
 #define CAP_ZIP_SUPPORTED       CAP_ZIP
@@ -100,6 +102,33 @@ struct Capability
  */
 extern rb_dlink_list caplist;
 
+/*
+ * state of a burst being streamed to a newly linked server, see
+ * burst_TS6()
+ */
+struct burst_state
+{
+	rb_dlink_node node;
+	struct Client *client_p;
+	rb_dlink_node *user_ptr;	/* next client to send, NULL when done */
+	rb_dlink_node *chan_ptr;	/* next channel to send, NULL when done */
+	unsigned long mark;		/* introduce_count when the burst began */
+	unsigned int users;
+	unsigned int channels;
+	unsigned int total_users;
+	unsigned int total_channels;
+	time_t started;
+	buf_head_t held;		/* other traffic for the link, sent after */
+	struct rb_dictionary *freed;	/* nicks given up meanwhile, or NULL */
+	uint64_t salt;			/* for the BDIG digests */
+	bool generating;
+};
+
+/* burst no more than this far ahead of what the link has taken */
+#define BURST_SENDQ_MAX	(1024 * 1024)
+
+extern rb_dlink_list burst_list;
+
 extern int MaxClientCount;	/* GLOBAL - highest number of clients */
 extern int MaxConnectionCount;	/* GLOBAL - highest number of connections */
 
@@ -134,4 +163,16 @@ extern int serv_connect(struct server_conf *, struct Client *);
 extern void burst_modes_TS6(struct Client *client_p, struct Channel *chptr,
 			    rb_dlink_list *list, char flag);
 
+extern void burst_continue(struct Client *client_p);
+extern void burst_cancel(struct Client *client_p);
+extern void burst_client_removed(struct Client *target_p);
+extern void burst_nick_freed(const char *name);
+extern void burst_channel_removed(struct Channel *chptr);
+extern void burst_record_clear(struct Client *target_p);
+extern void burst_record_free(struct User *user);
+extern void count_burst_records(size_t *count, size_t *mem, unsigned long *reused,
+				unsigned long *built);
+
+extern unsigned long burst_generation;
+
 #endif /* INCLUDED_s_serv_h */
@@ -33,6 +33,13 @@ struct User;
 struct oper_conf;
 extern time_t LastUsedWallops;
 
+/* Give all UID nicks the same TS. This ensures nick TS is always the same on
+ * all servers for each nick-user pair, also if a user with a UID nick changes
+ * their nick but is collided again (the server detecting the collision will
+ * not propagate the nick change further). -- jilles
+ */
+#define SAVE_NICKTS 100
+
 extern bool valid_hostname(const char *hostname);
 extern bool valid_username(const char *username);
 
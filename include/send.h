@@ -45,6 +45,8 @@ extern void send_queued(struct Client *to);
 
 extern void sendto_one(struct Client *target_p, const char *, ...) AFP(2, 3);
 extern void sendto_one_notice(struct Client *target_p,const char *, ...) AFP(2, 3);
+extern void sendto_one_linebuf(struct Client *target_p, buf_head_t *linebuf);
+extern void sendto_one_buffer(struct Client *target_p, char *data, int len);
 extern void sendto_one_prefix(struct Client *target_p, struct Client *source_p,
 			      const char *command, const char *, ...) AFP(4, 5);
 extern void sendto_one_numeric(struct Client *target_p,
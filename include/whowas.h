@@ -45,6 +45,11 @@ struct Client;
   also removed away information. *tough*
   - Dianora
  */
+/*
+ * the array lives in WWPATH so history survives a restart.  everything
+ * up to logoff is kept as is, the pointers below it are rebuilt when the
+ * file is loaded.  hashv is -1 for an unused (or half written) slot.
+ */
 struct Whowas
 {
 	int hashv;
@@ -54,7 +59,7 @@ struct Whowas
 	char sockhost[HOSTIPLEN + 1];
 	char realname[REALLEN + 1];
 	char suser[NICKLEN + 1];
-	const char *servername;
+	char servername[HOSTLEN + 1];
 	time_t logoff;
 	struct Client *online;	/* Pointer to new nickname for chasing or NULL */
 	struct Whowas *next;	/* for hash table... */
@@ -102,7 +107,7 @@ struct Client *get_history(const char *, time_t);
 void count_whowas_memory(size_t *, size_t *);
 
 /* XXX m_whowas.c in modules needs these */
-extern struct Whowas WHOWAS[];
+extern struct Whowas *WHOWAS;
 extern struct Whowas *WHOWASHASH[];
 extern unsigned int hash_whowas_name(const char *name);
 
@@ -38,10 +38,11 @@ struct rb_dictionary
 
 struct rb_dictionaryElement
 {
-	struct rb_dictionaryElement *left, *right, *prev, *next;
+	struct rb_dictionaryElement *left, *right, *parent, *prev, *next;
 	void *data;
 	const char *key;
 	int position;
+	int height;
 };
 
 struct rb_dictionaryIter
@@ -53,7 +53,19 @@
  * the block and return it back to the OS, thus causing our memory consumption to go
  * down after we no longer need it.
  * 
+ * Each block keeps a bitmap of its free elements rather than threading the
+ * free elements onto a list, and the blocks of a heap are kept on one of
+ * three lists according to how full they are.  Allocations are satisfied
+ * from partially used blocks first, in the order they became partially
+ * used, and take the lowest free element of the block, so that live
+ * elements stay packed together and blocks emptied by a mass exit can
+ * actually become entirely free.  Where madvise(MADV_DONTNEED) is
+ * available the garbage collector only releases the pages of idle blocks;
+ * the blocks are never unmapped, so reusing one later costs page faults
+ * instead of a fresh mmap().  Elsewhere idle blocks are freed, keeping
+ * the heap's last block.
  *
+ * The allocator is not thread safe; nothing in libratbox uses threads.
  *
  */
 #include <libratbox_config.h>
@@ -73,6 +85,9 @@
 
 static uintptr_t offset_pad;
 
+#define BH_MAP_BITS	(sizeof(unsigned long) * 8)
+#define BH_MAP_WORDS(n)	(((n) + BH_MAP_BITS - 1) / BH_MAP_BITS)
+
 /* status information for an allocated block in heap */
 struct rb_heap_block
 {
@@ -80,6 +95,9 @@ struct rb_heap_block
 	rb_dlink_node node;
 	unsigned long free_count;
 	void *elems;		/* Points to allocated memory */
+	unsigned long hint;	/* lowest freemap word that may have a free bit */
+	int released;		/* pages have been given back to the OS */
+	unsigned long freemap[1];	/* bit set == element free, sized at runtime */
 };
 typedef struct rb_heap_block rb_heap_block;
 
@@ -89,11 +107,18 @@ struct rb_bh
 	rb_dlink_node hlist;
 	size_t elemSize;	/* Size of each element to be stored */
 	unsigned long elemsPerBlock;	/* Number of elements per block */
-	rb_dlink_list block_list;
-	rb_dlink_list free_list;
+	rb_dlink_list full_list;	/* blocks with no free elements */
+	rb_dlink_list partial_list;	/* blocks with some free elements */
+	rb_dlink_list empty_list;	/* blocks with no used elements */
+	unsigned long free_count;	/* free elements over all blocks */
+	unsigned long released_count;	/* blocks whose pages were released */
 	char *desc;
 };
 
+#define rb_bh_block_count(bh) (rb_dlink_list_length(&(bh)->full_list) + \
+			       rb_dlink_list_length(&(bh)->partial_list) + \
+			       rb_dlink_list_length(&(bh)->empty_list))
+
 #ifndef NOBALLOC
 static int newblock(rb_bh *bh);
 static void rb_bh_gc_event(void *unused);
@@ -134,6 +159,67 @@ free_block(void *ptr, size_t size)
 #endif
 #endif
 }
+
+/*
+ * static inline void release_block(rb_bh *bh, rb_heap_block *b)
+ *
+ * Inputs: The heap and an entirely free block of it
+ * Output: None
+ * Side Effects: The pages behind the block are given back to the OS.
+ *		 With madvise() the block stays on the heap, otherwise it
+ *		 is removed and freed unless it is the heap's last block.
+ */
+static inline void
+release_block(rb_bh *bh, rb_heap_block *b)
+{
+#if defined(HAVE_MMAP) && defined(MADV_DONTNEED)
+	if(b->released)
+		return;
+	if(madvise(b->elems, b->alloc_size, MADV_DONTNEED) == 0)
+	{
+		b->released = 1;
+		bh->released_count++;
+	}
+#else
+	if(rb_bh_block_count(bh) == 1)
+		return;
+	rb_dlinkDelete(&b->node, &bh->empty_list);
+	bh->free_count -= bh->elemsPerBlock;
+	free_block(b->elems, b->alloc_size);
+	rb_free(b);
+#endif
+}
+
+/*
+ * static inline unsigned long first_free(rb_bh *bh, rb_heap_block *b)
+ *
+ * Inputs: The heap and a block with at least one free element
+ * Output: Index of the lowest free element in the block
+ * Side Effects: The block's search hint is advanced
+ */
+static inline unsigned long
+first_free(rb_bh *bh, rb_heap_block *b)
+{
+	unsigned long words = BH_MAP_WORDS(bh->elemsPerBlock);
+	unsigned long i, bit, word;
+
+	for(i = b->hint; i < words; i++)
+	{
+		word = b->freemap[i];
+		if(word == 0)
+			continue;
+		b->hint = i;
+#if defined(__GNUC__)
+		bit = __builtin_ctzl(word);
+#else
+		for(bit = 0; !(word & (1UL << bit)); bit++)
+			;
+#endif
+		return i * BH_MAP_BITS + bit;
+	}
+	rb_bh_fail("free element missing from block free map");
+	return 0;
+}
 #endif /* !NOBALLOC */
 
 /*
@@ -229,29 +315,30 @@ static int
 newblock(rb_bh *bh)
 {
 	rb_heap_block *b;
-	unsigned long i;
-	uintptr_t offset;
-	rb_dlink_node *node;
+	unsigned long i, words;
+
 	/* Setup the initial data structure. */
-	b = rb_malloc(sizeof(rb_heap_block));
+	words = BH_MAP_WORDS(bh->elemsPerBlock);
+	b = rb_malloc(sizeof(rb_heap_block) + (words - 1) * sizeof(unsigned long));
 
 	b->alloc_size = bh->elemsPerBlock * bh->elemSize;
 
 	b->elems = get_block(b->alloc_size);
 	if(rb_unlikely(b->elems == NULL))
 	{
+		rb_free(b);
 		return (1);
 	}
-	offset = (uintptr_t)b->elems;
-	/* Setup our blocks now */
-	for(i = 0; i < bh->elemsPerBlock; i++, offset += bh->elemSize)
-	{
-		*((void **)offset) = b;
-		node = (void *)(offset + offset_pad);
-		rb_dlinkAdd((void *)offset, node, &bh->free_list);
-	}
-	rb_dlinkAdd(b, &b->node, &bh->block_list);
+
+	/* every element starts out free */
+	for(i = 0; i < words; i++)
+		b->freemap[i] = ~0UL;
+	if(bh->elemsPerBlock % BH_MAP_BITS)
+		b->freemap[words - 1] = (1UL << (bh->elemsPerBlock % BH_MAP_BITS)) - 1;
+
+	rb_dlinkAdd(b, &b->node, &bh->empty_list);
 	b->free_count = bh->elemsPerBlock;
+	bh->free_count += bh->elemsPerBlock;
 	return (0);
 }
 #endif /* !NOBALLOC */
@@ -339,9 +426,9 @@ void *
 rb_bh_alloc(rb_bh *bh)
 {
 #ifndef NOBALLOC
-	rb_dlink_node *new_node;
-	rb_heap_block **block;
-	void *ptr;
+	rb_heap_block *b;
+	unsigned long i;
+	void *data, *ptr;
 #endif
 	lrb_assert(bh != NULL);
 	if(rb_unlikely(bh == NULL))
@@ -352,28 +439,48 @@ rb_bh_alloc(rb_bh *bh)
 #ifdef NOBALLOC
 	return (rb_malloc(bh->elemSize));
 #else
-	if(bh->free_list.head == NULL)
+	if(bh->partial_list.head != NULL)
+		b = bh->partial_list.head->data;
+	else
 	{
-		/* Allocate new block and assign */
-		/* newblock returns 1 if unsuccessful, 0 if not */
-
-		if(rb_unlikely(newblock(bh)))
+		if(bh->empty_list.head == NULL)
 		{
-			rb_lib_log("newblock() failed");
-			rb_outofmemory();	/* Well that didn't work either...bail */
+			/* Allocate new block and assign */
+			/* newblock returns 1 if unsuccessful, 0 if not */
+
+			if(rb_unlikely(newblock(bh)))
+			{
+				rb_lib_log("newblock() failed");
+				rb_outofmemory();	/* Well that didn't work either...bail */
+			}
 		}
-		if(bh->free_list.head == NULL)
+		b = bh->empty_list.head->data;
+		if(b->released)
 		{
-			rb_lib_log("out of memory after newblock()...");
-			rb_outofmemory();
+			/* pages come back zero filled on first touch */
+			b->released = 0;
+			bh->released_count--;
 		}
 	}
 
-	new_node = bh->free_list.head;
-	block = (rb_heap_block **) new_node->data;
-	ptr = (void *)((uintptr_t)new_node->data + (uintptr_t)offset_pad);
-	rb_dlinkDelete(new_node, &bh->free_list);
-	(*block)->free_count--;
+	i = first_free(bh, b);
+	b->freemap[i / BH_MAP_BITS] &= ~(1UL << (i % BH_MAP_BITS));
+
+	if(b->free_count-- == bh->elemsPerBlock)
+	{
+		rb_dlinkDelete(&b->node, &bh->empty_list);
+		rb_dlinkAddTail(b, &b->node, b->free_count ? &bh->partial_list : &bh->full_list);
+	}
+	else if(b->free_count == 0)
+	{
+		rb_dlinkDelete(&b->node, &bh->partial_list);
+		rb_dlinkAdd(b, &b->node, &bh->full_list);
+	}
+	bh->free_count--;
+
+	data = (void *)((uintptr_t)b->elems + i * bh->elemSize);
+	*((rb_heap_block **) data) = b;
+	ptr = (void *)((uintptr_t)data + (uintptr_t)offset_pad);
 	memset(ptr, 0, bh->elemSize - offset_pad);
 	return (ptr);
 #endif
@@ -396,6 +503,7 @@ rb_bh_free(rb_bh *bh, void *ptr)
 {
 #ifndef NOBALLOC
 	rb_heap_block *block;
+	unsigned long i, word, mask;
 	void *data;
 #endif
 	lrb_assert(bh != NULL);
@@ -425,9 +533,31 @@ rb_bh_free(rb_bh *bh, void *ptr)
 	{
 		rb_bh_fail("rb_bh_free() bogus pointer");
 	}
-	block->free_count++;
 
-	rb_dlinkAdd(data, (rb_dlink_node *)ptr, &bh->free_list);
+	i = ((uintptr_t)data - (uintptr_t)block->elems) / bh->elemSize;
+	word = i / BH_MAP_BITS;
+	mask = 1UL << (i % BH_MAP_BITS);
+	if(rb_unlikely(block->freemap[word] & mask))
+		rb_bh_fail("rb_bh_free() element already free");
+
+	block->freemap[word] |= mask;
+	if(word < block->hint)
+		block->hint = word;
+
+	if(block->free_count++ == 0)
+	{
+		rb_dlinkDelete(&block->node, &bh->full_list);
+		if(block->free_count == bh->elemsPerBlock)
+			rb_dlinkAdd(block, &block->node, &bh->empty_list);
+		else
+			rb_dlinkAddTail(block, &block->node, &bh->partial_list);
+	}
+	else if(block->free_count == bh->elemsPerBlock)
+	{
+		rb_dlinkDelete(&block->node, &bh->partial_list);
+		rb_dlinkAdd(block, &block->node, &bh->empty_list);
+	}
+	bh->free_count++;
 #endif /* !NOBALLOC */
 	return (0);
 }
@@ -454,11 +584,20 @@ rb_bh_destroy(rb_bh *bh)
 		return (1);
 
 #ifndef NOBALLOC
-	RB_DLINK_FOREACH_SAFE(ptr, next, bh->block_list.head)
+	rb_dlink_list *lists[3];
+	int i;
+
+	lists[0] = &bh->full_list;
+	lists[1] = &bh->partial_list;
+	lists[2] = &bh->empty_list;
+	for(i = 0; i < 3; i++)
 	{
-		b = ptr->data;
-		free_block(b->elems, b->alloc_size);
-		rb_free(b);
+		RB_DLINK_FOREACH_SAFE(ptr, next, lists[i]->head)
+		{
+			b = ptr->data;
+			free_block(b->elems, b->alloc_size);
+			rb_free(b);
+		}
 	}
 #endif /* !NOBALLOC */
 
@@ -469,6 +608,22 @@ rb_bh_destroy(rb_bh *bh)
 	return (0);
 }
 
+/*
+ * rb_bh_counts - elements in use and resident free elements in a heap.
+ * Blocks whose pages have been released do not count as free memory.
+ */
+static void
+rb_bh_counts(rb_bh *bh, size_t *used, size_t *freem)
+{
+#ifndef NOBALLOC
+	*used = rb_bh_block_count(bh) * bh->elemsPerBlock - bh->free_count;
+	*freem = bh->free_count - bh->released_count * bh->elemsPerBlock;
+#else
+	*used = 0;
+	*freem = 0;
+#endif
+}
+
 void
 rb_bh_usage(rb_bh *bh, size_t *bused, size_t *bfree, size_t *bmemusage, const char **desc)
 {
@@ -480,8 +635,7 @@ rb_bh_usage(rb_bh *bh, size_t *bused, size_t *bfree, size_t *bmemusage, const ch
 		return;
 	}
 
-	freem = rb_dlink_list_length(&bh->free_list);
-	used = (rb_dlink_list_length(&bh->block_list) * bh->elemsPerBlock) - freem;
+	rb_bh_counts(bh, &used, &freem);
 	memusage = used * bh->elemSize;
 	if(bused != NULL)
 		*bused = used;
@@ -518,8 +672,7 @@ rb_bh_usage_all(rb_bh_usage_cb *cb, void *data)
 	RB_DLINK_FOREACH(ptr, heap_lists->head)
 	{
 		bh = (rb_bh *)ptr->data;
-		freem = rb_dlink_list_length(&bh->free_list);
-		used = (rb_dlink_list_length(&bh->block_list) * bh->elemsPerBlock) - freem;
+		rb_bh_counts(bh, &used, &freem);
 		memusage = used * bh->elemSize;
 		heapalloc = (freem + used) * bh->elemSize;
 		if(bh->desc != NULL)
@@ -539,8 +692,7 @@ rb_bh_total_usage(size_t *total_alloc, size_t *total_used)
 	RB_DLINK_FOREACH(ptr, heap_lists->head)
 	{
 		bh = (rb_bh *)ptr->data;
-		freem = rb_dlink_list_length(&bh->free_list);
-		used = (rb_dlink_list_length(&bh->block_list) * bh->elemsPerBlock) - freem;
+		rb_bh_counts(bh, &used, &freem);
 		used_memory += used * bh->elemSize;
 		total_memory += (freem + used) * bh->elemSize;
 	}
@@ -557,8 +709,6 @@ rb_bh_gc(rb_bh *bh)
 {
 	rb_heap_block *b;
 	rb_dlink_node *ptr, *next;
-	unsigned long i;
-	uintptr_t offset;
 
 	if(bh == NULL)
 	{
@@ -566,34 +716,16 @@ rb_bh_gc(rb_bh *bh)
 		return (1);
 	}
 
-	if((rb_dlink_list_length(&bh->free_list) < bh->elemsPerBlock)
-	   || rb_dlink_list_length(&bh->block_list) == 1)
+	if(rb_dlink_list_length(&bh->empty_list) == bh->released_count)
 	{
-		/* There couldn't possibly be an entire free block.  Return. */
+		/* There isn't an idle block we haven't already dealt with. */
 		return (0);
 	}
 
-	RB_DLINK_FOREACH_SAFE(ptr, next, bh->block_list.head)
+	RB_DLINK_FOREACH_SAFE(ptr, next, bh->empty_list.head)
 	{
 		b = ptr->data;
-		if(rb_dlink_list_length(&bh->block_list) == 1)
-			return (0);
-
-		if(b->free_count == bh->elemsPerBlock)
-		{
-			/* i'm seriously going to hell for this.. */
-
-			offset = (uintptr_t)b->elems;
-			for(i = 0; i < bh->elemsPerBlock; i++, offset += (uintptr_t)bh->elemSize)
-			{
-				rb_dlinkDelete((rb_dlink_node *)(offset + offset_pad),
-					       &bh->free_list);
-			}
-			rb_dlinkDelete(&b->node, &bh->block_list);
-			free_block(b->elems, b->alloc_size);
-			rb_free(b);
-		}
-
+		release_block(bh, b);
 	}
 	return (0);
 }
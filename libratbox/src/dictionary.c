@@ -25,6 +25,10 @@
 #include <libratbox_config.h>
 #include <ratbox_lib.h>
 
+/*
+ * Elements are kept in an AVL tree, threaded with a sorted doubly
+ * linked list for iteration.  Lookups never modify the tree.
+ */
 static rb_bh *elem_heap = NULL;
 
 /*
@@ -183,95 +187,134 @@ rb_dictionary_get_linear_index(struct rb_dictionary *dict, const char *key)
 }
 
 /*
- * rb_dictionary_retune(struct rb_dictionary *dict, const char *key)
+ * rb_dictionary_height(struct rb_dictionaryElement *delem)
  *
- * Retunes the tree, self-optimizing for the element which belongs to key.
+ * Returns the height of the subtree rooted at delem, zero for an
+ * empty subtree.
+ */
+static inline int
+rb_dictionary_height(struct rb_dictionaryElement *delem)
+{
+	return delem != NULL ? delem->height : 0;
+}
+
+static inline void
+rb_dictionary_fix_height(struct rb_dictionaryElement *delem)
+{
+	int lh = rb_dictionary_height(delem->left);
+	int rh = rb_dictionary_height(delem->right);
+
+	delem->height = (lh > rh ? lh : rh) + 1;
+}
+
+/*
+ * rb_dictionary_replace_child(struct rb_dictionary *dict,
+ *     struct rb_dictionaryElement *parent,
+ *     struct rb_dictionaryElement *old,
+ *     struct rb_dictionaryElement *new)
+ *
+ * Points whichever link referred to old (a child pointer of parent,
+ * or the root of the tree) at new instead.
+ */
+static void
+rb_dictionary_replace_child(struct rb_dictionary *dict, struct rb_dictionaryElement *parent,
+			    struct rb_dictionaryElement *old, struct rb_dictionaryElement *new)
+{
+	if(parent == NULL)
+		dict->root = new;
+	else if(parent->left == old)
+		parent->left = new;
+	else
+		parent->right = new;
+}
+
+static struct rb_dictionaryElement *
+rb_dictionary_rotate_left(struct rb_dictionary *dict, struct rb_dictionaryElement *node)
+{
+	struct rb_dictionaryElement *pivot = node->right;
+
+	node->right = pivot->left;
+	if(pivot->left != NULL)
+		pivot->left->parent = node;
+
+	pivot->parent = node->parent;
+	rb_dictionary_replace_child(dict, node->parent, node, pivot);
+
+	pivot->left = node;
+	node->parent = pivot;
+
+	rb_dictionary_fix_height(node);
+	rb_dictionary_fix_height(pivot);
+
+	return pivot;
+}
+
+static struct rb_dictionaryElement *
+rb_dictionary_rotate_right(struct rb_dictionary *dict, struct rb_dictionaryElement *node)
+{
+	struct rb_dictionaryElement *pivot = node->left;
+
+	node->left = pivot->right;
+	if(pivot->right != NULL)
+		pivot->right->parent = node;
+
+	pivot->parent = node->parent;
+	rb_dictionary_replace_child(dict, node->parent, node, pivot);
+
+	pivot->right = node;
+	node->parent = pivot;
+
+	rb_dictionary_fix_height(node);
+	rb_dictionary_fix_height(pivot);
+
+	return pivot;
+}
+
+/*
+ * rb_dictionary_rebalance(struct rb_dictionary *dict,
+ *     struct rb_dictionaryElement *node)
+ *
+ * Restores the AVL invariant on the path from node up to the root,
+ * after an element has been linked below, or unlinked from below, node.
  *
  * Inputs:
- *     - node to begin search from
+ *     - dictionary tree
+ *     - lowest element whose subtree changed
  *
  * Outputs:
- *     - none
+ *     - nothing
  *
  * Side Effects:
- *     - a new root node is nominated.
+ *     - subtree heights are updated and rotations are done where the
+ *       two sides of an element differ in height by more than one.
  */
 static void
-rb_dictionary_retune(struct rb_dictionary *dict, const char *key)
+rb_dictionary_rebalance(struct rb_dictionary *dict, struct rb_dictionaryElement *node)
 {
-	struct rb_dictionaryElement n, *tn, *left, *right, *node;
-	int ret;
-
-	lrb_assert(dict != NULL);
+	int balance;
 
-	if(dict->root == NULL)
-		return;
-
-	/*
-	 * we initialize n with known values, since it's on stack
-	 * memory. otherwise the dict would become corrupted.
-	 *
-	 * n is used for temporary storage while the tree is retuned.
-	 *    -nenolod
-	 */
-	n.left = n.right = NULL;
-	left = right = &n;
-
-	/* this for(;;) loop is the main workhorse of the rebalancing */
-	for(node = dict->root;;)
+	while(node != NULL)
 	{
-		if((ret = dict->compare_cb(key, node->key)) == 0)
-			break;
+		rb_dictionary_fix_height(node);
+		balance = rb_dictionary_height(node->left) - rb_dictionary_height(node->right);
 
-		if(ret < 0)
+		if(balance > 1)
 		{
-			if(node->left == NULL)
-				break;
-
-			if((ret = dict->compare_cb(key, node->left->key)) < 0)
-			{
-				tn = node->left;
-				node->left = tn->right;
-				tn->right = node;
-				node = tn;
-
-				if(node->left == NULL)
-					break;
-			}
-
-			right->left = node;
-			right = node;
-			node = node->left;
+			if(rb_dictionary_height(node->left->left) <
+			   rb_dictionary_height(node->left->right))
+				rb_dictionary_rotate_left(dict, node->left);
+			node = rb_dictionary_rotate_right(dict, node);
 		}
-		else
+		else if(balance < -1)
 		{
-			if(node->right == NULL)
-				break;
-
-			if((ret = dict->compare_cb(key, node->right->key)) > 0)
-			{
-				tn = node->right;
-				node->right = tn->left;
-				tn->left = node;
-				node = tn;
-
-				if(node->right == NULL)
-					break;
-			}
-
-			left->right = node;
-			left = node;
-			node = node->right;
+			if(rb_dictionary_height(node->right->right) <
+			   rb_dictionary_height(node->right->left))
+				rb_dictionary_rotate_right(dict, node->right);
+			node = rb_dictionary_rotate_left(dict, node);
 		}
-	}
 
-	left->right = node->left;
-	right->left = node->right;
-
-	node->left = n.right;
-	node->right = n.left;
-
-	dict->root = node;
+		node = node->parent;
+	}
 }
 
 /*
@@ -280,138 +323,149 @@ rb_dictionary_retune(struct rb_dictionary *dict, const char *key)
  *
  * Links a dictionary tree element to the dictionary.
  *
- * When we add new nodes to the tree, it becomes the
- * next nominated root. This is perhaps not a wise
- * optimization because of automatic retuning, but
- * it keeps the code simple.
+ * The element is attached as a leaf, threaded into the ordered
+ * list next to its parent, and the tree is rebalanced on the way
+ * back up.
  *
  * Inputs:
  *     - dictionary tree
  *     - dictionary tree element
  *
  * Outputs:
- *     - nothing
+ *     - the element now holding the key; this is an existing element
+ *       (and delem is released) if the key was already present.
  *
  * Side Effects:
  *     - a node is linked to the dictionary tree
  */
-static void
+static struct rb_dictionaryElement *
 rb_dictionary_link(struct rb_dictionary *dict, struct rb_dictionaryElement *delem)
 {
+	struct rb_dictionaryElement *parent = NULL, *node;
+	int ret = 0;
+
 	lrb_assert(dict != NULL);
 	lrb_assert(delem != NULL);
 
-	dict->dirty = TRUE;
+	for(node = dict->root; node != NULL;)
+	{
+		if((ret = dict->compare_cb(delem->key, node->key)) == 0)
+		{
+			node->key = delem->key;
+			node->data = delem->data;
+
+			rb_bh_free(elem_heap, delem);
+			return node;
+		}
+
+		parent = node;
+		node = ret < 0 ? node->left : node->right;
+	}
 
+	dict->dirty = TRUE;
 	dict->count++;
 
-	if(dict->root == NULL)
+	delem->left = delem->right = NULL;
+	delem->parent = parent;
+	delem->height = 1;
+
+	if(parent == NULL)
 	{
-		delem->left = delem->right = NULL;
 		delem->next = delem->prev = NULL;
 		dict->head = dict->tail = dict->root = delem;
+		return delem;
 	}
-	else
-	{
-		int ret;
 
-		rb_dictionary_retune(dict, delem->key);
+	if(ret < 0)
+	{
+		parent->left = delem;
 
-		if((ret = dict->compare_cb(delem->key, dict->root->key)) < 0)
-		{
-			delem->left = dict->root->left;
-			delem->right = dict->root;
-			dict->root->left = NULL;
-
-			if(dict->root->prev)
-				dict->root->prev->next = delem;
-			else
-				dict->head = delem;
-
-			delem->prev = dict->root->prev;
-			delem->next = dict->root;
-			dict->root->prev = delem;
-			dict->root = delem;
-		}
-		else if(ret > 0)
-		{
-			delem->right = dict->root->right;
-			delem->left = dict->root;
-			dict->root->right = NULL;
-
-			if(dict->root->next)
-				dict->root->next->prev = delem;
-			else
-				dict->tail = delem;
-
-			delem->next = dict->root->next;
-			delem->prev = dict->root;
-			dict->root->next = delem;
-			dict->root = delem;
-		}
+		delem->prev = parent->prev;
+		delem->next = parent;
+		if(parent->prev != NULL)
+			parent->prev->next = delem;
 		else
-		{
-			dict->root->key = delem->key;
-			dict->root->data = delem->data;
-			dict->count--;
+			dict->head = delem;
+		parent->prev = delem;
+	}
+	else
+	{
+		parent->right = delem;
 
-			rb_bh_free(elem_heap, delem);
-		}
+		delem->next = parent->next;
+		delem->prev = parent;
+		if(parent->next != NULL)
+			parent->next->prev = delem;
+		else
+			dict->tail = delem;
+		parent->next = delem;
 	}
+
+	rb_dictionary_rebalance(dict, parent);
+
+	return delem;
 }
 
 /*
- * rb_dictionary_unlink_root(struct rb_dictionary *dict)
+ * rb_dictionary_unlink(struct rb_dictionary *dict,
+ *     struct rb_dictionaryElement *delem)
  *
- * Unlinks the root dictionary tree element from the dictionary.
+ * Unlinks a dictionary tree element from the dictionary.
  *
  * Inputs:
  *     - dictionary tree
+ *     - dictionary tree element
  *
  * Outputs:
  *     - nothing
  *
  * Side Effects:
- *     - the root node is unlinked from the dictionary tree
+ *     - the node is unlinked from the dictionary tree
  */
 static void
-rb_dictionary_unlink_root(struct rb_dictionary *dict)
+rb_dictionary_unlink(struct rb_dictionary *dict, struct rb_dictionaryElement *delem)
 {
-	struct rb_dictionaryElement *delem, *nextnode, *parentofnext;
+	struct rb_dictionaryElement *nextnode, *child, *start;
 
 	dict->dirty = TRUE;
 
-	delem = dict->root;
-	if(delem == NULL)
-		return;
-
-	if(dict->root->left == NULL)
-		dict->root = dict->root->right;
-	else if(dict->root->right == NULL)
-		dict->root = dict->root->left;
-	else
+	if(delem->left != NULL && delem->right != NULL)
 	{
-		/* Make the node with the next highest key the new root.
-		 * This node has a NULL left pointer. */
+		/* Move the node with the next highest key into delem's
+		 * place.  This node has a NULL left pointer. */
 		nextnode = delem->next;
 		lrb_assert(nextnode->left == NULL);
-		if(nextnode == delem->right)
+
+		if(nextnode->parent != delem)
 		{
-			dict->root = nextnode;
-			dict->root->left = delem->left;
+			start = nextnode->parent;
+			start->left = nextnode->right;
+			if(nextnode->right != NULL)
+				nextnode->right->parent = start;
+
+			nextnode->right = delem->right;
+			delem->right->parent = nextnode;
 		}
 		else
-		{
-			parentofnext = delem->right;
-			while(parentofnext->left != NULL && parentofnext->left != nextnode)
-				parentofnext = parentofnext->left;
-			lrb_assert(parentofnext->left == nextnode);
-			parentofnext->left = nextnode->right;
-			dict->root = nextnode;
-			dict->root->left = delem->left;
-			dict->root->right = delem->right;
-		}
+			start = nextnode;
+
+		nextnode->left = delem->left;
+		delem->left->parent = nextnode;
+
+		nextnode->parent = delem->parent;
+		rb_dictionary_replace_child(dict, delem->parent, delem, nextnode);
 	}
+	else
+	{
+		child = delem->left != NULL ? delem->left : delem->right;
+		if(child != NULL)
+			child->parent = delem->parent;
+
+		start = delem->parent;
+		rb_dictionary_replace_child(dict, delem->parent, delem, child);
+	}
+
+	rb_dictionary_rebalance(dict, start);
 
 	/* linked list */
 	if(delem->prev != NULL)
@@ -671,14 +725,19 @@ rb_dictionary_foreach_next(struct rb_dictionary *dtree, struct rb_dictionaryIter
 struct rb_dictionaryElement *
 rb_dictionary_find(struct rb_dictionary *dict, const char *key)
 {
+	struct rb_dictionaryElement *node;
+	int ret;
+
 	lrb_assert(dict != NULL);
 	lrb_assert(key != NULL);
 
-	/* retune for key, key will be the tree's root if it's available */
-	rb_dictionary_retune(dict, key);
+	for(node = dict->root; node != NULL;)
+	{
+		if((ret = dict->compare_cb(key, node->key)) == 0)
+			return node;
 
-	if(dict->root && !dict->compare_cb(key, dict->root->key))
-		return dict->root;
+		node = ret < 0 ? node->left : node->right;
+	}
 
 	return NULL;
 }
@@ -721,9 +780,7 @@ rb_dictionary_add(struct rb_dictionary *dict, const char *key, void *data)
 		return NULL;
 	}
 
-	rb_dictionary_link(dict, delem);
-
-	return delem;
+	return rb_dictionary_link(dict, delem);
 }
 
 /*
@@ -756,7 +813,7 @@ rb_dictionary_delete(struct rb_dictionary *dtree, const char *key)
 
 	data = delem->data;
 
-	rb_dictionary_unlink_root(dtree);
+	rb_dictionary_unlink(dtree, delem);
 	rb_bh_free(elem_heap, delem);
 
 	return data;
@@ -858,6 +915,8 @@ rb_dictionary_stats(struct rb_dictionary *dict, void (*cb) (const char *line, vo
 		rb_snprintf(str, sizeof str, "Dictionary stats for <%p> (%d)", (void *) dict,
 			    dict->count);
 	cb(str, privdata);
+	if(dict->root == NULL)
+		return;
 	maxdepth = 0;
 	sum = stats_recurse(dict->root, 0, &maxdepth);
 	rb_snprintf(str, sizeof str, "Depth sum %d Avg depth %d Max depth %d", sum,
@@ -67,10 +67,31 @@ mapi_clist_av1 join_clist[] = { &join_msgtab, &svsjoin_msgtab, &sjoin_msgtab, NU
 DECLARE_MODULE_AV1(join, NULL, NULL, join_clist, NULL, NULL, "SporksIRCD development team");
 
 static void set_final_mode(struct Mode *mode, struct Mode *oldmode);
-static void remove_a_mode(struct Channel *chptr, struct Client *source_p, int mask, char flag);
-static void remove_our_modes(struct Channel *chptr, struct Client *source_p);
-static void remove_channel_list(struct Channel *chptr, struct Client *source_p,
-				rb_dlink_list * list, char c, int mems);
+static void sjoin_flush_modes(struct Channel *chptr, struct Client *source_p, bool netjoin);
+
+/* -modes sent to local members when this side loses a TS, packed
+ * MAXMODEPARAMS to a line
+ */
+struct mode_packer
+{
+	struct Channel *chptr;
+	const char *source;
+	bool quiet;			/* no local members to tell */
+	int mems;			/* who the collected modes go to */
+	int count;
+	int len;
+	int baselen;
+	char *mptr;
+	char *pptr;
+	char modes[MAXMODEPARAMS + 1];
+	char params[BUFSIZE];
+};
+
+static void mode_packer_init(struct mode_packer *mp, struct Channel *chptr,
+			     struct Client *source_p);
+static void mode_packer_flush(struct mode_packer *mp);
+static void remove_our_modes(struct mode_packer *mp);
+static void remove_channel_list(struct mode_packer *mp, rb_dlink_list * list, char c, int mems);
 
 static char modebuf[MODEBUFLEN];
 static char parabuf[MODEBUFLEN];
@@ -79,6 +100,21 @@ static const char *para[MAXMODEPARAMS];
 static char *mbuf;
 static int pargs;
 
+/* member status, in the order prefixes are written and modes sent */
+static const struct sjoin_status
+{
+	int flag;
+	char prefix;
+	char mode;
+} sjoin_status[] = {
+	{ CHFL_FOUNDER,	'~', 'u' },
+	{ CHFL_ADMIN,	'!', 'a' },
+	{ CHFL_CHANOP,	'@', 'o' },
+	{ CHFL_HALFOP,	'%', 'h' },
+	{ CHFL_VOICE,	'+', 'v' },
+	{ 0,		'\0', '\0' }
+};
+
 extern int h_remove_our_modes;
 
 /*
@@ -205,9 +241,13 @@ ms_join(struct Client *client_p, struct Client *source_p, int parc, const char *
 	/* Lost the TS, other side wins, so remove modes on this side */
 	if(!keep_our_modes)
 	{
+		struct mode_packer mp;
+
 		set_final_mode(&mode, &chptr->mode);
 		chptr->mode = mode;
-		remove_our_modes(chptr, source_p);
+		mode_packer_init(&mp, chptr, source_p);
+		remove_our_modes(&mp);
+		mode_packer_flush(&mp);
 		RB_DLINK_FOREACH_SAFE(ptr, next_ptr, chptr->invites.head)
 		{
 			del_invite(chptr, ptr->data);
@@ -280,18 +320,16 @@ ms_sjoin(struct Client *client_p, struct Client *source_p, int parc, const char
 	int fl;
 	bool isnew;
 	int mlen_uid;
-	int len_nick;
 	int len_uid;
 	int len;
-	int slen;
 	int joins = 0;
-	int lcount;
 	const char *s;
 	char *ptr_uid;
 	char *p;
-	char *sptr;
 	int i, joinc = 0, timeslice = 0;
-	static char empty[] = "";
+	const struct sjoin_status *st;
+	bool has_local;
+	bool netjoin = NO;
 	rb_dlink_node *ptr, *next_ptr;
 
 	if(!IsChannelName(parv[2]) || !check_channel_name(parv[2]))
@@ -481,26 +519,25 @@ ms_sjoin(struct Client *client_p, struct Client *source_p, int parc, const char
 	if(!keep_our_modes)
 	{
 		hook_data_channel moduledata;
+		struct mode_packer mp;
+
 		moduledata.client = fakesource_p;
 		moduledata.chptr = chptr;
 
-		remove_our_modes(chptr, fakesource_p);
+		/* status and lists go out together, lists seen by the same
+		 * members next to each other
+		 */
+		mode_packer_init(&mp, chptr, fakesource_p);
+		remove_our_modes(&mp);
 		RB_DLINK_FOREACH_SAFE(ptr, next_ptr, chptr->invites.head)
 		{
 			del_invite(chptr, ptr->data);
 		}
 
-		if(rb_dlink_list_length(&chptr->banlist) > 0)
-			remove_channel_list(chptr, fakesource_p, &chptr->banlist, 'b', ALL_MEMBERS);
-		if(rb_dlink_list_length(&chptr->exceptlist) > 0)
-			remove_channel_list(chptr, fakesource_p, &chptr->exceptlist,
-					'e', ONLY_HALFOPSANDUP);
-		if(rb_dlink_list_length(&chptr->invexlist) > 0)
-			remove_channel_list(chptr, fakesource_p, &chptr->invexlist,
-					'I', ONLY_HALFOPSANDUP);
-		if(rb_dlink_list_length(&chptr->quietlist) > 0)
-			remove_channel_list(chptr, fakesource_p, &chptr->quietlist,
-					'q', ALL_MEMBERS);
+		remove_channel_list(&mp, &chptr->banlist, 'b', ALL_MEMBERS);
+		remove_channel_list(&mp, &chptr->quietlist, 'q', ALL_MEMBERS);
+		remove_channel_list(&mp, &chptr->exceptlist, 'e', ONLY_HALFOPSANDUP);
+		remove_channel_list(&mp, &chptr->invexlist, 'I', ONLY_HALFOPSANDUP);
 	
 		/* And the rest */
 		for(i = 0; i < 128; i++)
@@ -508,11 +545,12 @@ ms_sjoin(struct Client *client_p, struct Client *source_p, int parc, const char
 			struct list_mode *lmode = listmodes[i];
 			if (!lmode)
 				continue;
-			remove_channel_list(chptr, fakesource_p,
-					    get_channel_list(chptr, lmode->c),
+			remove_channel_list(&mp, get_channel_list(chptr, lmode->c),
 					    lmode->c, lmode->mems);
 		}
 
+		mode_packer_flush(&mp);
+
 		call_hook(h_remove_our_modes, &moduledata);
 
 		chptr->bants++;
@@ -545,9 +583,13 @@ ms_sjoin(struct Client *client_p, struct Client *source_p, int parc, const char
 	ptr_uid = buf_uid + mlen_uid;
 
 	mbuf = modebuf;
-	para[0] = para[1] = para[2] = para[3] = empty;
 	pargs = 0;
-	len_nick = len_uid = 0;
+	len_uid = 0;
+
+	/* joins from a burst mostly land in channels with nobody local in
+	 * them, there is no JOIN or MODE to build for those
+	 */
+	has_local = rb_dlink_list_length(&chptr->locmembers) != 0;
 
 	/* if theres a space, theres going to be more than one nick, change the
 	 * first space to \0, so s is just the first nick, and point p to the
@@ -564,45 +606,33 @@ ms_sjoin(struct Client *client_p, struct Client *source_p, int parc, const char
 	{
 		fl = 0;
 
+		/*
+		 * You may ask here, "why are we keeping modes unconditionally?
+		 * Shouldn't we just drop ~!% if they're disabled?" Well, the
+		 * reason we don't is to avoid problems with modes not
+		 * propagating to other servers which may have them enabled and
+		 * thus causing a desync.
+		 *
+		 * This does have the unfortunate side effect of having a loop
+		 * hole where a user can gain ~!% via a server that may have the
+		 * mode enabled. This isn't a real problem in practise because
+		 * users should have the modes they wish to have enabled/disabled
+		 * on all of their servers.
+		 * -- Elizabeth
+		 */
 		for (i = 0; i < 5; i++)
 		{
-			/*
-			 * You may ask here, "why are we keeping modes unconditionally?
-			 * Shouldn't we just drop ~!% if they're disabled?" Well, the
-			 * reason we don't is to avoid problems with modes not
-			 * propagating to other servers which may have them enabled and
-			 * thus causing a desync.
-			 *
-			 * This does have the unfortunate side effect of having a loop
-			 * hole where a user can gain ~!% via a server that may have the
-			 * mode enabled. This isn't a real problem in practise because
-			 * users should have the modes they wish to have enabled/disabled
-			 * on all of their servers.
-			 * -- Elizabeth
-			 */
-			switch (*s)
+			for (st = sjoin_status; st->flag; st++)
 			{
-			case '~':
-				fl |= CHFL_FOUNDER;
-				s++;
-				break;
-			case '!':
-				fl |= CHFL_ADMIN;
-				s++;
-				break;
-			case '@':
-				fl |= CHFL_CHANOP;
-				s++;
-				break;
-			case '%':
-				fl |= CHFL_HALFOP;
-				s++;
-				break;
-			case '+':
-				fl |= CHFL_VOICE;
-				s++;
-				break;
+				if(*s == st->prefix)
+					break;
 			}
+
+			if(!st->flag)
+				break;
+
+			fl |= st->flag;
+			s++;
 		}
 
 		/* if the client doesnt exist or is fake direction, skip. */
@@ -613,7 +643,7 @@ ms_sjoin(struct Client *client_p, struct Client *source_p, int parc, const char
 		/* we assume for these we can fit at least one nick/uid in.. */
 
 		/* check we can fit another status+nick+space into a buffer */
-		if((mlen_uid + len_uid + IDLEN + 3) > (BUFSIZE - 3))
+		if((mlen_uid + len_uid + IDLEN + 6) > (BUFSIZE - 3))
 		{
 			*(ptr_uid - 1) = '\0';
 			sendto_server(client_p->from, NULL, CAP_TS6, NOCAPS, "%s", buf_uid);
@@ -621,182 +651,57 @@ ms_sjoin(struct Client *client_p, struct Client *source_p, int parc, const char
 			len_uid = 0;
 		}
 
-		if(keep_new_modes)
+		if(!keep_new_modes)
+			fl = 0;
+
+		/* See above comment on why we keep modes like this. --Elizabeth */
+		for (st = sjoin_status; st->flag; st++)
 		{
-			/* See above comment on why we keep modes like this. --Elizabeth */
-			if(fl & CHFL_FOUNDER)
-			{
-				*ptr_uid++ = '~';
-				len_nick++;
-				len_uid++;
-			}
-			if(fl & CHFL_ADMIN)
+			if(fl & st->flag)
 			{
-				*ptr_uid++ = '!';
-				len_nick++;
-				len_uid++;
-			}
-			if(fl & CHFL_CHANOP)
-			{
-				*ptr_uid++ = '@';
-				len_nick++;
-				len_uid++;
-			}
-			if(fl & CHFL_HALFOP)
-			{
-				*ptr_uid++ = '%';
-				len_nick++;
-				len_uid++;
-			}
-			if(fl & CHFL_VOICE)
-			{
-				*ptr_uid++ = '+';
-				len_nick++;
+				*ptr_uid++ = st->prefix;
 				len_uid++;
 			}
 		}
 
-		/* copy the nick to the two buffers */
-		len = rb_sprintf(ptr_uid, "%s ", use_id(target_p));
+		/* copy the uid to the propagated buffer */
+		len = strlen(target_p->id);
+		memcpy(ptr_uid, target_p->id, len);
+		ptr_uid[len++] = ' ';
 		ptr_uid += len;
 		len_uid += len;
 
-		if(!keep_new_modes)
-			fl = 0;
-
 		if(!IsMember(target_p, chptr))
 		{
 			add_user_to_channel(chptr, target_p, fl);
-			send_channel_join(chptr, target_p);
-			joins++;
-		}
-
-
-		if (fl & CHFL_FOUNDER)
-		{
-			*mbuf++ = 'u';
-			para[pargs++] = target_p->name;
-
-			if (pargs >= MAXMODEPARAMS)
+			if(has_local && !HasSentEob(source_p))
 			{
-				/*
-				 * Ok, the code is now going to "walk" through
-				 * sendbuf, filling in para strings. So, I will use sptr
-				 * to point into the sendbuf.
-				 * Notice, that rb_snprintf() returns the number of chars
-				 * successfully inserted into string.
-				 * - Dianora
-				 */
-
-				sptr = sendbuf;
-				*mbuf = '\0';
-				for (lcount = 0; lcount < MAXMODEPARAMS; lcount++)
+				if(!netjoin)
 				{
-					slen = rb_snprintf(sptr, MODEBUFLEN, " %s", para[lcount]);	/* see? */
-					sptr += slen;	/* ready for next */
+					start_netjoin(chptr, source_p);
+					netjoin = YES;
 				}
-				sendto_channel_local(ALL_MEMBERS, chptr, ":%s MODE %s %s%s",
-						     source_p->name, chptr->chname, modebuf, sendbuf);
-				mbuf = modebuf;
-				*mbuf++ = '+';
-
-				sendbuf[0] = '\0';
-				pargs = 0;
+				send_netjoin(chptr, target_p);
 			}
+			else if(has_local)
+				send_channel_join(chptr, target_p);
+			joins++;
 		}
-		if (fl & CHFL_ADMIN)
-		{
-			*mbuf++ = 'a';
-			para[pargs++] = target_p->name;
 
-			if (pargs >= MAXMODEPARAMS)
-			{
-				sptr = sendbuf;
-				*mbuf = '\0';
-				for (lcount = 0; lcount < MAXMODEPARAMS; lcount++)
-				{
-					slen = rb_snprintf(sptr, MODEBUFLEN, " %s", para[lcount]);
-					sptr += slen;
-				}
-				sendto_channel_local(ALL_MEMBERS, chptr, ":%s MODE %s %s%s",
-						     source_p->name, chptr->chname, modebuf, sendbuf);
-				mbuf = modebuf;
-				*mbuf++ = '+';
+		/* nobody here to tell about the joins or their status */
+		if(!has_local)
+			goto nextnick;
 
-				sendbuf[0] = '\0';
-				pargs = 0;
-			}
-		}
-		if (fl & CHFL_CHANOP)
+		for (st = sjoin_status; st->flag; st++)
 		{
-			*mbuf++ = 'o';
-			para[pargs++] = target_p->name;
-
-			if (pargs >= MAXMODEPARAMS)
-			{
-				sptr = sendbuf;
-				*mbuf = '\0';
-				for (lcount = 0; lcount < MAXMODEPARAMS; lcount++)
-				{
-					slen = rb_snprintf(sptr, MODEBUFLEN, " %s", para[lcount]);
-					sptr += slen;
-				}
-				sendto_channel_local(ALL_MEMBERS, chptr, ":%s MODE %s %s%s",
-						     source_p->name, chptr->chname, modebuf, sendbuf);
-				mbuf = modebuf;
-				*mbuf++ = '+';
+			if(!(fl & st->flag))
+				continue;
 
-				sendbuf[0] = '\0';
-				pargs = 0;
-			}
-		}
-		if (fl & CHFL_HALFOP)
-		{
-			*mbuf++ = 'h';
+			*mbuf++ = st->mode;
 			para[pargs++] = target_p->name;
 
-			if (pargs >= MAXMODEPARAMS)
-			{
-				sptr = sendbuf;
-				*mbuf = '\0';
-				for (lcount = 0; lcount < MAXMODEPARAMS; lcount++)
-				{
-					slen = rb_snprintf(sptr, MODEBUFLEN, " %s", para[lcount]);
-					sptr += slen;
-				}
-				sendto_channel_local(ALL_MEMBERS, chptr, ":%s MODE %s %s%s",
-						     source_p->name, chptr->chname, modebuf, sendbuf);
-
-				mbuf = modebuf;
-				*mbuf++ = '+';
-
-				sendbuf[0] = '\0';
-				pargs = 0;
-			}
-		}
-		if (fl & CHFL_VOICE)
-		{
-			*mbuf++ = 'v';
-			para[pargs++] = target_p->name;
-
-			if (pargs >= MAXMODEPARAMS)
-			{
-				sptr = sendbuf;
-				*mbuf = '\0';
-				for (lcount = 0; lcount < MAXMODEPARAMS; lcount++)
-				{
-					slen = rb_snprintf(sptr, MODEBUFLEN, " %s", para[lcount]);
-					sptr += slen;
-				}
-				sendto_channel_local(ALL_MEMBERS, chptr, ":%s MODE %s %s%s",
-						     source_p->name, chptr->chname, modebuf, sendbuf);
-
-				mbuf = modebuf;
-				*mbuf++ = '+';
-
-				sendbuf[0] = '\0';
-				pargs = 0;
-			}
+			if(pargs >= MAXMODEPARAMS)
+				sjoin_flush_modes(chptr, fakesource_p, netjoin);
 		}
 
 	nextnick:
@@ -820,29 +725,12 @@ ms_sjoin(struct Client *client_p, struct Client *source_p, int parc, const char
 		}
 	}
 
-	*mbuf = '\0';
+	if(pargs != 0)
+		sjoin_flush_modes(chptr, fakesource_p, netjoin);
 
-	/*
-	 * checking for lcount < MAXMODEPARAMS at this time is wrong
-	 * since the code has already verified above that pargs < MAXMODEPARAMS
-	 * checking for para[lcount] != '\0' is also wrong, since
-	 * there is no place where para[lcount] is set!
-	 * - Dianora
-	 */
-
-	if (pargs != 0)
-	{
-		sptr = sendbuf;
-
-		for (lcount = 0; lcount < pargs; lcount++)
-		{
-			slen = rb_snprintf(sptr, MODEBUFLEN, " %s", para[lcount]);
-			sptr += slen;
-		}
-
-		sendto_channel_local(ALL_MEMBERS, chptr, ":%s MODE %s %s%s",
-				     fakesource_p->name, chptr->chname, modebuf, sendbuf);
-	}
+	/* the batch covers this SJOIN only, its status modes included */
+	if(netjoin)
+		end_netjoin(chptr);
 
 	if(!joins && !(chptr->mode.mode & MODE_PERMANENT) && isnew)
 	{
@@ -860,6 +748,36 @@ ms_sjoin(struct Client *client_p, struct Client *source_p, int parc, const char
 	return 0;
 }
 
+/*
+ * sjoin_flush_modes
+ *
+ * inputs	- channel, source of the modes, whether a netjoin batch is open
+ * output	- none
+ * side effects - the status modes collected in modebuf/para are sent
+ *		  to local members and the buffers are reset
+ */
+static void
+sjoin_flush_modes(struct Channel *chptr, struct Client *source_p, bool netjoin)
+{
+	char *sptr = sendbuf;
+	int i;
+
+	*mbuf = '\0';
+	for (i = 0; i < pargs; i++)
+		sptr += rb_snprintf(sptr, sendbuf + sizeof(sendbuf) - sptr, " %s", para[i]);
+
+	if(netjoin)
+		send_netjoin_mode(chptr, source_p, modebuf, sendbuf);
+	else
+		sendto_channel_local(ALL_MEMBERS, chptr, ":%s MODE %s %s%s",
+				     source_p->name, chptr->chname, modebuf, sendbuf);
+
+	mbuf = modebuf;
+	*mbuf++ = '+';
+	sendbuf[0] = '\0';
+	pargs = 0;
+}
+
 static void
 set_final_mode(struct Mode *mode, struct Mode *oldmode)
 {
@@ -986,159 +904,131 @@ set_final_mode(struct Mode *mode, struct Mode *oldmode)
 	*mbuf = '\0';
 }
 
-/* remove_our_modes()
+/* mode_packer_init()
  *
- * inputs	- pointer to channel to remove modes from
- *		- client pointer
+ * inputs	- packer, channel, source of the modes
  * output	- NONE
- * side effects	- Go through the local members, remove all their
- *		chanop modes etc., this side lost the TS.
+ * side effects	- packer is ready to collect -modes for the channel
  */
 static void
-remove_our_modes(struct Channel *chptr, struct Client *source_p)
+mode_packer_init(struct mode_packer *mp, struct Channel *chptr, struct Client *source_p)
 {
-	remove_a_mode(chptr, source_p, CHFL_FOUNDER, 'u');
-	remove_a_mode(chptr, source_p, CHFL_ADMIN, 'a');
-	remove_a_mode(chptr, source_p, CHFL_CHANOP, 'o');
-	remove_a_mode(chptr, source_p, CHFL_HALFOP, 'h');
-	remove_a_mode(chptr, source_p, CHFL_VOICE, 'v');
+	mp->chptr = chptr;
+	mp->source = IsHidden(source_p) ? me.name : source_p->name;
+	mp->quiet = rb_dlink_list_length(&chptr->locmembers) == 0;
+	mp->mems = ALL_MEMBERS;
+	mp->count = 0;
+	mp->baselen = mp->len = strlen(mp->source) + strlen(chptr->chname) + 10;
+	mp->mptr = mp->modes;
+	mp->pptr = mp->params;
 }
 
-/* remove_a_mode()
+/* mode_packer_flush()
  *
- * inputs	-
+ * inputs	- packer
  * output	- NONE
- * side effects	- remove ONE mode from a channel
+ * side effects	- collected modes are sent to local members
  */
 static void
-remove_a_mode(struct Channel *chptr, struct Client *source_p, int mask, char flag)
+mode_packer_flush(struct mode_packer *mp)
 {
-	rb_dlink_node *ptr;
-	struct membership *msptr;
-	char lmodebuf[MODEBUFLEN];
-	const char *lpara[MAXMODEPARAMS];
-	int count = 0;
-	int lcount;
-
-	mbuf = lmodebuf;
-	*mbuf++ = '-';
-
-	for (lcount = 0; lcount < MAXMODEPARAMS; lcount++)
-		lpara[lcount] = "";
-	sendbuf[0] = '\0';
-
-	RB_DLINK_FOREACH(ptr, chptr->members.head)
-	{
-		msptr = ptr->data;
+	if(mp->count == 0)
+		return;
+
+	*mp->mptr = '\0';
+	*mp->pptr = '\0';
+	sendto_channel_local(mp->mems, mp->chptr, ":%s MODE %s -%s%s",
+			     mp->source, mp->chptr->chname, mp->modes, mp->params);
+
+	mp->count = 0;
+	mp->len = mp->baselen;
+	mp->mptr = mp->modes;
+	mp->pptr = mp->params;
+}
 
-		if ((msptr->flags & mask) == 0)
-			continue;
+/* mode_packer_add()
+ *
+ * inputs	- packer, members to tell, mode char, its parameter
+ * output	- NONE
+ * side effects	- -mode is collected, a line is sent when full or when
+ *		  it is for different members
+ */
+static void
+mode_packer_add(struct mode_packer *mp, int mems, char c, const char *arg)
+{
+	int alen;
 
-		msptr->flags &= ~mask;
+	if(mp->quiet)
+		return;
 
-		lpara[count++] = msptr->client_p->name;
+	alen = strlen(arg);
 
-		*mbuf++ = flag;
+	if(mp->count > 0 && (mp->mems != mems || mp->count >= MAXMODEPARAMS ||
+			     mp->len + alen + 2 > BUFSIZE - 3))
+		mode_packer_flush(mp);
 
-		if (count >= MAXMODEPARAMS)
-		{
-			for (lcount = 0; lcount < MAXMODEPARAMS; lcount++)
-			{
-				if (*lpara[lcount] == '\0')
-					break;
-
-				rb_strlcat(sendbuf, " ", sizeof(sendbuf));
-				rb_strlcat(sendbuf, lpara[lcount], sizeof(sendbuf));
-				lpara[lcount] = "";
-			}
+	mp->mems = mems;
+	*mp->mptr++ = c;
+	*mp->pptr++ = ' ';
+	memcpy(mp->pptr, arg, alen);
+	mp->pptr += alen;
+	mp->len += alen + 2;
+	mp->count++;
+}
 
-			*mbuf = '\0';
-			sendto_channel_local(ALL_MEMBERS, chptr,
-					     ":%s MODE %s %s%s",
-					     IsHidden(source_p) ? me.name : source_p->name,
-					     chptr->chname, lmodebuf, sendbuf);
-			mbuf = lmodebuf;
-			*mbuf++ = '-';
-			count = 0;
-			sendbuf[0] = '\0';
-		}
-	}
+/* remove_our_modes()
+ *
+ * inputs	- packer for the channel
+ * output	- NONE
+ * side effects	- every member loses its status in one pass over the
+ *		  channel, this side lost the TS
+ */
+static void
+remove_our_modes(struct mode_packer *mp)
+{
+	const struct sjoin_status *st;
+	struct membership *msptr;
+	rb_dlink_node *ptr;
 
-	if (count != 0)
+	RB_DLINK_FOREACH(ptr, mp->chptr->members.head)
 	{
-		*mbuf = '\0';
-		for (lcount = 0; lcount < MAXMODEPARAMS; lcount++)
+		msptr = ptr->data;
+
+		for (st = sjoin_status; st->flag; st++)
 		{
-			if (*lpara[lcount] == '\0')
-				break;
+			if((msptr->flags & st->flag) == 0)
+				continue;
 
-			rb_strlcat(sendbuf, " ", sizeof(sendbuf));
-			rb_strlcat(sendbuf, lpara[lcount], sizeof(sendbuf));
+			msptr->flags &= ~st->flag;
+			mode_packer_add(mp, ALL_MEMBERS, st->mode, msptr->client_p->name);
 		}
-		sendto_channel_local(ALL_MEMBERS, chptr,
-				     ":%s MODE %s %s%s",
-				     IsHidden(source_p) ? me.name : source_p->name,
-				     chptr->chname, lmodebuf, sendbuf);
 	}
 }
 
 /* remove_channel_list()
  *
- * inputs	- channel, source, list to remove, char of mode, caps needed
+ * inputs	- packer for the channel, list to remove, char of mode,
+ *		  members who may see it
  * outputs	-
  * side effects - given list is removed, with modes issued to local clients
  */
 static void
-remove_channel_list(struct Channel *chptr, struct Client *source_p,
-		    rb_dlink_list * list, char c, int mems)
+remove_channel_list(struct mode_packer *mp, rb_dlink_list * list, char c, int mems)
 {
-	static char lmodebuf[BUFSIZE];
-	static char lparabuf[BUFSIZE];
 	struct mode_list_t *listptr;
 	rb_dlink_node *ptr;
 	rb_dlink_node *next_ptr;
-	char *pbuf;
-	int count = 0;
-	int cur_len, mlen, plen;
-
-	pbuf = lparabuf;
 
-	cur_len = mlen = rb_sprintf(lmodebuf, ":%s MODE %s -", source_p->name, chptr->chname);
-	mbuf = lmodebuf + mlen;
+	if(list == NULL)
+		return;
 
 	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, list->head)
 	{
 		listptr = ptr->data;
-
-		/* trailing space, and the mode letter itself */
-		plen = strlen(listptr->maskstr) + 2;
-
-		if(count >= MAXMODEPARAMS || (cur_len + plen) > BUFSIZE - 4)
-		{
-			/* remove trailing space */
-			*mbuf = '\0';
-			*(pbuf - 1) = '\0';
-
-			sendto_channel_local(mems, chptr, "%s %s", lmodebuf, lparabuf);
-
-			cur_len = mlen;
-			mbuf = lmodebuf + mlen;
-			pbuf = lparabuf;
-			count = 0;
-		}
-
-		*mbuf++ = c;
-		cur_len += plen;
-		pbuf += rb_sprintf(pbuf, "%s ", listptr->maskstr);
-		count++;
-
+		mode_packer_add(mp, mems, c, listptr->maskstr);
 		free_list_item(listptr);
 	}
 
-	*mbuf = '\0';
-	*(pbuf - 1) = '\0';
-	sendto_channel_local(mems, chptr, "%s %s", lmodebuf, lparabuf);
-
 	list->head = list->tail = NULL;
 	list->length = 0;
 }
@@ -44,6 +44,7 @@
 #include "s_stats.h"
 #include "tgchange.h"
 #include "inline/stringops.h"
+#include "arena.h"
 
 static int m_message(int, const char *, struct Client *, struct Client *, int, const char **);
 static int m_privmsg(struct Client *, struct Client *, int, const char **);
@@ -266,7 +267,7 @@ build_target_list(int p_or_n, const char *command, struct Client *client_p,
 	struct Channel *chptr = NULL;
 	struct Client *target_p;
 
-	target_list = LOCAL_COPY(nicks_channels);	/* skip strcpy for non-lazyleafs */
+	target_list = arena_strdup(nicks_channels);	/* skip strcpy for non-lazyleafs */
 
 	ntargets = 0;
 
@@ -494,7 +495,7 @@ msg_channel(int p_or_n, const char *command,
 	    const char *text)
 {
 	int result;
-	char *text2 = LOCAL_COPY(text);
+	char *text2 = arena_strdup(text);
 
 	if(MyClient(source_p))
 	{
@@ -587,7 +588,7 @@ msg_channel_opmod(int p_or_n, const char *command,
 		  struct Client *client_p, struct Client *source_p,
 		  struct Channel *chptr, const char *text)
 {
-	char *text2 = LOCAL_COPY(text);
+	char *text2 = arena_strdup(text);
 
 	/* XXX Mostly for the filtering this provides */
 	can_send(chptr, source_p, NULL, text2, p_or_n == NOTICE ? COMMAND_NOTICE : COMMAND_PRIVMSG);
@@ -41,12 +41,15 @@
 #include "modules.h"
 #include "packet.h"
 #include "s_newconf.h"
+#include "arena.h"
 
 static int m_mode(struct Client *, struct Client *, int, const char **);
 static int ms_mode(struct Client *, struct Client *, int, const char **);
 static int ms_tmode(struct Client *, struct Client *, int, const char **);
 static int ms_mlock(struct Client *, struct Client *, int, const char **);
 static int ms_bmask(struct Client *, struct Client *, int, const char **);
+static int ms_bdig(struct Client *, struct Client *, int, const char **);
+static int ms_breq(struct Client *, struct Client *, int, const char **);
 
 static int modinit(void);
 static void modfini(void);
@@ -68,7 +71,18 @@ struct Message bmask_msgtab = {
 	{mg_ignore, mg_ignore, mg_ignore, {ms_bmask, 5}, mg_ignore, mg_ignore}
 };
 
-mapi_clist_av1 mode_clist[] = { &mode_msgtab, &tmode_msgtab, &mlock_msgtab, &bmask_msgtab, NULL };
+struct Message bdig_msgtab = {
+	"BDIG", 0, 0, 0, MFLG_SLOW,
+	{mg_ignore, mg_ignore, mg_ignore, {ms_bdig, 5}, mg_ignore, mg_ignore}
+};
+struct Message breq_msgtab = {
+	"BREQ", 0, 0, 0, MFLG_SLOW,
+	{mg_ignore, mg_ignore, mg_ignore, {ms_breq, 4}, mg_ignore, mg_ignore}
+};
+
+mapi_clist_av1 mode_clist[] = {
+	&mode_msgtab, &tmode_msgtab, &mlock_msgtab, &bmask_msgtab, &bdig_msgtab, &breq_msgtab, NULL
+};
 
 DECLARE_MODULE_AV1(mode, modinit, modfini, mode_clist, NULL, NULL, "SporksIRCD development team");
 
@@ -76,6 +90,7 @@ static int
 modinit(void)
 {
 	add_capability("MLOCK", CAP_MLOCK, YES, NO);
+	add_capability("BDIG", CAP_BDIG, YES, NO);
 	return 0;
 }
 
@@ -83,6 +98,7 @@ static void
 modfini(void)
 {
 	delete_capability("MLOCK");
+	delete_capability("BDIG");
 }
 
 /*
@@ -333,7 +349,7 @@ ms_bmask(struct Client *client_p, struct Client *source_p, int parc, const char
 	}
 
 	parabuf[0] = '\0';
-	s = LOCAL_COPY(parv[4]);
+	s = arena_strdup(parv[4]);
 
 	/* Hide connecting server on netburst -- jilles */
 	if (ConfigServerHide.flatten_links && !HasSentEob(source_p))
@@ -430,3 +446,106 @@ ms_bmask(struct Client *client_p, struct Client *source_p, int parc, const char
 	return 0;
 }
 
+
+/* the list a BDIG or BREQ names, or NULL */
+static rb_dlink_list *
+bdig_list(struct Channel *chptr, char c)
+{
+	switch (c)
+	{
+	case 'b':
+		return &chptr->banlist;
+	case 'e':
+		return &chptr->exceptlist;
+	case 'I':
+		return &chptr->invexlist;
+	case 'q':
+		return &chptr->quietlist;
+	default:
+		if(get_list_mode(c) == NULL)
+			return NULL;
+		return get_channel_list(chptr, c);
+	}
+}
+
+/*
+ * ms_bdig - digests of the lists of a channel in a burst
+ * parv[1] - channelTS
+ * parv[2] - channel
+ * parv[3] - salt
+ * parv[4] - space separated mode letters, each followed by a digest
+ */
+static int
+ms_bdig(struct Client *client_p, struct Client *source_p, int parc, const char *parv[])
+{
+	struct Channel *chptr;
+	rb_dlink_list *list;
+	char want[BUFSIZE];
+	char *w = want;
+	char *s, *p;
+	uint64_t salt;
+
+	/* never propagated, only the link itself knows the lists */
+	if(source_p != client_p)
+		return 0;
+
+	if(!IsChanPrefix(parv[2][0]) || (chptr = find_channel(parv[2])) == NULL)
+		return 0;
+
+	/* TS is higher, BMASK would be dropped as well */
+	if(atol(parv[1]) > chptr->channelts)
+		return 0;
+
+	salt = strtoull(parv[3], NULL, 16);
+	s = arena_strdup(parv[4]);
+
+	for(s = rb_strtok_r(s, " ", &p); s != NULL; s = rb_strtok_r(NULL, " ", &p))
+	{
+		if((list = bdig_list(chptr, *s)) == NULL)
+			continue;
+
+		if(channel_list_digest(list, salt) != strtoull(s + 1, NULL, 16))
+			*w++ = *s;
+	}
+
+	if(w == want)
+		return 0;
+
+	*w = '\0';
+	sendto_one(client_p, ":%s BREQ %ld %s %s", me.id, atol(parv[1]), chptr->chname, want);
+	return 0;
+}
+
+/*
+ * ms_breq - lists asked for after a BDIG
+ * parv[1] - channelTS from the BDIG
+ * parv[2] - channel
+ * parv[3] - mode letters of the lists
+ */
+static int
+ms_breq(struct Client *client_p, struct Client *source_p, int parc, const char *parv[])
+{
+	struct Channel *chptr;
+	rb_dlink_list *list;
+	const char *s;
+
+	if(source_p != client_p)
+		return 0;
+
+	if(!IsChanPrefix(parv[2][0]) || (chptr = find_channel(parv[2])) == NULL)
+		return 0;
+
+	/* recreated since, it was burst or propagated anew */
+	if(atol(parv[1]) < chptr->channelts)
+		return 0;
+
+	for(s = parv[3]; *s != '\0'; s++)
+	{
+		list = bdig_list(chptr, *s);
+
+		if(list != NULL && rb_dlink_list_length(list) > 0)
+			burst_modes_TS6(client_p, chptr, list, *s);
+	}
+
+	return 0;
+}
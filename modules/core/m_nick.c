@@ -46,13 +46,7 @@
 #include "scache.h"
 #include "s_newconf.h"
 #include "monitor.h"
-
-/* Give all UID nicks the same TS. This ensures nick TS is always the same on
- * all servers for each nick-user pair, also if a user with a UID nick changes
- * their nick but is collided again (the server detecting the collision will
- * not propagate the nick change further). -- jilles
- */
-#define SAVE_NICKTS 100
+#include "intern.h"
 
 static int mr_nick(struct Client *, struct Client *, int, const char **);
 static int m_nick(struct Client *, struct Client *, int, const char **);
@@ -1124,18 +1118,18 @@ register_client(struct Client *client_p, struct Client *server,
 
 	strcpy(source_p->name, nick);
 	rb_strlcpy(source_p->username, parv[5], sizeof(source_p->username));
-	rb_strlcpy(source_p->host, parv[6], sizeof(source_p->host));
-	rb_strlcpy(source_p->orighost, source_p->host, sizeof(source_p->orighost));
+	intern_set(&source_p->host, parv[6], HOSTLEN);
+	intern_set(&source_p->orighost, source_p->host, HOSTLEN);
 
 	if(parc == 12)
 	{
-		rb_strlcpy(source_p->info, parv[11], sizeof(source_p->info));
+		intern_set(&source_p->info, parv[11], REALLEN);
 		rb_strlcpy(source_p->sockhost, parv[7], sizeof(source_p->sockhost));
 		rb_strlcpy(source_p->id, parv[8], sizeof(source_p->id));
 		add_to_id_hash(source_p->id, source_p);
 		if (strcmp(parv[9], "*"))
 		{
-			rb_strlcpy(source_p->orighost, parv[9], sizeof(source_p->orighost));
+			intern_set(&source_p->orighost, parv[9], HOSTLEN);
 			if (irccmp(source_p->host, source_p->orighost))
 				SetDynSpoof(source_p);
 		}
@@ -1144,7 +1138,7 @@ register_client(struct Client *client_p, struct Client *server,
 	}
 	else if(parc == 10)
 	{
-		rb_strlcpy(source_p->info, parv[9], sizeof(source_p->info));
+		intern_set(&source_p->info, parv[9], REALLEN);
 		rb_strlcpy(source_p->sockhost, parv[7], sizeof(source_p->sockhost));
 		rb_strlcpy(source_p->id, parv[8], sizeof(source_p->id));
 		add_to_id_hash(source_p->id, source_p);
@@ -1204,6 +1198,7 @@ register_client(struct Client *client_p, struct Client *server,
 		rb_dlinkAddAlloc(source_p, &oper_list);
 
 	SetRemoteClient(source_p);
+	source_p->introduced = ++introduce_count;
 
 	if(++Count.total > Count.max_tot)
 		Count.max_tot = Count.total;
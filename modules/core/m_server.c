@@ -40,6 +40,7 @@
 #include "msg.h"
 #include "parse.h"
 #include "modules.h"
+#include "intern.h"
 
 static int mr_server(struct Client *, struct Client *, int, const char **);
 static int ms_server(struct Client *, struct Client *, int, const char **);
@@ -706,13 +707,13 @@ set_server_gecos(struct Client *client_p, const char *info)
 			/* if there was a trailing space, s could point to \0, so check */
 			if(s && (*s != '\0'))
 			{
-				rb_strlcpy(client_p->info, s, sizeof(client_p->info));
+				intern_set(&client_p->info, s, REALLEN);
 				return 1;
 			}
 		}
 	}
 
-	rb_strlcpy(client_p->info, "(Unknown Location)", sizeof(client_p->info));
+	intern_set(&client_p->info, "(Unknown Location)", REALLEN);
 
 	return 1;
 }
@@ -71,6 +71,7 @@ static struct clicap
 	_CLICAP("sasl", CLICAP_SASL, 0, 0),
 	_CLICAP("account-notify", CLICAP_ACCOUNT_NOTIFY, 0, 0),
 	_CLICAP("extended-join", CLICAP_EXTENDED_JOIN, 0, 0),
+	_CLICAP("batch", CLICAP_BATCH, 0, 0),
 };
 
 #define CLICAP_LIST_LEN (sizeof(clicap_list) / sizeof(struct clicap))
@@ -35,6 +35,7 @@
 #include "ircd.h"
 #include "numeric.h"
 #include "send.h"
+#include "s_serv.h"
 #include "msg.h"
 #include "modules.h"
 
@@ -65,5 +66,6 @@ me_certfp(struct Client *client_p, struct Client *source_p, int parc, const char
 	source_p->certfp = NULL;
 	if (!EmptyString(parv[1]))
 		source_p->certfp = rb_strdup(parv[1]);
+	burst_record_clear(source_p);
 	return 0;
 }
@@ -27,6 +27,7 @@
 #include "modules.h"
 #include "whowas.h"
 #include "monitor.h"
+#include "intern.h"
 
 static int me_realhost(struct Client *, struct Client *, int, const char **);
 static int ms_chghost(struct Client *, struct Client *, int, const char **);
@@ -98,8 +99,8 @@ me_realhost(struct Client *client_p, struct Client *source_p,
 		return 0;
 
 	del_from_hostname_hash(source_p->orighost, source_p);
-	rb_strlcpy(source_p->orighost, parv[1], sizeof source_p->orighost);
-	if (irccmp(source_p->host, source_p->orighost))
+	intern_set(&source_p->orighost, parv[1], HOSTLEN);
+	if (source_p->host != source_p->orighost && irccmp(source_p->host, source_p->orighost))
 		SetDynSpoof(source_p);
 	else
 		ClearDynSpoof(source_p);
@@ -124,7 +125,7 @@ do_chghost(struct Client *source_p, struct Client *target_p,
 		return 0;
 	}
 	change_nick_user_host(target_p, target_p->name, target_p->username, newhost, 0, "Changing host");
-	if (irccmp(target_p->host, target_p->orighost))
+	if (target_p->host != target_p->orighost && irccmp(target_p->host, target_p->orighost))
 	{
 		SetDynSpoof(target_p);
 		if (MyClient(target_p))
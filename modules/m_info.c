@@ -115,6 +115,18 @@ static struct InfoStruct info_table[] = {
 		&ConfigFileEntry.use_part_messages,
 		"Whether or not the server should allow users to show messages on PART"
 	},
+	{
+		"burst_cache",
+		OUTPUT_BOOLEAN_YN,
+		&ConfigFileEntry.burst_cache,
+		"Reuse serialized user introductions between bursts",
+	},
+	{
+		"burst_cache_verify",
+		OUTPUT_BOOLEAN_YN,
+		&ConfigFileEntry.burst_cache_verify,
+		"Check reused introductions against freshly built ones",
+	},
 	{
 		"caller_id_wait",
 		OUTPUT_DECIMAL,
@@ -398,6 +410,12 @@ static struct InfoStruct info_table[] = {
 		&ConfigFileEntry.nick_delay,
 		"Delay nicks are locked for on split",
 	},
+	{
+		"netsplit_slice",
+		OUTPUT_DECIMAL,
+		&ConfigFileEntry.netsplit_slice,
+		"Split users cleaned up per second, 0 for all at once",
+	},
 	{
 		"no_oper_flood",
 		OUTPUT_BOOLEAN,
@@ -536,6 +554,12 @@ static struct InfoStruct info_table[] = {
 		&ConfigFileEntry.throttle_duration, 
 		"Connection throttle duration",
 	},
+	{
+		"throttle_sketch",
+		OUTPUT_BOOLEAN_YN,
+		&ConfigFileEntry.throttle_sketch,
+		"Count connections in a fixed size sketch before throttling",
+	},
 	{
 		"tkline_expire_notices",
 		OUTPUT_BOOLEAN,
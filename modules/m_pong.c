@@ -27,6 +27,7 @@
 #include "ircd.h"
 #include "s_user.h"
 #include "client.h"
+#include "monitor.h"
 #include "hash.h"		/* for find_client() */
 #include "hook.h"
 #include "numeric.h"
@@ -91,6 +92,10 @@ ms_pong(struct Client *client_p, struct Client *source_p, int parc, const char *
 					     (signed int) (rb_current_time() - source_p->localClient->firsttime));
 		SetEob(source_p);
 		eob_count++;
+
+		if(MyConnect(source_p))
+			monitor_signon_burst(source_p);
+
 		call_hook(h_server_eob, source_p);
 	}
 
@@ -49,6 +49,9 @@
 #include "hash.h"
 #include "reject.h"
 #include "whowas.h"
+#include "bandbi.h"
+#include "intern.h"
+#include "arena.h"
 
 static int m_stats (struct Client *, struct Client *, int, const char **);
 
@@ -108,6 +111,7 @@ static void stats_operedup(struct Client *);
 static void stats_ports(struct Client *);
 static void stats_tresv(struct Client *);
 static void stats_resv(struct Client *);
+static void stats_bandb(struct Client *);
 static void stats_usage(struct Client *);
 static void stats_tstats(struct Client *);
 static void stats_uptime(struct Client *);
@@ -159,6 +163,7 @@ static struct StatsStruct stats_cmd_table[] = {
 	{'Q', stats_resv,		1, 0, },
 	{'r', stats_usage,		1, 0, },
 	{'R', stats_usage,		1, 0, },
+	{'S', stats_bandb,		1, 0, },
 	{'t', stats_tstats,		1, 0, },
 	{'T', stats_tstats,		1, 0, },
 	{'u', stats_uptime,		0, 0, },
@@ -833,6 +838,20 @@ stats_resv(struct Client *source_p)
 	HASH_WALK_END
 }
 
+static void
+stats_bandb(struct Client *source_p)
+{
+	sendto_one_numeric(source_p, RPL_STATSDEBUG,
+			   "S :Ban rehashes %lu, last started %ld seconds ago, %s",
+			   bandb_stats.rehashes,
+			   bandb_stats.rehashes ? (long) (rb_current_time() - bandb_stats.started) : 0L,
+			   bandb_stats.finished ? "complete" : "in progress");
+	sendto_one_numeric(source_p, RPL_STATSDEBUG,
+			   "S :Added %lu, removed %lu, updated %lu, unchanged %lu, pending %lu",
+			   bandb_stats.added, bandb_stats.removed, bandb_stats.updated,
+			   bandb_stats.unchanged, bandb_stats.pending);
+}
+
 static void
 stats_usage (struct Client *source_p)
 {
@@ -1206,6 +1225,16 @@ stats_memory (struct Client *source_p)
 	size_t wwm = 0;		/* whowas array memory used */
 	size_t conf_memory = 0;	/* memory used by conf lines */
 	size_t mem_servers_cached;	/* memory used by scache */
+	size_t number_interned;		/* distinct interned strings */
+	size_t mem_interned;		/* memory used by them */
+	size_t mem_intern_saved;	/* copies they stand in for */
+
+	size_t number_burst_records;	/* users with serialized introductions */
+	size_t mem_burst_records;	/* memory used by them */
+	unsigned long burst_reused, burst_built;
+
+	size_t number_arena_chunks;	/* scratch chunks held by the arena */
+	size_t mem_arena;		/* memory used by them */
 
 	size_t linebuf_count = 0;
 	size_t linebuf_memory_used = 0;
@@ -1388,6 +1417,26 @@ stats_memory (struct Client *source_p)
 			   "z :scache %ld(%ld)",
 			   (long)number_servers_cached, (long)mem_servers_cached);
 
+	count_intern_memory(&number_interned, &mem_interned, &mem_intern_saved);
+
+	sendto_one_numeric(source_p, RPL_STATSDEBUG,
+			   "z :interned strings %ld(%ld) saving %ld bytes of copies",
+			   (long)number_interned, (long)mem_interned, (long)mem_intern_saved);
+
+	count_burst_records(&number_burst_records, &mem_burst_records,
+			    &burst_reused, &burst_built);
+
+	sendto_one_numeric(source_p, RPL_STATSDEBUG,
+			   "z :burst records %ld(%ld), %lu reused, %lu built",
+			   (long)number_burst_records, (long)mem_burst_records,
+			   burst_reused, burst_built);
+
+	count_arena_memory(&number_arena_chunks, &mem_arena);
+
+	sendto_one_numeric(source_p, RPL_STATSDEBUG,
+			   "z :arena chunks %ld(%ld)",
+			   (long)number_arena_chunks, (long)mem_arena);
+
 	sendto_one_numeric(source_p, RPL_STATSDEBUG,
 			   "z :hostname hash %d(%ld)",
 			   HOST_MAX, (long)HOST_MAX * sizeof(rb_dlink_list));
@@ -1396,6 +1445,9 @@ stats_memory (struct Client *source_p)
 		class_count * sizeof(struct Class);
 
 	total_memory += mem_servers_cached;
+	total_memory += mem_interned;
+	total_memory += mem_burst_records;
+	total_memory += mem_arena;
 	sendto_one_numeric(source_p, RPL_STATSDEBUG,
 			   "z :Total: whowas %d channel %d conf %d", 
 			   (int) totww, (int) total_channel_memory,
@@ -1490,6 +1542,26 @@ stats_servlinks (struct Client *source_p)
 			(rb_current_time() > target_p->localClient->lasttime) ? 
 			 (rb_current_time() - target_p->localClient->lasttime) : 0,
 			IsOper (source_p) ? show_capabilities (target_p) : "TS");
+
+		sendto_one_numeric(source_p, RPL_STATSDEBUG,
+				   "? :%s sendq: %u control, %u normal, %u held",
+				   target_p->name,
+				   rb_linebuf_len(&target_p->localClient->buf_sendq_control),
+				   rb_linebuf_len(&target_p->localClient->buf_sendq),
+				   target_p->localClient->burst != NULL ?
+				   rb_linebuf_len(&target_p->localClient->burst->held) : 0);
+
+		if(target_p->localClient->burst != NULL)
+		{
+			struct burst_state *burst = target_p->localClient->burst;
+
+			sendto_one_numeric(source_p, RPL_STATSDEBUG,
+					   "? :%s burst for %ld seconds: %u/%u users, %u/%u channels",
+					   target_p->name,
+					   (long) (rb_current_time() - burst->started),
+					   burst->users, burst->total_users,
+					   burst->channels, burst->total_channels);
+		}
 	}
 
 	sendto_one_numeric(source_p, RPL_STATSDEBUG,
@@ -35,6 +35,7 @@
 #include "parse.h"
 #include "modules.h"
 #include "blacklist.h"
+#include "intern.h"
 
 static int mr_user(struct Client *, struct Client *, int, const char **);
 
@@ -95,7 +96,7 @@ do_local_user(struct Client *client_p, struct Client *source_p,
 		source_p->flags |= FLAGS_SENTUSER;
 	}
 
-	rb_strlcpy(source_p->info, realname, sizeof(source_p->info));
+	intern_set(&source_p->info, realname, REALLEN);
 
 	if(!IsGotId(source_p))
 	{
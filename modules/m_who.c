@@ -39,6 +39,7 @@
 #include "modules.h"
 #include "packet.h"
 #include "s_newconf.h"
+#include "arena.h"
 
 #define FIELD_CHANNEL    0x0001
 #define FIELD_HOP        0x0002
@@ -100,7 +101,6 @@ m_who(struct Client *client_p, struct Client *source_p, int parc, const char *pa
 	bool operspy = NO;
 	struct who_format fmt;
 	const char *s;
-	char maskcopy[512];
 
 	fmt.fields = 0;
 	fmt.querytype = NULL;
@@ -136,8 +136,7 @@ m_who(struct Client *client_p, struct Client *source_p, int parc, const char *pa
 			fmt.querytype = "0";
 	}
 
-	rb_strlcpy(maskcopy, parv[1], sizeof maskcopy);
-	mask = maskcopy;
+	mask = arena_strdup(parv[1]);
 
 	collapse(mask);
 
@@ -43,6 +43,7 @@
 #include "hook.h"
 #include "s_newconf.h"
 #include "s_user.h"
+#include "arena.h"
 
 static void do_whois(struct Client *client_p, struct Client *source_p, int parc, const char *parv[]);
 static void single_whois(struct Client *source_p, struct Client *target_p, bool operspy);
@@ -177,7 +178,7 @@ do_whois(struct Client *client_p, struct Client *source_p, int parc, const char
 	char *p = NULL;
 	bool operspy = NO;
 
-	nick = LOCAL_COPY(parv[1]);
+	nick = arena_strdup(parv[1]);
 	if((p = strchr(nick, ',')))
 		*p = '\0';
 
@@ -0,0 +1,175 @@
+/*
+ * SporksIRCD: the ircd for discerning transsexual quilting bees.
+ * arena.c: scratch memory for command processing
+ *
+ * Copyright (C) 2011 SporksIRCD development team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *  USA
+ */
+
+#include "stdinc.h"
+#include "arena.h"
+
+/*
+ * A bump allocator over a chain of chunks.  The first chunk is allocated
+ * at startup and never freed; it is big enough for anything a single
+ * command normally needs, so the common case never touches malloc.
+ * Chunks added when it overflows are freed again on release, except
+ * for one that is kept around to absorb the next overflow.
+ */
+
+#define ARENA_CHUNK_SIZE	16384
+#define ARENA_ALIGN(x)		(((x) + 7) & ~((size_t) 7))
+
+struct arena_chunk
+{
+	struct arena_chunk *prev;
+	size_t size;
+	size_t used;
+	/* data follows */
+};
+
+#define CHUNK_DATA(c)	((char *) (c) + ARENA_ALIGN(sizeof(struct arena_chunk)))
+
+static struct arena_chunk *arena_base;
+static struct arena_chunk *arena_cur;
+static struct arena_chunk *arena_spare;
+
+static struct arena_chunk *
+new_chunk(size_t size)
+{
+	struct arena_chunk *chunk;
+
+	if(size < ARENA_CHUNK_SIZE)
+		size = ARENA_CHUNK_SIZE;
+
+	if(size == ARENA_CHUNK_SIZE && arena_spare != NULL)
+	{
+		chunk = arena_spare;
+		arena_spare = NULL;
+	}
+	else
+	{
+		chunk = rb_malloc(ARENA_ALIGN(sizeof(struct arena_chunk)) + size);
+		chunk->size = size;
+	}
+
+	chunk->used = 0;
+	chunk->prev = NULL;
+	return chunk;
+}
+
+static void
+free_chunk(struct arena_chunk *chunk)
+{
+	if(chunk->size == ARENA_CHUNK_SIZE && arena_spare == NULL)
+		arena_spare = chunk;
+	else
+		rb_free(chunk);
+}
+
+void
+init_arena(void)
+{
+	arena_base = arena_cur = new_chunk(ARENA_CHUNK_SIZE);
+}
+
+void *
+arena_alloc(size_t len)
+{
+	struct arena_chunk *chunk;
+	void *ptr;
+
+	len = ARENA_ALIGN(len);
+
+	if(arena_cur->size - arena_cur->used < len)
+	{
+		chunk = new_chunk(len);
+		chunk->prev = arena_cur;
+		arena_cur = chunk;
+	}
+
+	ptr = CHUNK_DATA(arena_cur) + arena_cur->used;
+	arena_cur->used += len;
+	return ptr;
+}
+
+char *
+arena_strdup(const char *s)
+{
+	size_t len = strlen(s) + 1;
+
+	return memcpy(arena_alloc(len), s, len);
+}
+
+char *
+arena_sprintf(const char *format, ...)
+{
+	va_list args;
+	char buf[BUFSIZE];
+
+	va_start(args, format);
+	rb_vsnprintf(buf, sizeof(buf), format, args);
+	va_end(args);
+
+	return arena_strdup(buf);
+}
+
+void
+arena_mark(struct arena_mark *mark)
+{
+	mark->chunk = arena_cur;
+	mark->used = arena_cur->used;
+}
+
+/*
+ * arena_release - throw away everything allocated since the mark was taken
+ */
+void
+arena_release(const struct arena_mark *mark)
+{
+	struct arena_chunk *chunk;
+
+	while(arena_cur != mark->chunk && arena_cur != arena_base)
+	{
+		chunk = arena_cur;
+		arena_cur = chunk->prev;
+		free_chunk(chunk);
+	}
+
+	arena_cur->used = mark->used;
+}
+
+void
+count_arena_memory(size_t *count, size_t *memory)
+{
+	struct arena_chunk *chunk;
+	size_t c = 0, m = 0;
+
+	for(chunk = arena_cur; chunk != NULL; chunk = chunk->prev)
+	{
+		c++;
+		m += chunk->size;
+	}
+	if(arena_spare != NULL)
+	{
+		c++;
+		m += arena_spare->size;
+	}
+
+	*count = c;
+	*memory = m;
+}
@@ -46,17 +46,25 @@
 #include "ircd.h"
 #include "msg.h"		/* XXX: MAXPARA */
 #include "operhash.h"
+#include "bandb_snapshot.h"
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
 
 static char bandb_add_letter[LAST_BANDB_TYPE] = {
 	'K', 'D', 'X', 'R'
 };
 
 rb_dlink_list bandb_pending;
+static int bandb_listing;	/* a listing has started, see bandb_handle_finish() */
 
 static rb_helper *bandb_helper;
 static int start_bandb(void);
 
 static void bandb_parse(rb_helper *);
+static void bandb_handle_clear(void);
+static void bandb_unqueue_removal(bandb_type type, const char *mask1, const char *mask2);
 static void bandb_restart_cb(rb_helper *);
 static char *bandb_path;
 
@@ -145,6 +153,8 @@ bandb_del(bandb_type type, const char *mask1, const char *mask2)
 {
 	static char buf[BUFSIZE];
 
+	bandb_unqueue_removal(type, mask1, mask2);
+
 	buf[0] = '\0';
 
 	rb_snprintf_append(buf, sizeof(buf), "%c %s", bandb_del_letter[type], mask1);
@@ -156,22 +166,22 @@ bandb_del(bandb_type type, const char *mask1, const char *mask2)
 }
 
 static void
-bandb_handle_ban(char *parv[], int parc)
+bandb_add_pending(char type, const char *user, const char *host, const char *oper,
+		  const char *reason)
 {
 	struct ConfItem *aconf;
-	char *p;
-	int para = 1;
+	const char *p;
 
 	aconf = make_conf();
 	aconf->port = 0;
 
-	if(parv[0][0] == 'K')
-		aconf->user = rb_strdup(parv[para++]);
+	if(type == 'K')
+		aconf->user = rb_strdup(user);
 
-	aconf->host = rb_strdup(parv[para++]);
-	aconf->info.oper = operhash_add(parv[para++]);
+	aconf->host = rb_strdup(host);
+	aconf->info.oper = operhash_add(oper);
 
-	switch (parv[0][0])
+	switch (type)
 	{
 	case 'K':
 		aconf->status = CONF_KILL;
@@ -194,17 +204,127 @@ bandb_handle_ban(char *parv[], int parc)
 		break;
 	}
 
-	if((p = strchr(parv[para], '|')))
+	if((p = strchr(reason, '|')))
 	{
-		*p++ = '\0';
-		aconf->spasswd = rb_strdup(p);
+		aconf->spasswd = rb_strdup(p + 1);
+		aconf->passwd = rb_strndup(reason, p - reason + 1);
 	}
-
-	aconf->passwd = rb_strdup(parv[para]);
+	else
+		aconf->passwd = rb_strdup(reason);
 
 	rb_dlinkAddAlloc(aconf, &bandb_pending);
 }
 
+static void
+bandb_handle_ban(char *parv[], int parc)
+{
+	if(parv[0][0] == 'K')
+	{
+		if(parc < 5)
+			return;
+		bandb_add_pending('K', parv[1], parv[2], parv[3], parv[4]);
+	}
+	else
+	{
+		if(parc < 4)
+			return;
+		bandb_add_pending(parv[0][0], NULL, parv[1], parv[2], parv[3]);
+	}
+}
+
+#ifndef _WIN32
+/* reads one length-prefixed string from a snapshot record */
+static const char *
+bandb_snapshot_string(const char **pos, const char *end)
+{
+	const char *str;
+	uint16_t len;
+
+	if(end - *pos < (ptrdiff_t) sizeof(len))
+		return NULL;
+
+	memcpy(&len, *pos, sizeof(len));
+	str = *pos + sizeof(len);
+
+	if(end - str < (ptrdiff_t) len + 1 || str[len] != '\0')
+		return NULL;
+
+	*pos = str + len + 1;
+	return str;
+}
+
+/*
+ * bandb_handle_snapshot()
+ *
+ * Loads the binary ban snapshot written by bandb straight into
+ * bandb_pending, see bandb_snapshot.h for the layout.  Returns 1 on
+ * success; on failure nothing is left pending.
+ */
+static int
+bandb_handle_snapshot(const char *path)
+{
+	struct stat st;
+	const char *map, *pos, *end;
+	const char *mask1, *mask2, *oper, *reason;
+	uint32_t header[2], i;
+	char type;
+	int fd, ok = 0;
+
+	if((fd = open(path, O_RDONLY)) == -1)
+		return 0;
+
+	if(fstat(fd, &st) == -1 || st.st_size < SNAPSHOT_HEADER_LEN)
+	{
+		close(fd);
+		return 0;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if(map == MAP_FAILED)
+		return 0;
+
+	end = map + st.st_size;
+	memcpy(header, map + SNAPSHOT_MAGIC_LEN, sizeof(header));
+
+	if(!memcmp(map, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_LEN) && header[0] == SNAPSHOT_VERSION)
+	{
+		pos = map + SNAPSHOT_HEADER_LEN;
+
+		for(i = 0; i < header[1]; i++)
+		{
+			if(pos >= end)
+				break;
+
+			type = *pos++;
+
+			if((mask1 = bandb_snapshot_string(&pos, end)) == NULL ||
+			   (mask2 = bandb_snapshot_string(&pos, end)) == NULL ||
+			   (oper = bandb_snapshot_string(&pos, end)) == NULL ||
+			   (reason = bandb_snapshot_string(&pos, end)) == NULL)
+				break;
+
+			if(type == 'K')
+				bandb_add_pending(type, mask1, mask2, oper, reason);
+			else if(type == 'D' || type == 'X' || type == 'R')
+				bandb_add_pending(type, NULL, mask2, oper, reason);
+			else
+				break;
+		}
+
+		ok = (i == header[1] && pos == end);
+	}
+
+	munmap((void *) map, st.st_size);
+
+	if(!ok)
+		bandb_handle_clear();
+
+	return ok;
+}
+#endif
+
 static int
 bandb_check_kline(struct ConfItem *aconf)
 {
@@ -312,70 +432,436 @@ bandb_handle_clear(void)
 		free_conf(ptr->data);
 		rb_dlinkDestroy(ptr, &bandb_pending);
 	}
+
+	bandb_listing = 1;
+}
+
+/* adds one loaded ban to the live ban set; returns 1 if it was added */
+static int
+bandb_install_ban(struct ConfItem *aconf)
+{
+	switch (aconf->status)
+	{
+	case CONF_KILL:
+		if(bandb_check_kline(aconf))
+		{
+			add_conf_by_address(aconf->host, CONF_KILL, aconf->user, NULL, aconf);
+			return 1;
+		}
+		break;
+
+	case CONF_DLINE:
+		if(bandb_check_dline(aconf))
+		{
+			add_conf_by_address(aconf->host, CONF_DLINE, aconf->user, NULL, aconf);
+			return 1;
+		}
+		break;
+
+	case CONF_XLINE:
+		if(bandb_check_xline(aconf))
+		{
+			rb_dlinkAddAlloc(aconf, &xline_conf_list);
+			return 1;
+		}
+		break;
+
+	case CONF_RESV_CHANNEL:
+		if(bandb_check_resv_channel(aconf))
+		{
+			add_to_resv_hash(aconf->host, aconf);
+			return 1;
+		}
+		break;
+
+	case CONF_RESV_NICK:
+		if(bandb_check_resv_nick(aconf))
+		{
+			rb_dlinkAddAlloc(aconf, &resv_conf_list);
+			return 1;
+		}
+		break;
+	}
+
+	free_conf(aconf);
+	return 0;
+}
+
+/*
+ * REHASH BANS after the initial load is applied as a diff: bans that
+ * are unchanged stay in place, bans whose reason changed are updated in
+ * place, and removals then additions are worked through a chunk at a
+ * time from an event, so the server is never without its bans and never
+ * stalls on a large list.  Removals hold the live ConfItem itself; an
+ * oper removing that ban meanwhile goes through bandb_del(), which drops
+ * it from the queue before it is freed.
+ */
+#define BANDB_APPLY_CHUNK	5000
+
+/* a chunk adding more bans than this checks every client instead */
+#define BANDB_CHECK_TARGETED	64
+
+struct bandb_rehash_stats bandb_stats;
+
+static int bandb_loaded;
+static rb_dlink_list bandb_remove_queue;
+static rb_dlink_list bandb_add_queue;
+static struct ev_entry *bandb_apply_ev;
+static unsigned int bandb_added_types;
+
+static char *
+bandb_conf_key(struct ConfItem *aconf)
+{
+	char buf[BUFSIZE];
+
+	if(aconf->status == CONF_KILL)
+		rb_snprintf(buf, sizeof(buf), "K %s@%s", aconf->user, aconf->host);
+	else
+		rb_snprintf(buf, sizeof(buf), "%c %s",
+			    aconf->status == CONF_DLINE ? 'D' :
+			    aconf->status == CONF_XLINE ? 'X' : 'R', aconf->host);
+
+	return rb_strdup(buf);
+}
+
+static int
+bandb_conf_same(struct ConfItem *aconf, struct ConfItem *other)
+{
+	if(aconf->status != other->status || strcmp(aconf->passwd, other->passwd))
+		return 0;
+
+	if(aconf->spasswd == NULL || other->spasswd == NULL)
+		return aconf->spasswd == other->spasswd;
+
+	return !strcmp(aconf->spasswd, other->spasswd);
+}
+
+/* compares one live ban against the freshly loaded set */
+static void
+bandb_diff_one(struct ConfItem *aconf, void *data)
+{
+	struct rb_dictionary *loaded = data;
+	struct rb_dictionaryElement *elem;
+	struct ConfItem *newconf;
+	const char *oper;
+	char *swap;
+	char *key = bandb_conf_key(aconf);
+	char *loadedkey;
+
+	elem = rb_dictionary_find(loaded, key);
+	rb_free(key);
+
+	if(elem == NULL || (newconf = elem->data)->status != aconf->status)
+	{
+		rb_dlinkAddTailAlloc(aconf, &bandb_remove_queue);
+		return;
+	}
+
+	if(bandb_conf_same(aconf, newconf))
+		bandb_stats.unchanged++;
+	else
+	{
+		/* only the reason or the oper changed, the ban itself stays
+		 * where it is and takes the new ones; free_conf() below then
+		 * frees the old ones
+		 */
+		swap = aconf->passwd;
+		aconf->passwd = newconf->passwd;
+		newconf->passwd = swap;
+
+		swap = aconf->spasswd;
+		aconf->spasswd = newconf->spasswd;
+		newconf->spasswd = swap;
+
+		oper = aconf->info.oper;
+		aconf->info.oper = newconf->info.oper;
+		newconf->info.oper = oper;
+		bandb_stats.updated++;
+	}
+
+	free_conf(newconf);
+	loadedkey = (char *) elem->key;
+	rb_dictionary_delete(loaded, loadedkey);
+	rb_free(loadedkey);
+}
+
+static void
+bandb_queue_loaded(struct rb_dictionaryElement *elem, void *unused)
+{
+	rb_dlinkAddTailAlloc(elem->data, &bandb_add_queue);
+	rb_free((char *) elem->key);
+}
+
+/* removes one live ban queued by bandb_diff_one() */
+static void
+bandb_remove_ban(struct ConfItem *aconf)
+{
+	switch (aconf->status)
+	{
+	case CONF_KILL:
+	case CONF_DLINE:
+		/* frees it, unless clients still hold it */
+		delete_one_address_conf(aconf->host, aconf);
+		break;
+
+	case CONF_XLINE:
+		rb_dlinkFindDestroy(aconf, &xline_conf_list);
+		free_conf(aconf);
+		break;
+
+	case CONF_RESV_CHANNEL:
+		del_from_resv_hash(aconf->host, aconf);
+		free_conf(aconf);
+		break;
+
+	case CONF_RESV_NICK:
+		rb_dlinkFindDestroy(aconf, &resv_conf_list);
+		free_conf(aconf);
+		break;
+	}
+
+	bandb_stats.removed++;
+}
+
+/*
+ * bandb_unqueue_removal
+ *
+ * inputs	- type and mask of a ban an oper is removing
+ * output	- none
+ * side effects - a queued removal of that ban is dropped, the caller
+ *		  frees the ConfItem and it must not be removed again
+ */
+static void
+bandb_unqueue_removal(bandb_type type, const char *mask1, const char *mask2)
+{
+	static const unsigned int bandb_status[LAST_BANDB_TYPE] = {
+		CONF_KILL, CONF_DLINE, CONF_XLINE, CONF_RESV_CHANNEL | CONF_RESV_NICK
+	};
+	struct ConfItem *aconf;
+	rb_dlink_node *ptr, *next_ptr;
+
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, bandb_remove_queue.head)
+	{
+		aconf = ptr->data;
+
+		if(!(aconf->status & bandb_status[type]))
+			continue;
+
+		if(type == BANDB_KLINE ? irccmp(aconf->user, mask1) || irccmp(aconf->host, mask2) :
+		   irccmp(aconf->host, mask1))
+			continue;
+
+		rb_dlinkDestroy(ptr, &bandb_remove_queue);
+	}
+
+	bandb_stats.pending = rb_dlink_list_length(&bandb_remove_queue) +
+		rb_dlink_list_length(&bandb_add_queue);
+}
+
+/* applies up to max queued changes; returns 1 once nothing is left */
+static int
+bandb_apply_chunk(unsigned long max)
+{
+	struct ConfItem *aconf;
+	rb_dlink_node *ptr, *next_ptr;
+	rb_dlink_list added = { NULL, NULL, 0 };
+	unsigned long done = 0;
+	int targeted;
+
+	while(done < max && (ptr = bandb_remove_queue.head) != NULL)
+	{
+		aconf = ptr->data;
+		rb_dlinkDestroy(ptr, &bandb_remove_queue);
+		bandb_remove_ban(aconf);
+		done++;
+	}
+
+	while(done < max && (ptr = bandb_add_queue.head) != NULL)
+	{
+		aconf = ptr->data;
+		rb_dlinkDestroy(ptr, &bandb_add_queue);
+
+		if(bandb_install_ban(aconf))
+		{
+			if(aconf->status & (CONF_KILL | CONF_DLINE | CONF_XLINE))
+				rb_dlinkAddAlloc(aconf, &added);
+			bandb_stats.added++;
+		}
+		done++;
+	}
+
+	/* only new bans can affect clients already connected; checked now,
+	 * while nothing else can have removed them, unless there are enough
+	 * of them that one lookup per client is cheaper
+	 */
+	targeted = rb_dlink_list_length(&added) <= BANDB_CHECK_TARGETED;
+	if(targeted)
+		check_new_bans(&added);
+
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, added.head)
+	{
+		if(!targeted)
+			bandb_added_types |= ((struct ConfItem *) ptr->data)->status;
+		rb_dlinkDestroy(ptr, &added);
+	}
+
+	bandb_stats.pending = rb_dlink_list_length(&bandb_remove_queue) +
+		rb_dlink_list_length(&bandb_add_queue);
+
+	return bandb_stats.pending == 0;
+}
+
+static void
+bandb_apply_done(void)
+{
+	if(bandb_apply_ev != NULL)
+	{
+		rb_event_delete(bandb_apply_ev);
+		bandb_apply_ev = NULL;
+	}
+
+	if(bandb_added_types & CONF_DLINE)
+		check_dlines();
+	if(bandb_added_types & CONF_KILL)
+		check_klines();
+	if(bandb_added_types & CONF_XLINE)
+		check_xlines();
+
+	bandb_added_types = 0;
+	bandb_stats.finished = rb_current_time();
+
+	sendto_realops_snomask(SNO_GENERAL, L_ALL,
+			       "Ban rehash complete: %lu added, %lu removed, %lu updated, %lu unchanged in %ld seconds",
+			       bandb_stats.added, bandb_stats.removed, bandb_stats.updated,
+			       bandb_stats.unchanged,
+			       (long) (bandb_stats.finished - bandb_stats.started));
+}
+
+static void
+bandb_apply_event(void *unused)
+{
+	if(bandb_apply_chunk(BANDB_APPLY_CHUNK))
+		bandb_apply_done();
 }
 
 static void
 bandb_handle_finish(void)
 {
+	struct rb_dictionary *loaded;
 	struct ConfItem *aconf;
 	rb_dlink_node *ptr, *next_ptr;
+	char *key;
+	int i;
+
+	/* only a listing that actually arrived may be diffed, an empty
+	 * bandb_pending would otherwise remove every ban
+	 */
+	if(!bandb_listing)
+	{
+		s_assert(0);
+		ilog(L_MAIN, "bandb - end of ban listing without a listing, ignored");
+		return;
+	}
+
+	bandb_listing = 0;
+
+	/* a rehash that is still being applied is completed first */
+	if(bandb_apply_ev != NULL)
+	{
+		bandb_apply_chunk(ULONG_MAX);
+		bandb_apply_done();
+	}
+
+	bandb_stats.started = rb_current_time();
+	bandb_stats.finished = 0;
+	bandb_stats.added = bandb_stats.removed = bandb_stats.unchanged = 0;
+	bandb_stats.updated = 0;
+	bandb_stats.rehashes++;
 
-	clear_out_address_conf_bans();
-	clear_s_newconf_bans();
+	if(!bandb_loaded)
+	{
+		/* nothing to diff against on the initial load */
+		RB_DLINK_FOREACH_SAFE(ptr, next_ptr, bandb_pending.head)
+		{
+			aconf = ptr->data;
+			rb_dlinkDestroy(ptr, &bandb_pending);
+
+			if(bandb_install_ban(aconf))
+				bandb_stats.added++;
+		}
+
+		bandb_loaded = 1;
+		bandb_stats.finished = rb_current_time();
+		check_banned_lines();
+		return;
+	}
+
+	loaded = rb_dictionary_create(irccmp);
 
 	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, bandb_pending.head)
 	{
 		aconf = ptr->data;
-
 		rb_dlinkDestroy(ptr, &bandb_pending);
 
-		switch (aconf->status)
+		key = bandb_conf_key(aconf);
+
+		if(rb_dictionary_find(loaded, key) != NULL)
 		{
-		case CONF_KILL:
-			if(bandb_check_kline(aconf))
-				add_conf_by_address(aconf->host, CONF_KILL, aconf->user, NULL,
-						    aconf);
-			else
-				free_conf(aconf);
+			free_conf(aconf);
+			rb_free(key);
+			continue;
+		}
 
-			break;
+		rb_dictionary_add(loaded, key, aconf);
+	}
 
-		case CONF_DLINE:
-			if(bandb_check_dline(aconf))
-				add_conf_by_address(aconf->host, CONF_DLINE, aconf->user, NULL,
-						    aconf);
-			else
-				free_conf(aconf);
+	foreach_address_conf_ban(bandb_diff_one, loaded);
 
-			break;
+	RB_DLINK_FOREACH(ptr, xline_conf_list.head)
+	{
+		aconf = ptr->data;
+		if(!aconf->hold)
+			bandb_diff_one(aconf, loaded);
+	}
 
-		case CONF_XLINE:
-			if(bandb_check_xline(aconf))
-				rb_dlinkAddAlloc(aconf, &xline_conf_list);
-			else
-				free_conf(aconf);
+	RB_DLINK_FOREACH(ptr, resv_conf_list.head)
+	{
+		aconf = ptr->data;
+		if(!aconf->hold)
+			bandb_diff_one(aconf, loaded);
+	}
 
-			break;
+	HASH_WALK(i, R_MAX, ptr, resvTable)
+	{
+		aconf = ptr->data;
+		if(!aconf->hold)
+			bandb_diff_one(aconf, loaded);
+	}
+	HASH_WALK_END
 
-		case CONF_RESV_CHANNEL:
-			if(bandb_check_resv_channel(aconf))
-				add_to_resv_hash(aconf->host, aconf);
-			else
-				free_conf(aconf);
+	/* whatever was not matched is new */
+	rb_dictionary_destroy(loaded, bandb_queue_loaded, NULL);
 
-			break;
+	bandb_stats.pending = rb_dlink_list_length(&bandb_remove_queue) +
+		rb_dlink_list_length(&bandb_add_queue);
 
-		case CONF_RESV_NICK:
-			if(bandb_check_resv_nick(aconf))
-				rb_dlinkAddAlloc(aconf, &resv_conf_list);
-			else
-				free_conf(aconf);
+	if(bandb_stats.pending == 0)
+	{
+		bandb_stats.finished = rb_current_time();
+		return;
+	}
 
-			break;
-		}
+	if(bandb_apply_chunk(BANDB_APPLY_CHUNK))
+	{
+		bandb_apply_done();
+		return;
 	}
 
-	check_banned_lines();
+	sendto_realops_snomask(SNO_GENERAL, L_ALL,
+			       "Ban rehash: %lu changes left to apply, %lu per second",
+			       bandb_stats.pending, (unsigned long) BANDB_APPLY_CHUNK);
+
+	bandb_apply_ev = rb_event_add("bandb_apply", bandb_apply_event, NULL, 1);
 }
 
 static void
@@ -415,8 +901,24 @@ bandb_parse(rb_helper * helper)
 			bandb_handle_ban(parv, parc);
 			break;
 
+		case 'S':
+			/* a snapshot is the whole listing, no F follows it */
+#ifndef _WIN32
+			if(parc > 1 && bandb_handle_snapshot(parv[1]))
+			{
+				bandb_handle_finish();
+				break;
+			}
+#endif
+			ilog(L_MAIN, "bandb - unable to load ban snapshot, requesting bans as text");
+			bandb_listing = 0;
+			rb_helper_write(helper, "T");
+			break;
+
 		case 'C':
 			bandb_handle_clear();
+			break;
+
 		case 'F':
 			bandb_handle_finish();
 			break;
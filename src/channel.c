@@ -43,6 +43,7 @@
 #include "logger.h"
 #include "packet.h"
 #include "inline/stringops.h"
+#include "arena.h"
 
 struct config_channel_entry ConfigChannel;
 rb_dlink_list global_channel_list;
@@ -335,6 +336,244 @@ remove_user_from_channels(struct Client *client_p)
 	client_p->user->channel.length = 0;
 }
 
+/*
+ * Netsplit teardown.  Instead of running every departing user through
+ * sendto_common_channels_local() and remove_user_from_channels() on its
+ * own, split_add_user() queues their memberships per channel, and
+ * split_remove_users() then walks each affected channel once: the
+ * QUITs are built into one block that is handed to every local member,
+ * and the memberships are dropped before the channel is checked for
+ * destruction.
+ */
+struct split_channel
+{
+	rb_dlink_node node;
+	struct Channel *chptr;
+	rb_dlink_list members;	/* departing memberships, in exit order */
+	unsigned int index;
+};
+
+static rb_dlink_list split_channels;
+
+/* split_add_user()
+ *
+ * input	- remote user leaving in a netsplit
+ * output	-
+ * side effects - the user's memberships are queued for split_remove_users()
+ */
+void
+split_add_user(struct Client *client_p)
+{
+	struct split_channel *sc;
+	struct membership *msptr;
+	rb_dlink_node *ptr;
+
+	RB_DLINK_FOREACH(ptr, client_p->user->channel.head)
+	{
+		msptr = ptr->data;
+		sc = msptr->chptr->split;
+
+		if(sc == NULL)
+		{
+			sc = rb_malloc(sizeof(struct split_channel));
+			sc->chptr = msptr->chptr;
+			sc->index = rb_dlink_list_length(&split_channels);
+			msptr->chptr->split = sc;
+			rb_dlinkAddTail(sc, &sc->node, &split_channels);
+		}
+
+		rb_dlinkAddTailAlloc(msptr, &sc->members);
+	}
+}
+
+/* split_quit_sent()
+ *
+ * input	- departing user, local user, channel being handled
+ * output	- YES if the local user shares a channel with the departing
+ *		  user that was handled before sc, and so already has its QUIT
+ * side effects -
+ */
+static bool
+split_quit_sent(struct Client *source_p, struct Client *target_p, struct split_channel *sc)
+{
+	struct membership *msptr;
+	rb_dlink_node *ptr;
+
+	RB_DLINK_FOREACH(ptr, source_p->user->channel.head)
+	{
+		msptr = ptr->data;
+
+		if(msptr->chptr->split != NULL && msptr->chptr->split->index < sc->index &&
+		   find_channel_membership(msptr->chptr, target_p) != NULL)
+			return YES;
+	}
+
+	return NO;
+}
+
+/* split_batch_build()
+ *
+ * input	- buffer, channel being handled, quit reason
+ * output	-
+ * side effects - the channel's QUITs are added to the buffer, tagged
+ *		  with the netsplit batch reference
+ */
+static void
+split_batch_build(buf_head_t *batchbuf, struct split_channel *sc, const char *comment)
+{
+	struct Client *source_p;
+	rb_dlink_node *ptr;
+
+	RB_DLINK_FOREACH(ptr, sc->members.head)
+	{
+		source_p = ((struct membership *) ptr->data)->client_p;
+		rb_linebuf_putmsg(batchbuf, NULL, NULL, "@batch=s%lu :%s!%s@%s QUIT :%s",
+				  current_serial, source_p->name, source_p->username,
+				  source_p->host, comment);
+	}
+}
+
+/* split_remove_users()
+ *
+ * input	- quit reason
+ * output	- number of channels that lost members
+ * side effects - local members are sent the QUITs of everyone queued by
+ *		  split_add_user(), who is then removed from all channels
+ *
+ * Users that negotiated the batch capability get their QUITs tagged and
+ * wrapped in a single netsplit batch, so they can fold the split into one
+ * line.  The quit reason is always "server1 server2", which is what the
+ * batch parameters want.
+ */
+int
+split_remove_users(const char *comment)
+{
+	struct split_channel *sc;
+	struct membership *msptr;
+	struct Channel *chptr;
+	struct Client *source_p;
+	struct Client *target_p;
+	rb_dlink_node *ptr, *next_ptr;
+	rb_dlink_node *mptr, *next_mptr;
+	rb_dlink_node *lptr;
+	rb_dlink_list batched = { NULL, NULL, 0 };
+	buf_head_t linebuf;
+	buf_head_t batchbuf;
+	bool batchbuf_built;
+	int count = 0;
+
+	++current_serial;
+
+	RB_DLINK_FOREACH(ptr, split_channels.head)
+	{
+		sc = ptr->data;
+		chptr = sc->chptr;
+
+		if(rb_dlink_list_length(&chptr->locmembers) == 0)
+			continue;
+
+		rb_linebuf_newbuf(&linebuf);
+		rb_linebuf_newbuf(&batchbuf);
+		batchbuf_built = NO;
+
+		RB_DLINK_FOREACH(mptr, sc->members.head)
+		{
+			source_p = ((struct membership *) mptr->data)->client_p;
+			rb_linebuf_putmsg(&linebuf, NULL, NULL, ":%s!%s@%s QUIT :%s",
+					  source_p->name, source_p->username,
+					  source_p->host, comment);
+		}
+
+		RB_DLINK_FOREACH(lptr, chptr->locmembers.head)
+		{
+			target_p = ((struct membership *) lptr->data)->client_p;
+
+			if(IsIOError(target_p))
+				continue;
+
+			/* first affected channel for this client, nothing
+			 * sent yet so it gets the whole block
+			 */
+			if(target_p->serial != current_serial)
+			{
+				target_p->serial = current_serial;
+
+				if(!IsCapable(target_p, CLICAP_BATCH))
+				{
+					sendto_one_linebuf(target_p, &linebuf);
+					continue;
+				}
+
+				if(!batchbuf_built)
+				{
+					split_batch_build(&batchbuf, sc, comment);
+					batchbuf_built = YES;
+				}
+
+				sendto_one(target_p, ":%s BATCH +s%lu netsplit %s", me.name, current_serial,
+					   comment);
+				rb_dlinkAddAlloc(target_p, &batched);
+				sendto_one_linebuf(target_p, &batchbuf);
+				continue;
+			}
+
+			RB_DLINK_FOREACH(mptr, sc->members.head)
+			{
+				source_p = ((struct membership *) mptr->data)->client_p;
+
+				if(split_quit_sent(source_p, target_p, sc))
+					continue;
+
+				if(IsCapable(target_p, CLICAP_BATCH))
+					sendto_one(target_p, "@batch=s%lu :%s!%s@%s QUIT :%s",
+						   current_serial, source_p->name,
+						   source_p->username, source_p->host, comment);
+				else
+					sendto_one(target_p, ":%s!%s@%s QUIT :%s",
+						   source_p->name, source_p->username,
+						   source_p->host, comment);
+			}
+		}
+
+		rb_linebuf_donebuf(&linebuf);
+		rb_linebuf_donebuf(&batchbuf);
+	}
+
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, batched.head)
+	{
+		sendto_one(ptr->data, ":%s BATCH -s%lu", me.name, current_serial);
+		rb_free_rb_dlink_node(ptr);
+	}
+
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, split_channels.head)
+	{
+		sc = ptr->data;
+		chptr = sc->chptr;
+
+		RB_DLINK_FOREACH_SAFE(mptr, next_mptr, sc->members.head)
+		{
+			msptr = mptr->data;
+
+			rb_dlinkDelete(&msptr->usernode, &msptr->client_p->user->channel);
+			rb_dlinkDelete(&msptr->channode, &chptr->members);
+			rb_bh_free(member_heap, msptr);
+			rb_dlinkDestroy(mptr, &sc->members);
+		}
+
+		chptr->split = NULL;
+
+		if(!(chptr->mode.mode & MODE_PERMANENT)
+		   && rb_dlink_list_length(&chptr->members) <= 0)
+			destroy_channel(chptr);
+
+		rb_dlinkDelete(&sc->node, &split_channels);
+		rb_free(sc);
+		count++;
+	}
+
+	return count;
+}
+
 /* invalidate_bancache_user()
  *
  * input	- user to invalidate ban cache for
@@ -404,6 +643,48 @@ free_channel_list(rb_dlink_list * list)
 	list->length = 0;
 }
 
+/* channel_list_digest()
+ *
+ * input	- list of list-type modes, salt chosen by the sender
+ * output	- digest of the masks on the list
+ * side effects -
+ *
+ * The masks are hashed case insensitively, as BMASK compares them, and
+ * the hashes summed, so the order of the list does not matter.
+ */
+uint64_t
+channel_list_digest(rb_dlink_list * list, uint64_t salt)
+{
+	rb_dlink_node *ptr;
+	struct mode_list_t *actualModeItem;
+	const unsigned char *s;
+	uint64_t digest = 0;
+	uint64_t h;
+
+	RB_DLINK_FOREACH(ptr, list->head)
+	{
+		actualModeItem = ptr->data;
+
+		h = salt ^ UINT64_C(0xcbf29ce484222325);
+		for(s = (const unsigned char *) actualModeItem->maskstr; *s != '\0'; s++)
+		{
+			h ^= ToLower(*s);
+			h *= UINT64_C(0x100000001b3);
+		}
+
+		/* mix, so sums of similar masks do not cancel out */
+		h ^= h >> 33;
+		h *= UINT64_C(0xff51afd7ed558ccd);
+		h ^= h >> 33;
+		h *= UINT64_C(0xc4ceb9fe1a85ec53);
+		h ^= h >> 33;
+
+		digest += h;
+	}
+
+	return digest;
+}
+
 /* destroy_channel()
  *
  * input	- channel to destroy
@@ -434,6 +715,7 @@ destroy_channel(struct Channel *chptr)
 	/* Free the topic */
 	free_topic(chptr);
 
+	burst_channel_removed(chptr);
 	rb_dlinkDelete(&chptr->node, &global_channel_list);
 	del_from_channel_hash(chptr->chname, chptr);
 	free_channel(chptr);
@@ -1283,6 +1565,146 @@ send_channel_join(struct Channel *chptr, struct Client *client_p)
 					     user->suser, client_p->info);
 }
 
+/* reference of the netjoin batch open for the SJOIN being processed */
+static unsigned long netjoin_serial;
+
+/*
+ * start_netjoin()
+ *
+ * input        - channel joined, server bursting it
+ * output       - none
+ * side effects - local members which negotiated the batch capability are
+ *		  sent the start of a netjoin batch, which the joins and
+ *		  status modes from this SJOIN are tagged with until
+ *		  end_netjoin()
+ */
+void
+start_netjoin(struct Channel *chptr, struct Client *server_p)
+{
+	struct Client *target_p;
+	rb_dlink_node *ptr;
+
+	netjoin_serial++;
+
+	RB_DLINK_FOREACH(ptr, chptr->locmembers.head)
+	{
+		target_p = ((struct membership *) ptr->data)->client_p;
+
+		if(IsIOError(target_p) || !IsCapable(target_p, CLICAP_BATCH))
+			continue;
+
+		sendto_one(target_p, ":%s BATCH +j%lu netjoin %s %s", me.name, netjoin_serial,
+			   ConfigServerHide.flatten_links ? "*.net" : server_p->servptr->name,
+			   ConfigServerHide.flatten_links ? "*.split" : server_p->name);
+	}
+}
+
+/*
+ * send_netjoin()
+ *
+ * input        - channel joined, client joining
+ * output       - none
+ * side effects - as send_channel_join(), except that local members which
+ *		  negotiated the batch capability get the join tagged with
+ *		  the batch from start_netjoin()
+ */
+void
+send_netjoin(struct Channel *chptr, struct Client *client_p)
+{
+	struct Client *target_p;
+	rb_dlink_node *ptr;
+
+	if(!IsClient(client_p))
+		return;
+
+	sendto_channel_local_with_capability(ALL_MEMBERS, NOCAPS,
+					     CLICAP_EXTENDED_JOIN | CLICAP_BATCH, chptr,
+					     ":%s!%s@%s JOIN %s", client_p->name,
+					     client_p->username, client_p->host, chptr->chname);
+
+	sendto_channel_local_with_capability(ALL_MEMBERS, CLICAP_EXTENDED_JOIN, CLICAP_BATCH,
+					     chptr, ":%s!%s@%s JOIN %s %s :%s", client_p->name,
+					     client_p->username, client_p->host, chptr->chname,
+					     EmptyString(client_p->user->suser) ? "*" : client_p->
+					     user->suser, client_p->info);
+
+	RB_DLINK_FOREACH(ptr, chptr->locmembers.head)
+	{
+		target_p = ((struct membership *) ptr->data)->client_p;
+
+		if(IsIOError(target_p) || !IsCapable(target_p, CLICAP_BATCH))
+			continue;
+
+		if(IsCapable(target_p, CLICAP_EXTENDED_JOIN))
+			sendto_one(target_p, "@batch=j%lu :%s!%s@%s JOIN %s %s :%s",
+				   netjoin_serial, client_p->name, client_p->username,
+				   client_p->host, chptr->chname,
+				   EmptyString(client_p->user->suser) ? "*" :
+				   client_p->user->suser, client_p->info);
+		else
+			sendto_one(target_p, "@batch=j%lu :%s!%s@%s JOIN %s",
+				   netjoin_serial, client_p->name, client_p->username,
+				   client_p->host, chptr->chname);
+	}
+}
+
+/*
+ * send_netjoin_mode()
+ *
+ * input        - channel, source of the modes, modes and their parameters
+ * output       - none
+ * side effects - the status modes of a netjoin are sent to local members,
+ *		  tagged with the batch from start_netjoin() for those
+ *		  which negotiated the batch capability
+ */
+void
+send_netjoin_mode(struct Channel *chptr, struct Client *source_p,
+		  const char *modes, const char *params)
+{
+	struct Client *target_p;
+	rb_dlink_node *ptr;
+
+	sendto_channel_local_with_capability(ALL_MEMBERS, NOCAPS, CLICAP_BATCH, chptr,
+					     ":%s MODE %s %s%s", source_p->name,
+					     chptr->chname, modes, params);
+
+	RB_DLINK_FOREACH(ptr, chptr->locmembers.head)
+	{
+		target_p = ((struct membership *) ptr->data)->client_p;
+
+		if(IsIOError(target_p) || !IsCapable(target_p, CLICAP_BATCH))
+			continue;
+
+		sendto_one(target_p, "@batch=j%lu :%s MODE %s %s%s", netjoin_serial,
+			   source_p->name, chptr->chname, modes, params);
+	}
+}
+
+/*
+ * end_netjoin()
+ *
+ * input        - channel joined
+ * output       - none
+ * side effects - local members which negotiated the batch capability are
+ *		  sent the end of the batch from start_netjoin()
+ */
+void
+end_netjoin(struct Channel *chptr)
+{
+	struct Client *target_p;
+	rb_dlink_node *ptr;
+
+	RB_DLINK_FOREACH(ptr, chptr->locmembers.head)
+	{
+		target_p = ((struct membership *) ptr->data)->client_p;
+
+		if(IsIOError(target_p) || !IsCapable(target_p, CLICAP_BATCH))
+			continue;
+
+		sendto_one(target_p, ":%s BATCH -j%lu", me.name, netjoin_serial);
+	}
+}
+
 /* allocate_topic()
  *
  * input	- channel to allocate topic for
@@ -1861,16 +2283,20 @@ user_join(struct Client *client_p, struct Client *source_p, const char *channels
 	char *p = NULL, *p2 = NULL;
 	char *chanlist;
 	char *mykey;
+	struct arena_mark mark;
 
 	jbuf[0] = '\0';
 
 	if(channels == NULL)
 		return;
 
+	/* autojoin on connect gets here from outside of parse() */
+	arena_mark(&mark);
+
 	/* rebuild the list of channels theyre supposed to be joining.
 	 * this code has a side effect of losing keys, but..
 	 */
-	chanlist = LOCAL_COPY(channels);
+	chanlist = arena_strdup(channels);
 	for(name = rb_strtok_r(chanlist, ",", &p); name; name = rb_strtok_r(NULL, ",", &p))
 	{
 		/* check the length and name of channel is ok */
@@ -1932,7 +2358,7 @@ user_join(struct Client *client_p, struct Client *source_p, const char *channels
 
 	if(keys != NULL)
 	{
-		mykey = LOCAL_COPY(keys);
+		mykey = arena_strdup(keys);
 		key = rb_strtok_r(mykey, ",", &p2);
 	}
 
@@ -2112,6 +2538,7 @@ user_join(struct Client *client_p, struct Client *source_p, const char *channels
 		call_hook(h_channel_join, &hook_info);
 	}
 
+	arena_release(&mark);
 	return;
 }
 
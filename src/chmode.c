@@ -43,6 +43,7 @@
 #include "logger.h"
 #include "chmode.h"
 #include "supported.h"
+#include "arena.h"
 
 /* Contains A-Za-z except beoqvI etc. */
 static int maxmodes_simple;
@@ -51,8 +52,6 @@ struct ChModeChange mode_changes[BUFSIZE];
 int mode_count;
 int mode_limit;
 static int mode_limit_simple;
-static int mask_pos;
-static int removed_mask_pos;
 
 /* XXX there must be a better way... */
 char cmodes_a[128];
@@ -429,8 +428,7 @@ check_string(char *s)
 static char *
 pretty_mask(const char *idmask)
 {
-	static char mask_buf[BUFSIZE];
-	int old_mask_pos;
+	char *pretty;
 	char *nick, *user, *host, *forward = NULL;
 	char splat[] = "*";
 	char *t, *at, *ex, *ex2;
@@ -438,27 +436,22 @@ pretty_mask(const char *idmask)
 	char e2 = 0;				/* save value that delimits forward channel */
 	char *mask;
 
-	mask = LOCAL_COPY(idmask);
+	mask = arena_strdup(idmask);
 	mask = check_string(mask);
 	collapse(mask);
 
 	nick = user = host = splat;
 
-	if((size_t) BUFSIZE - mask_pos < strlen(mask) + 5)
-		return NULL;
-
-	old_mask_pos = mask_pos;
-
 	if (*mask == '$')
 	{
-		mask_pos += rb_sprintf(mask_buf + mask_pos, "%s", mask) + 1;
-		t = mask_buf + old_mask_pos + 1;
+		pretty = arena_strdup(mask);
+		t = pretty + 1;
 		if (*t == '!')
 			*t = '~';
 		if (*t == '~')
 			t++;
 		*t = ToLower(*t);
-		return mask_buf + old_mask_pos;
+		return pretty;
 	}
 
 	at = ex = ex2 = NULL;
@@ -536,9 +529,9 @@ pretty_mask(const char *idmask)
 	}
 
 	if (forward)
-		mask_pos += rb_sprintf(mask_buf + mask_pos, "%s!%s@%s$%s", nick, user, host, forward) + 1;
+		pretty = arena_sprintf("%s!%s@%s$%s", nick, user, host, forward);
 	else
-		mask_pos += rb_sprintf(mask_buf + mask_pos, "%s!%s@%s", nick, user, host) + 1;
+		pretty = arena_sprintf("%s!%s@%s", nick, user, host);
 
 	/* restore mask, since we may need to use it again later */
 	if(at)
@@ -556,7 +549,7 @@ pretty_mask(const char *idmask)
 	if(fe)
 		forward[CHANNELLEN] = fe;
 
-	return mask_buf + old_mask_pos;
+	return pretty;
 }
 
 /* fix_key()
@@ -1072,8 +1065,7 @@ chm_list(struct Client *source_p, struct Channel *chptr, int alevel, int parc, i
 	else if(dir == MODE_DEL)
 	{
 		struct mode_list_t *removed;		
-		static char buf[BANLEN * MAXMODEPARAMS];
-		int old_removed_mask_pos = removed_mask_pos;
+		char *removed_mask;
 
 		if((removed = del_id(source_p, chptr, mask, list, mode_type)) == NULL)
 		{
@@ -1083,9 +1075,9 @@ chm_list(struct Client *source_p, struct Channel *chptr, int alevel, int parc, i
 		}
 
 		if(removed && removed->forward)
-			removed_mask_pos += rb_snprintf(buf + removed_mask_pos, sizeof(buf), "%s$%s", removed->maskstr, removed->forward) + 1;
+			removed_mask = arena_sprintf("%s$%s", removed->maskstr, removed->forward);
 		else
-			removed_mask_pos += rb_strlcpy(buf + removed_mask_pos, send_mask, sizeof(buf)) + 1;
+			removed_mask = arena_strdup(send_mask);
 
 		if(removed)
 		{
@@ -1099,7 +1091,7 @@ chm_list(struct Client *source_p, struct Channel *chptr, int alevel, int parc, i
 		mode_changes[mode_count].nocaps = 0;
 		mode_changes[mode_count].mems = mems;
 		mode_changes[mode_count].id = NULL;
-		mode_changes[mode_count++].arg = buf + old_removed_mask_pos;
+		mode_changes[mode_count++].arg = removed_mask;
 	}
 }
 
@@ -1739,10 +1731,14 @@ set_channel_mode(struct Client *client_p, struct Client *source_p, struct Channe
 	const char *ml = parv[0];
 	char c;
 	struct Client *fakesource_p;
+	struct arena_mark mark;
 	int flags_list[3] = { ALL_MEMBERS, ONLY_HALFOPSANDUP, ONLY_OPERS };
 
-	mask_pos = 0;
-	removed_mask_pos = 0;
+	/* masks built by the mode handlers live in the arena until the
+	 * changes have been sent; we may be called outside of parse()
+	 */
+	arena_mark(&mark);
+
 	mode_count = 0;
 	mode_limit = 0;
 	mode_limit_simple = 0;
@@ -1790,7 +1786,10 @@ set_channel_mode(struct Client *client_p, struct Client *source_p, struct Channe
 
 	/* bail out if we have nothing to do... */
 	if(!mode_count)
+	{
+		arena_release(&mark);
 		return;
+	}
 
 	if(IsServer(source_p))
 		rb_sprintf(cmdbuf, ":%s MODE %s ", fakesource_p->name, chptr->chname);
@@ -1879,6 +1878,8 @@ set_channel_mode(struct Client *client_p, struct Client *source_p, struct Channe
 	/* only propagate modes originating locally, or if we're hubbing */
 	if(MyClient(source_p) || rb_dlink_list_length(&serv_list) > 1)
 		send_cap_mode_changes(client_p, source_p, chptr, mode_changes, mode_count);
+
+	arena_release(&mark);
 }
 
 /* set_channel_mlock()
@@ -177,10 +177,86 @@ get_con_freq(struct Class *clptr)
  * side effects - class is added to class_list if new, else old class
  *                is updated with new values.
  */
+static int
+same_cidr_bitlens(struct Class *a, struct Class *b)
+{
+	int i;
+
+	if(CidrIpv4Levels(a) != CidrIpv4Levels(b) || CidrIpv6Levels(a) != CidrIpv6Levels(b))
+		return 0;
+
+	for(i = 0; i < CidrIpv4Levels(a); i++)
+		if(a->cidr_ipv4_limits[i].bitlen != b->cidr_ipv4_limits[i].bitlen)
+			return 0;
+
+	for(i = 0; i < CidrIpv6Levels(a); i++)
+		if(a->cidr_ipv6_limits[i].bitlen != b->cidr_ipv6_limits[i].bitlen)
+			return 0;
+
+	return 1;
+}
+
+static void
+copy_cidr_limits(struct Class *to, struct Class *from)
+{
+	memcpy(to->cidr_ipv4_limits, from->cidr_ipv4_limits, sizeof(to->cidr_ipv4_limits));
+	memcpy(to->cidr_ipv6_limits, from->cidr_ipv6_limits, sizeof(to->cidr_ipv6_limits));
+	CidrIpv4Levels(to) = CidrIpv4Levels(from);
+	CidrIpv6Levels(to) = CidrIpv6Levels(from);
+}
+
+static void
+count_ip_limits(struct Class *cl, rb_dlink_list *list)
+{
+	struct cidr_limit *limits;
+	struct Client *client_p;
+	struct ConfItem *aconf;
+	rb_patricia_node_t *pnode;
+	rb_dlink_node *ptr;
+	int levels, i;
+
+	RB_DLINK_FOREACH(ptr, list->head)
+	{
+		client_p = ptr->data;
+		aconf = client_p->localClient->att_conf;
+
+		if(aconf == NULL || ClassPtr(aconf) != cl)
+			continue;
+
+		limits = get_cidr_limits(cl, GET_SS_FAMILY(&client_p->localClient->ip), &levels);
+		for(i = 0; i < levels; i++)
+		{
+			pnode = make_and_lookup_ip(IpLimits(cl),
+						   (struct sockaddr *) &client_p->localClient->ip,
+						   limits[i].bitlen);
+			if(pnode != NULL)
+				pnode->data = (void *) (((intptr_t) pnode->data) + 1);
+		}
+	}
+}
+
+/*
+ * rebuild_ip_limits
+ *
+ * inputs	- class whose subnet sizes changed
+ * output	- NONE
+ * side effects - recounts the attached local clients under the new sizes
+ */
+static void
+rebuild_ip_limits(struct Class *cl)
+{
+	rb_destroy_patricia(IpLimits(cl), NULL);
+	IpLimits(cl) = rb_new_patricia(PATRICIA_BITS);
+
+	count_ip_limits(cl, &unknown_list);
+	count_ip_limits(cl, &lclient_list);
+}
+
 void
 add_class(struct Class *classptr)
 {
 	struct Class *tmpptr;
+	int rebuild;
 
 	tmpptr = find_class(classptr->class_name);
 
@@ -196,16 +272,45 @@ add_class(struct Class *classptr)
 		MaxGlobal(tmpptr) = MaxGlobal(classptr);
 		MaxIdent(tmpptr) = MaxIdent(classptr);
 		PingFreq(tmpptr) = PingFreq(classptr);
+		IdentBudget(tmpptr) = IdentBudget(classptr);
 		MaxSendq(tmpptr) = MaxSendq(classptr);
 		ConFreq(tmpptr) = ConFreq(classptr);
 		CidrIpv4Bitlen(tmpptr) = CidrIpv4Bitlen(classptr);
 		CidrIpv6Bitlen(tmpptr) = CidrIpv6Bitlen(classptr);
 		CidrAmount(tmpptr) = CidrAmount(classptr);
 
+		/* the counts are keyed by subnet size, so they have to be
+		 * redone if the sizes changed; a new limit alone is fine.
+		 */
+		rebuild = !same_cidr_bitlens(tmpptr, classptr);
+		copy_cidr_limits(tmpptr, classptr);
+		if(rebuild)
+			rebuild_ip_limits(tmpptr);
+
 		free_class(classptr);
 	}
 }
 
+/*
+ * get_cidr_limits
+ *
+ * inputs	- class, address family
+ * output	- subnet limits for that family, number of them in *levels
+ * side effects - NONE
+ */
+struct cidr_limit *
+get_cidr_limits(struct Class *cl, int family, int *levels)
+{
+	if(family == AF_INET6)
+	{
+		*levels = CidrIpv6Levels(cl);
+		return cl->cidr_ipv6_limits;
+	}
+
+	*levels = CidrIpv4Levels(cl);
+	return cl->cidr_ipv4_limits;
+}
+
 
 /*
  * find_class
@@ -53,6 +53,7 @@
 #include "reject.h"
 #include "scache.h"
 #include "sslproc.h"
+#include "intern.h"
 
 #define DEBUG_EXITED_CLIENTS
 
@@ -67,6 +68,8 @@ static int exit_local_client(struct Client *, struct Client *, struct Client *,
 static int exit_unknown_client(struct Client *, struct Client *, struct Client *, const char *);
 static int exit_local_server(struct Client *, struct Client *, struct Client *, const char *);
 static int qs_server(struct Client *, struct Client *, struct Client *, const char *comment);
+static void exit_split_client(struct Client *);
+static void exit_split_clients(void *unused);
 
 static EVH check_pings;
 
@@ -86,6 +89,9 @@ enum
 };
 
 rb_dlink_list dead_list;
+
+/* bumped each time a client becomes a user, see burst_TS6() */
+unsigned long introduce_count;
 #ifdef DEBUG_EXITED_CLIENTS
 static rb_dlink_list dead_remote_list;
 #endif
@@ -99,6 +105,9 @@ struct abort_client
 
 static rb_dlink_list abort_list;
 
+/* users gone in a netsplit, waiting for exit_split_clients() */
+static rb_dlink_list split_list;
+
 
 /*
  * init_client
@@ -123,6 +132,7 @@ init_client(void)
 	rb_event_addish("check_pings", check_pings, NULL, 30);
 	rb_event_addish("free_exited_clients", &free_exited_clients, NULL, 4);
 	rb_event_addish("exit_aborted_clients", exit_aborted_clients, NULL, 1);
+	rb_event_add("exit_split_clients", exit_split_clients, NULL, 1);
 	rb_event_add("flood_recalc", flood_recalc, NULL, 1);
 
 	nd_dict = rb_dictionary_create(irccmp);
@@ -174,6 +184,9 @@ make_client(struct Client *from)
 
 	SetUnknown(client_p);
 	strcpy(client_p->username, "unknown");
+	client_p->host = intern_add("", 0);
+	client_p->orighost = intern_add("", 0);
+	client_p->info = intern_add("", 0);
 
 	return client_p;
 }
@@ -258,6 +271,9 @@ free_client(struct Client *client_p)
 	free_local_client(client_p);
 	free_pre_client(client_p);
 	rb_free(client_p->certfp);
+	intern_del(client_p->host);
+	intern_del(client_p->orighost);
+	intern_del(client_p->info);
 	rb_bh_free(client_heap, client_p);
 }
 
@@ -468,6 +484,96 @@ check_klines_event(void *unused)
 	check_klines();
 }
 
+/* check_kline_client()
+ *
+ * inputs	- local client
+ * outputs	-
+ * side effects - the client is exited if it is K-lined
+ */
+static void
+check_kline_client(struct Client *client_p)
+{
+	struct ConfItem *aconf;
+
+	if(IsMe(client_p) || !IsPerson(client_p))
+		return;
+
+	if((aconf = find_kline(client_p)) == NULL)
+		return;
+
+	if(IsExemptKline(client_p))
+	{
+		sendto_realops_snomask(SNO_GENERAL, L_ALL,
+				       "KLINE over-ruled for %s, client is kline_exempt [%s@%s]",
+				       get_client_name(client_p, HIDE_IP),
+				       aconf->user, aconf->host);
+		return;
+	}
+
+	sendto_realops_snomask(SNO_GENERAL, L_ALL, "KLINE active for %s",
+			       get_client_name(client_p, HIDE_IP));
+
+	notify_banned_client(client_p, aconf, K_LINED);
+}
+
+/* check_dline_client()
+ *
+ * inputs	- local client, registered or not
+ * outputs	-
+ * side effects - the client is exited if it is D-lined
+ */
+static void
+check_dline_client(struct Client *client_p)
+{
+	struct ConfItem *aconf;
+
+	if(IsMe(client_p))
+		return;
+
+	aconf = find_dline((struct sockaddr *) &client_p->localClient->ip,
+			   client_p->localClient->ip.ss_family);
+
+	if(aconf == NULL || aconf->status & CONF_EXEMPTDLINE)
+		return;
+
+	if(IsPerson(client_p))
+		sendto_realops_snomask(SNO_GENERAL, L_ALL, "DLINE active for %s",
+				       get_client_name(client_p, HIDE_IP));
+
+	notify_banned_client(client_p, aconf, D_LINED);
+}
+
+/* check_xline_client()
+ *
+ * inputs	- local client
+ * outputs	-
+ * side effects - the client is exited if it is X-lined
+ */
+static void
+check_xline_client(struct Client *client_p)
+{
+	struct ConfItem *aconf;
+
+	if(IsMe(client_p) || !IsPerson(client_p))
+		return;
+
+	if((aconf = find_xline(client_p->info, 1)) == NULL)
+		return;
+
+	if(IsExemptKline(client_p))
+	{
+		sendto_realops_snomask(SNO_GENERAL, L_ALL,
+				       "XLINE over-ruled for %s, client is kline_exempt [%s]",
+				       get_client_name(client_p, HIDE_IP), aconf->host);
+		return;
+	}
+
+	sendto_realops_snomask(SNO_GENERAL, L_ALL, "XLINE active for %s",
+			       get_client_name(client_p, HIDE_IP));
+
+	(void) exit_client(client_p, client_p, &me, "Bad user info");
+}
+
 /* check_klines
  *
  * inputs       -
@@ -477,35 +583,12 @@ check_klines_event(void *unused)
 void
 check_klines(void)
 {
-	struct Client *client_p;
-	struct ConfItem *aconf;
 	rb_dlink_node *ptr;
 	rb_dlink_node *next_ptr;
 
 	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, lclient_list.head)
 	{
-		client_p = ptr->data;
-
-		if(IsMe(client_p) || !IsPerson(client_p))
-			continue;
-
-		if((aconf = find_kline(client_p)) != NULL)
-		{
-			if(IsExemptKline(client_p))
-			{
-				sendto_realops_snomask(SNO_GENERAL, L_ALL,
-						       "KLINE over-ruled for %s, client is kline_exempt [%s@%s]",
-						       get_client_name(client_p, HIDE_IP),
-						       aconf->user, aconf->host);
-				continue;
-			}
-
-			sendto_realops_snomask(SNO_GENERAL, L_ALL, "KLINE active for %s",
-					       get_client_name(client_p, HIDE_IP));
-
-			notify_banned_client(client_p, aconf, K_LINED);
-			continue;
-		}
+		check_kline_client(ptr->data);
 	}
 }
 
@@ -518,47 +601,18 @@ check_klines(void)
 void
 check_dlines(void)
 {
-	struct Client *client_p;
-	struct ConfItem *aconf;
 	rb_dlink_node *ptr;
 	rb_dlink_node *next_ptr;
 
 	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, lclient_list.head)
 	{
-		client_p = ptr->data;
-
-		if(IsMe(client_p))
-			continue;
-
-		if((aconf =
-		    find_dline((struct sockaddr *) &client_p->localClient->ip,
-			       client_p->localClient->ip.ss_family)) != NULL)
-		{
-			if(aconf->status & CONF_EXEMPTDLINE)
-				continue;
-
-			sendto_realops_snomask(SNO_GENERAL, L_ALL, "DLINE active for %s",
-					       get_client_name(client_p, HIDE_IP));
-
-			notify_banned_client(client_p, aconf, D_LINED);
-			continue;
-		}
+		check_dline_client(ptr->data);
 	}
 
 	/* dlines need to be checked against unknowns too */
 	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, unknown_list.head)
 	{
-		client_p = ptr->data;
-
-		if((aconf =
-		    find_dline((struct sockaddr *) &client_p->localClient->ip,
-			       client_p->localClient->ip.ss_family)) != NULL)
-		{
-			if(aconf->status & CONF_EXEMPTDLINE)
-				continue;
-
-			notify_banned_client(client_p, aconf, D_LINED);
-		}
+		check_dline_client(ptr->data);
 	}
 }
 
@@ -571,36 +625,136 @@ check_dlines(void)
 void
 check_xlines(void)
 {
-	struct Client *client_p;
-	struct ConfItem *aconf;
 	rb_dlink_node *ptr;
 	rb_dlink_node *next_ptr;
 
 	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, lclient_list.head)
 	{
-		client_p = ptr->data;
+		check_xline_client(ptr->data);
+	}
+}
 
-		if(IsMe(client_p) || !IsPerson(client_p))
-			continue;
+/* a new ban, parsed once for matching against every client */
+struct new_ban
+{
+	struct ConfItem *aconf;
+	struct rb_sockaddr_storage addr;
+	int bits;
+	int masktype;
+};
+
+/* new_ban_matches()
+ *
+ * inputs	- parsed ban, local client
+ * outputs	- 1 if the ban's mask covers the client, else 0
+ * side effects -
+ *
+ * This only looks at the mask, the same way find_conf_by_address() does;
+ * exemptions and which ban wins are left to the check_*_client() call
+ * that follows a match.
+ */
+static int
+new_ban_matches(struct new_ban *ban, struct Client *client_p)
+{
+	struct ConfItem *aconf = ban->aconf;
+	struct sockaddr *ip = (struct sockaddr *) &client_p->localClient->ip;
 
-		if((aconf = find_xline(client_p->info, 1)) != NULL)
+	switch (aconf->status)
+	{
+	case CONF_XLINE:
+		return IsPerson(client_p) && match_esc(aconf->host, client_p->info);
+
+	case CONF_KILL:
+		if(!IsPerson(client_p) || !match(aconf->user, client_p->username))
+			return 0;
+
+		if(ban->masktype == HM_HOST)
+			return match(aconf->host, client_p->host) ||
+				match(aconf->host, client_p->sockhost) ||
+				(client_p->orighost != NULL &&
+				 match(aconf->host, client_p->orighost));
+
+		/* fall through, the address part is the same as a D-line's */
+	case CONF_DLINE:
+		if(ban->masktype == HM_IPV6)
+			return ip->sa_family == AF_INET6 &&
+				comp_with_mask_sock(ip, (struct sockaddr *) &ban->addr, ban->bits);
+		if(ban->masktype == HM_IPV4)
+			return ip->sa_family == AF_INET &&
+				comp_with_mask_sock(ip, (struct sockaddr *) &ban->addr, ban->bits);
+		return 0;
+	}
+
+	return 0;
+}
+
+/* check_new_bans()
+ *
+ * inputs	- K-lines, D-lines and X-lines that were just added
+ * outputs	-
+ * side effects - clients covered by one of them are checked as
+ *		  check_klines(), check_dlines() and check_xlines() would,
+ *		  without looking up every other client
+ */
+void
+check_new_bans(rb_dlink_list *bans)
+{
+	struct new_ban *parsed, *ban;
+	struct Client *client_p;
+	rb_dlink_node *ptr, *next_ptr;
+	rb_dlink_list *lists[2] = { &lclient_list, &unknown_list };
+	unsigned long count = rb_dlink_list_length(bans);
+	unsigned int checked;
+	int i;
+
+	if(count == 0)
+		return;
+
+	parsed = rb_malloc(sizeof(struct new_ban) * count);
+	ban = parsed;
+
+	RB_DLINK_FOREACH(ptr, bans->head)
+	{
+		ban->aconf = ptr->data;
+		ban->masktype = HM_HOST;
+
+		if(ban->aconf->status != CONF_XLINE)
+			ban->masktype = parse_netmask(ban->aconf->host,
+						      (struct sockaddr *) &ban->addr, &ban->bits);
+		ban++;
+	}
+
+	/* only D-lines apply to unknowns, new_ban_matches() sorts that out */
+	for(i = 0; i < 2; i++)
+	{
+		RB_DLINK_FOREACH_SAFE(ptr, next_ptr, lists[i]->head)
 		{
-			if(IsExemptKline(client_p))
-			{
-				sendto_realops_snomask(SNO_GENERAL, L_ALL,
-						       "XLINE over-ruled for %s, client is kline_exempt [%s]",
-						       get_client_name(client_p, HIDE_IP),
-						       aconf->host);
+			client_p = ptr->data;
+
+			if(IsMe(client_p))
 				continue;
-			}
 
-			sendto_realops_snomask(SNO_GENERAL, L_ALL, "XLINE active for %s",
-					       get_client_name(client_p, HIDE_IP));
+			checked = 0;
 
-			(void) exit_client(client_p, client_p, &me, "Bad user info");
-			continue;
+			/* each kind of ban is looked up at most once per client */
+			for(ban = parsed; ban < parsed + count && !IsAnyDead(client_p); ban++)
+			{
+				if(checked & ban->aconf->status || !new_ban_matches(ban, client_p))
+					continue;
+
+				checked |= ban->aconf->status;
+
+				if(ban->aconf->status == CONF_DLINE)
+					check_dline_client(client_p);
+				else if(ban->aconf->status == CONF_KILL)
+					check_kline_client(client_p);
+				else
+					check_xline_client(client_p);
+			}
 		}
 	}
+
+	rb_free(parsed);
 }
 
 /*
@@ -681,6 +835,7 @@ remove_client_from_list(struct Client *client_p)
 	if(client_p->node.prev == NULL && client_p->node.next == NULL)
 		return;
 
+	burst_client_removed(client_p);
 	rb_dlinkDelete(&client_p->node, &global_client_list);
 
 	update_client_exit_stats(client_p);
@@ -998,29 +1153,16 @@ recurse_remove_clients(struct Client *source_p, const char *comment)
 	if(source_p->serv == NULL)	/* oooops. uh this is actually a major bug */
 		return;
 
-	/* this is very ugly, but it saves cpu :P */
-	if(ConfigFileEntry.nick_delay > 0)
+	RB_DLINK_FOREACH_SAFE(ptr, ptr_next, source_p->serv->users.head)
 	{
-		RB_DLINK_FOREACH_SAFE(ptr, ptr_next, source_p->serv->users.head)
-		{
-			target_p = ptr->data;
-			target_p->flags |= FLAGS_KILLED;
-			add_nd_entry(target_p->name);
+		target_p = ptr->data;
+		target_p->flags |= FLAGS_KILLED;
 
-			if(!IsDead(target_p) && !IsClosing(target_p))
-				exit_remote_client(NULL, target_p, &me, comment);
-		}
-	}
-	else
-	{
-		RB_DLINK_FOREACH_SAFE(ptr, ptr_next, source_p->serv->users.head)
-		{
-			target_p = ptr->data;
-			target_p->flags |= FLAGS_KILLED;
+		if(ConfigFileEntry.nick_delay > 0)
+			add_nd_entry(target_p->name);
 
-			if(!IsDead(target_p) && !IsClosing(target_p))
-				exit_remote_client(NULL, target_p, &me, comment);
-		}
+		if(!IsDead(target_p) && !IsClosing(target_p))
+			exit_split_client(target_p);
 	}
 
 	RB_DLINK_FOREACH_SAFE(ptr, ptr_next, source_p->serv->servers.head)
@@ -1042,6 +1184,10 @@ remove_dependents(struct Client *client_p, struct Client *source_p, struct Clien
 {
 	struct Client *to;
 	rb_dlink_node *ptr, *next;
+	struct timeval start, end;
+	unsigned int users;
+	int channels;
+	long msec;
 
 	RB_DLINK_FOREACH_SAFE(ptr, next, serv_list.head)
 	{
@@ -1053,7 +1199,26 @@ remove_dependents(struct Client *client_p, struct Client *source_p, struct Clien
 		recurse_send_quits(client_p, source_p, to, comment1, comment);
 	}
 
+	gettimeofday(&start, NULL);
+	users = rb_dlink_list_length(&split_list);
+
 	recurse_remove_clients(source_p, comment1);
+	users = rb_dlink_list_length(&split_list) - users;
+
+	channels = split_remove_users(comment1);
+
+	if(ConfigFileEntry.netsplit_slice <= 0)
+		exit_split_clients(NULL);
+
+	gettimeofday(&end, NULL);
+
+	if(users == 0)
+		return;
+
+	msec = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_usec - start.tv_usec) / 1000;
+	sendto_realops_snomask(SNO_EXTERNAL, L_ALL,
+			       "Netsplit of %s: %u users left %d channels in %ld.%03ld seconds",
+			       source_p->name, users, channels, msec / 1000, msec % 1000);
 }
 
 void
@@ -1201,6 +1366,71 @@ exit_remote_client(struct Client *client_p, struct Client *source_p, struct Clie
 	return (CLIENT_EXITED);
 }
 
+/*
+ * Netsplit counterpart of exit_remote_client().  The user is taken off
+ * every lookup immediately, the channel side is left to
+ * split_remove_users(), and the remaining cleanup is done by
+ * exit_split_clients(), netsplit_slice users at a time if set.
+ */
+static void
+exit_split_client(struct Client *source_p)
+{
+	if(IsOper(source_p))
+		rb_dlinkFindDestroy(source_p, &oper_list);
+
+	split_add_user(source_p);
+
+	add_history(source_p, 0);
+	off_history(source_p);
+
+	monitor_signoff(source_p);
+
+	if(has_id(source_p))
+		del_from_id_hash(source_p->id, source_p);
+
+	del_from_hostname_hash(source_p->orighost, source_p);
+	del_from_client_hash(source_p->name, source_p);
+	remove_client_from_list(source_p);
+
+	if(source_p->servptr && source_p->servptr->serv)
+		rb_dlinkDelete(&source_p->lnode, &source_p->servptr->serv->users);
+
+	SetDead(source_p);
+	rb_dlinkAddTailAlloc(source_p, &split_list);
+}
+
+static void
+exit_split_clients(void *unused)
+{
+	struct Client *target_p;
+	rb_dlink_node *ptr, *next_ptr;
+	rb_dlink_node *iptr, *next_iptr;
+	int count = 0;
+
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, split_list.head)
+	{
+		if(ConfigFileEntry.netsplit_slice > 0 && count++ >= ConfigFileEntry.netsplit_slice)
+			break;
+
+		target_p = ptr->data;
+
+		user_metadata_clear(target_p);
+
+		RB_DLINK_FOREACH_SAFE(iptr, next_iptr, target_p->user->invited.head)
+		{
+			del_invite(iptr->data, target_p);
+		}
+
+		del_all_accepts(target_p);
+
+#ifdef DEBUG_EXITED_CLIENTS
+		rb_dlinkMoveNode(ptr, &split_list, &dead_remote_list);
+#else
+		rb_dlinkMoveNode(ptr, &split_list, &dead_list);
+#endif
+	}
+}
+
 /*
  * This assumes IsUnknown(source_p) == TRUE and MyConnect(source_p) == TRUE
  */
@@ -1324,6 +1554,7 @@ exit_local_server(struct Client *client_p, struct Client *source_p, struct Clien
 	rb_dlinkDelete(&source_p->localClient->tnode, &serv_list);
 	rb_dlinkFindDestroy(source_p, &global_serv_list);
 
+	burst_cancel(source_p);
 	unset_chcap_usage_counts(source_p);
 	sendk = source_p->localClient->sendK;
 	recvk = source_p->localClient->receiveK;
@@ -1702,6 +1933,8 @@ free_user(struct User *user, struct Client *client_p)
 		if(user->away)
 			rb_free((char *) user->away);
 
+		burst_record_free(user);
+
 		/*
 		 * sanity check
 		 */
@@ -1859,6 +2092,7 @@ close_connection(struct Client *client_p)
 
 	rb_linebuf_donebuf(&client_p->localClient->buf_sendq);
 	rb_linebuf_donebuf(&client_p->localClient->buf_recvq);
+	rb_linebuf_donebuf(&client_p->localClient->buf_sendq_control);
 	detach_conf(client_p);
 
 	/* XXX shouldnt really be done here. */
@@ -1939,6 +2173,7 @@ user_metadata_add(struct Client *target, const char *name, const char *value, in
 	md->value = rb_strdup(value);
 
 	rb_dictionary_add(target->user->metadata, md->name, md);
+	burst_record_clear(target);
 
 	if(propagate)
 		sendto_match_servs(&me, "*", CAP_ENCAP, NOCAPS, "ENCAP * METADATA ADD %s %s :%s",
@@ -1965,6 +2200,7 @@ user_metadata_delete(struct Client *target, const char *name, int propagate)
 		return;
 
 	rb_dictionary_delete(target->user->metadata, md->name);
+	burst_record_clear(target);
 
 	rb_free(md);
 
@@ -39,6 +39,7 @@
 #include "cache.h"
 #include "s_newconf.h"
 #include "hook.h"
+#include "s_serv.h"
 
 #define hash_cli_fd(x)	(x % CLI_FD_MAX)
 
@@ -46,10 +47,25 @@ static rb_dlink_list clientbyfdTable[U_MAX];
 
 rb_dlink_list *clientTable;
 rb_dlink_list *channelTable;
-rb_dlink_list *idTable;
 rb_dlink_list *resvTable;
 rb_dlink_list *hostTable;
 
+/*
+ * TS6 IDs are 3 (SID) or 9 (UID) characters of [0-9A-Za-z], so an ID
+ * packs into an integer at six bits a character.  The ID table is open
+ * addressed on that value, a lookup is a multiply and normally a single
+ * compare instead of hashing the string and walking a chain.
+ */
+struct id_slot
+{
+	uint64_t key;			/* 0 when the slot is free */
+	struct Client *client_p;
+};
+
+static struct id_slot *idTable;
+static unsigned int id_bits = U_MAX_BITS;	/* 1 << id_bits slots */
+static unsigned int id_count;
+
 /*
  * look in whowas.c for the missing ...[WW_MAX]; entry
  */
@@ -95,7 +111,7 @@ void
 init_hash(void)
 {
 	clientTable = rb_malloc(sizeof(rb_dlink_list) * U_MAX);
-	idTable = rb_malloc(sizeof(rb_dlink_list) * U_MAX);
+	idTable = rb_malloc(sizeof(struct id_slot) * U_MAX);
 	channelTable = rb_malloc(sizeof(rb_dlink_list) * CH_MAX);
 	hostTable = rb_malloc(sizeof(rb_dlink_list) * HOST_MAX);
 	resvTable = rb_malloc(sizeof(rb_dlink_list) * R_MAX);
@@ -173,14 +189,47 @@ hash_nick(const char *name)
 	return fnv_hash_upper((const unsigned char *) name, U_MAX_BITS);
 }
 
+/* pack_id()
+ *
+ * packs an id into an integer, 0 if it cannot be an id
+ */
+static uint64_t
+pack_id(const char *id)
+{
+	uint64_t key = 0;
+	unsigned int c;
+	int i;
+
+	for(i = 0; id[i] != '\0'; i++)
+	{
+		c = (unsigned char) id[i];
+
+		if(i >= IDLEN - 1)
+			return 0;
+
+		if(c >= '0' && c <= '9')
+			c = c - '0' + 1;
+		else if(c >= 'A' && c <= 'Z')
+			c = c - 'A' + 11;
+		else if(c >= 'a' && c <= 'z')
+			c = c - 'a' + 37;
+		else
+			return 0;
+
+		key = (key << 6) | c;
+	}
+
+	return key;
+}
+
 /* hash_id()
  *
- * hashes an id, case is kept
+ * home slot of a packed id
  */
-static uint32_t
-hash_id(const char *name)
+static inline unsigned int
+hash_id(uint64_t key)
 {
-	return fnv_hash((const unsigned char *) name, U_MAX_BITS);
+	return (unsigned int) ((key * UINT64_C(0x9E3779B97F4A7C15)) >> (64 - id_bits));
 }
 
 /* hash_channel()
@@ -218,16 +267,81 @@ hash_resv(const char *name)
  *
  * adds an entry to the id hash table
  */
+static void
+id_insert(uint64_t key, struct Client *client_p)
+{
+	unsigned int mask = (1U << id_bits) - 1;
+	unsigned int i;
+
+	for(i = hash_id(key); idTable[i].key != 0; i = (i + 1) & mask)
+		;
+
+	idTable[i].key = key;
+	idTable[i].client_p = client_p;
+}
+
+/* id_resize()
+ *
+ * moves the id table to 1 << bits slots
+ */
+static void
+id_resize(unsigned int bits)
+{
+	struct id_slot *old = idTable;
+	unsigned int oldsize = 1U << id_bits;
+	unsigned int i;
+
+	id_bits = bits;
+	idTable = rb_malloc(sizeof(struct id_slot) << id_bits);
+
+	for(i = 0; i < oldsize; i++)
+	{
+		if(old[i].key != 0)
+			id_insert(old[i].key, old[i].client_p);
+	}
+
+	rb_free(old);
+}
+
+/* reserve_id_hash()
+ *
+ * grows the id table once so that count more ids fit, rather than
+ * doubling it while a burst is being taken
+ */
+void
+reserve_id_hash(unsigned long count)
+{
+	unsigned int bits = id_bits;
+
+	if(count > ID_RESERVE_MAX)
+		count = ID_RESERVE_MAX;
+
+	while((id_count + count) * 2 > (1U << bits))
+		bits++;
+
+	if(bits != id_bits)
+		id_resize(bits);
+}
+
 void
 add_to_id_hash(const char *name, struct Client *client_p)
 {
-	unsigned int hashv;
+	uint64_t key;
 
 	if(EmptyString(name) || (client_p == NULL))
 		return;
 
-	hashv = hash_id(name);
-	rb_dlinkAddAlloc(client_p, &idTable[hashv]);
+	key = pack_id(name);
+	s_assert(key != 0);
+	if(key == 0)
+		return;
+
+	/* keep the table at most half full */
+	if((id_count + 1) * 2 > (1U << id_bits))
+		id_resize(id_bits + 1);
+
+	id_insert(key, client_p);
+	id_count++;
 }
 
 /* add_to_client_hash()
@@ -291,15 +405,44 @@ add_to_resv_hash(const char *name, struct ConfItem *aconf)
 void
 del_from_id_hash(const char *id, struct Client *client_p)
 {
-	unsigned int hashv;
+	unsigned int mask = (1U << id_bits) - 1;
+	unsigned int i, j, home;
+	uint64_t key;
 
 	s_assert(id != NULL);
 	s_assert(client_p != NULL);
 	if(EmptyString(id) || client_p == NULL)
 		return;
 
-	hashv = hash_id(id);
-	rb_dlinkFindDestroy(client_p, &idTable[hashv]);
+	if((key = pack_id(id)) == 0)
+		return;
+
+	for(i = hash_id(key); ; i = (i + 1) & mask)
+	{
+		if(idTable[i].key == 0)
+			return;
+
+		if(idTable[i].key == key && idTable[i].client_p == client_p)
+			break;
+	}
+
+	/* pull back later entries of the run that would be cut off from
+	 * their home slot by the hole
+	 */
+	for(j = (i + 1) & mask; idTable[j].key != 0; j = (j + 1) & mask)
+	{
+		home = hash_id(idTable[j].key);
+
+		if(((j - home) & mask) >= ((j - i) & mask))
+		{
+			idTable[i] = idTable[j];
+			i = j;
+		}
+	}
+
+	idTable[i].key = 0;
+	idTable[i].client_p = NULL;
+	id_count--;
 }
 
 /* del_from_client_hash()
@@ -319,6 +462,10 @@ del_from_client_hash(const char *name, struct Client *client_p)
 
 	hashv = hash_nick(name);
 	rb_dlinkFindDestroy(client_p, &clientTable[hashv]);
+
+	/* a burst may not have got to the next user of this nick yet */
+	if(IsPerson(client_p) && rb_dlink_list_length(&burst_list) != 0)
+		burst_nick_freed(name);
 }
 
 /* del_from_channel_hash()
@@ -383,21 +530,17 @@ del_from_resv_hash(const char *name, struct ConfItem *aconf)
 struct Client *
 find_id(const char *name)
 {
-	struct Client *target_p;
-	rb_dlink_node *ptr;
-	unsigned int hashv;
+	unsigned int mask = (1U << id_bits) - 1;
+	unsigned int i;
+	uint64_t key;
 
-	if(EmptyString(name))
+	if(EmptyString(name) || (key = pack_id(name)) == 0)
 		return NULL;
 
-	hashv = hash_id(name);
-
-	RB_DLINK_FOREACH(ptr, idTable[hashv].head)
+	for(i = hash_id(key); idTable[i].key != 0; i = (i + 1) & mask)
 	{
-		target_p = ptr->data;
-
-		if(strcmp(name, target_p->id) == 0)
-			return target_p;
+		if(idTable[i].key == key)
+			return idTable[i].client_p;
 	}
 
 	return NULL;
@@ -763,6 +906,45 @@ count_hash(struct Client *source_p, rb_dlink_list * table, int length, const cha
 	output_hash(source_p, name, length, counts, deepest);
 }
 
+/* count_id_hash()
+ *
+ * the id table has no chains, so what is counted is how far each
+ * entry sits from its home slot
+ */
+static void
+count_id_hash(struct Client *source_p)
+{
+	unsigned int size = 1U << id_bits;
+	unsigned int mask = size - 1;
+	unsigned int i, dist;
+	int counts[11];
+	int deepest = 0;
+
+	memset(counts, 0, sizeof(counts));
+
+	for(i = 0; i < size; i++)
+	{
+		if(idTable[i].key == 0)
+			continue;
+
+		dist = (i - hash_id(idTable[i].key)) & mask;
+		counts[dist < 10 ? dist : 10]++;
+
+		if((int) dist > deepest)
+			deepest = dist;
+	}
+
+	sendto_one_numeric(source_p, RPL_STATSDEBUG, "B :ID Hash Statistics");
+	sendto_one_numeric(source_p, RPL_STATSDEBUG, "B :Size: %u Used: %u Furthest: %d",
+			   size, id_count, deepest);
+
+	for(i = 0; i < 11; i++)
+	{
+		sendto_one_numeric(source_p, RPL_STATSDEBUG, "B :Entries %u%s slots from home: %d",
+				   i, i == 10 ? "+" : "", counts[i]);
+	}
+}
+
 void
 hash_stats(struct Client *source_p)
 {
@@ -770,7 +952,7 @@ hash_stats(struct Client *source_p)
 	sendto_one_numeric(source_p, RPL_STATSDEBUG, "B :--");
 	count_hash(source_p, clientTable, U_MAX, "Client");
 	sendto_one_numeric(source_p, RPL_STATSDEBUG, "B :--");
-	count_hash(source_p, idTable, U_MAX, "ID");
+	count_id_hash(source_p);
 	sendto_one_numeric(source_p, RPL_STATSDEBUG, "B :--");
 	count_hash(source_p, hostTable, HOST_MAX, "Hostname");
 }
@@ -629,6 +629,32 @@ clear_out_address_conf(void)
 	}
 }
 
+/* void foreach_address_conf_ban(void (*)(struct ConfItem *, void *), void *)
+ * Input: callback and its argument
+ * Output: None
+ * Side effects: Calls the callback for every permanent K-line and D-line,
+ *               the entries clear_out_address_conf_bans() would remove.
+ *               The callback must not change the hash table.
+ */
+void
+foreach_address_conf_ban(void (*func)(struct ConfItem *, void *), void *data)
+{
+	struct AddressRec *arec;
+	int i;
+
+	for(i = 0; i < ATABLE_SIZE; i++)
+	{
+		for(arec = atable[i]; arec; arec = arec->next)
+		{
+			if(arec->aconf->flags & CONF_FLAGS_TEMPORARY ||
+			   (arec->type == CONF_CLIENT || arec->type == CONF_EXEMPTDLINE))
+				continue;
+
+			func(arec->aconf, data);
+		}
+	}
+}
+
 void
 clear_out_address_conf_bans(void)
 {
@@ -0,0 +1,159 @@
+/*
+ * SporksIRCD: the ircd for discerning transsexual quilting bees.
+ * intern.c: shared, reference counted strings
+ *
+ * Copyright (C) 2011 SporksIRCD development team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *  USA
+ */
+
+#include "stdinc.h"
+#include "hash.h"
+#include "intern.h"
+
+/*
+ * Hostnames and realnames repeat a lot across a network: cloaks, web
+ * gateways and bouncers put the same few strings on thousands of users.
+ * Clients point into this pool instead of carrying their own copies.
+ * The string is stored right after its entry header, so intern_del()
+ * can get back to the entry from the pointer it was given.
+ */
+
+#define INTERN_MAX_BITS	16
+#define INTERN_MAX	(1 << INTERN_MAX_BITS)
+
+struct intern_entry
+{
+	struct intern_entry *next;
+	unsigned int refcount;
+	unsigned int len;
+	char str[1];
+};
+
+#define INTERN_ENTRY(s)	((struct intern_entry *) ((s) - offsetof(struct intern_entry, str)))
+
+static struct intern_entry **intern_table;
+
+static size_t intern_count;	/* distinct strings */
+static size_t intern_bytes;	/* bytes of distinct strings */
+static size_t intern_refbytes;	/* bytes the references would take as copies */
+
+void
+init_intern(void)
+{
+	intern_table = rb_malloc(sizeof(struct intern_entry *) * INTERN_MAX);
+}
+
+/*
+ * intern_add - take a reference to the interned copy of str
+ * at most maxlen characters of str are used, as rb_strlcpy() into a
+ * maxlen + 1 sized buffer would.
+ */
+const char *
+intern_add(const char *str, size_t maxlen)
+{
+	struct intern_entry *entry;
+	unsigned int hashv;
+	size_t len;
+
+	if(str == NULL)
+		str = "";
+
+	for(len = 0; len < maxlen && str[len] != '\0'; len++)
+		;
+
+	hashv = fnv_hash_len((const unsigned char *) str, INTERN_MAX_BITS, len);
+
+	for(entry = intern_table[hashv]; entry != NULL; entry = entry->next)
+	{
+		if(entry->len == len && !memcmp(entry->str, str, len))
+		{
+			entry->refcount++;
+			intern_refbytes += len + 1;
+			return entry->str;
+		}
+	}
+
+	entry = rb_malloc(sizeof(struct intern_entry) + len);
+	memcpy(entry->str, str, len);
+	entry->str[len] = '\0';
+	entry->len = len;
+	entry->refcount = 1;
+
+	entry->next = intern_table[hashv];
+	intern_table[hashv] = entry;
+
+	intern_count++;
+	intern_bytes += len + 1;
+	intern_refbytes += len + 1;
+	return entry->str;
+}
+
+/*
+ * intern_del - drop a reference taken by intern_add()
+ */
+void
+intern_del(const char *str)
+{
+	struct intern_entry *entry, **prev;
+	unsigned int hashv;
+
+	if(str == NULL)
+		return;
+
+	entry = INTERN_ENTRY(str);
+	intern_refbytes -= entry->len + 1;
+
+	if(--entry->refcount > 0)
+		return;
+
+	hashv = fnv_hash_len((const unsigned char *) entry->str, INTERN_MAX_BITS, entry->len);
+
+	for(prev = &intern_table[hashv]; *prev != NULL; prev = &(*prev)->next)
+	{
+		if(*prev == entry)
+		{
+			*prev = entry->next;
+			break;
+		}
+	}
+
+	intern_count--;
+	intern_bytes -= entry->len + 1;
+	rb_free(entry);
+}
+
+/*
+ * intern_set - point *field at str, releasing what it pointed at before
+ */
+void
+intern_set(const char **field, const char *str, size_t maxlen)
+{
+	const char *old = *field;
+
+	/* take the new reference first, str may be *field itself */
+	*field = intern_add(str, maxlen);
+	intern_del(old);
+}
+
+void
+count_intern_memory(size_t *count, size_t *memory, size_t *saved)
+{
+	*count = intern_count;
+	*memory = intern_bytes + intern_count * offsetof(struct intern_entry, str) +
+		sizeof(struct intern_entry *) * INTERN_MAX;
+	*saved = intern_refbytes - intern_bytes;
+}
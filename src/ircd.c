@@ -69,6 +69,8 @@
 #include "chmode.h"
 #include "privilege.h"
 #include "bandbi.h"
+#include "arena.h"
+#include "intern.h"
 
 /* /quote set variables */
 struct SetOptions GlobalSetOptions;
@@ -672,6 +674,11 @@ ircd_main(int argc, char *argv[])
 	clear_scache_hash_table();	/* server cache name table */
 	init_host_hash();
 	clear_hash_parse();
+	init_arena();
+	init_intern();
+	intern_set(&me.host, "", 0);
+	intern_set(&me.orighost, "", 0);
+	intern_set(&me.info, "", 0);
 	init_client();
 	init_hook();
 	init_list_modes();
@@ -733,7 +740,7 @@ ircd_main(int argc, char *argv[])
 		ierror("no server description specified in serverinfo block.");
 		return -3;
 	}
-	rb_strlcpy(me.info, ServerInfo.description, sizeof(me.info));
+	intern_set(&me.info, ServerInfo.description, REALLEN);
 
 	if(ServerInfo.ssl_cert != NULL && ServerInfo.ssl_private_key != NULL)
 	{
@@ -41,6 +41,7 @@
 #include "hostmask.h"
 #include "sslproc.h"
 #include "hash.h"
+#include "intern.h"
 
 #ifndef INADDR_NONE
 #define INADDR_NONE ((unsigned int) 0xffffffff)
@@ -449,7 +450,7 @@ add_connection(struct Listener *listener, rb_fde_t * F, struct sockaddr *sai, st
 			  sizeof(new_client->sockhost));
 
 
-	rb_strlcpy(new_client->host, new_client->sockhost, sizeof(new_client->host));
+	intern_set(&new_client->host, new_client->sockhost, HOSTLEN);
 
 	new_client->localClient->F = F;
 	add_to_cli_fd_hash(new_client);
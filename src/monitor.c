@@ -35,6 +35,7 @@
 #include "monitor.h"
 #include "hash.h"
 #include "numeric.h"
+#include "send.h"
 
 struct monitor *monitorTable[MONITOR_HASH_SIZE];
 static rb_bh *monitor_heap;
@@ -95,7 +96,13 @@ void
 monitor_signon(struct Client *client_p)
 {
 	char buf[USERHOST_REPLYLEN];
-	struct monitor *monptr = find_monitor(client_p->name, 0);
+	struct monitor *monptr;
+
+	/* still in a burst, see monitor_signon_burst() */
+	if(MonitorDeferred(client_p))
+		return;
+
+	monptr = find_monitor(client_p->name, 0);
 
 	/* noones watching this nick */
 	if(monptr == NULL)
@@ -117,7 +124,13 @@ monitor_signon(struct Client *client_p)
 void
 monitor_signoff(struct Client *client_p)
 {
-	struct monitor *monptr = find_monitor(client_p->name, 0);
+	struct monitor *monptr;
+
+	/* never signed on */
+	if(MonitorDeferred(client_p))
+		return;
+
+	monptr = find_monitor(client_p->name, 0);
 
 	/* noones watching this nick */
 	if(monptr == NULL)
@@ -126,6 +139,66 @@ monitor_signoff(struct Client *client_p)
 	sendto_monitor(monptr, form_str(RPL_MONOFFLINE), me.name, "*", client_p->name);
 }
 
+/* monitor_signon_burst()
+ *
+ * inputs	- server that has just finished its burst
+ * outputs	-
+ * side effects	- local clients are told which of the nicks they monitor
+ *		  came online in the burst, in as few lines as fit
+ *
+ * Users introduced over a link that has not finished bursting are left
+ * out by monitor_signon() and monitor_signoff(), so a netjoin is one
+ * pass over the local monitor lists here rather than a lookup for each
+ * user, and nicks changed or given up during the burst are not seen.
+ */
+void
+monitor_signon_burst(struct Client *server_p)
+{
+	char buf[BUFSIZE];
+	struct Client *client_p, *target_p;
+	struct monitor *monptr;
+	rb_dlink_node *ptr, *mptr;
+	char *t;
+	int mlen, cur_len, arglen;
+
+	RB_DLINK_FOREACH(ptr, lclient_list.head)
+	{
+		client_p = ptr->data;
+
+		if(rb_dlink_list_length(&client_p->localClient->monitor_list) == 0)
+			continue;
+
+		cur_len = mlen = rb_sprintf(buf, form_str(RPL_MONONLINE),
+					    me.name, client_p->name, "");
+		t = buf + mlen;
+
+		RB_DLINK_FOREACH(mptr, client_p->localClient->monitor_list.head)
+		{
+			monptr = mptr->data;
+
+			if((target_p = find_named_client(monptr->name)) == NULL ||
+			   !IsPerson(target_p) || target_p->from != server_p)
+				continue;
+
+			if(cur_len + NICKLEN + USERLEN + HOSTLEN + 3 >= BUFSIZE - 3)
+			{
+				sendto_one(client_p, "%s", buf);
+				cur_len = mlen;
+				t = buf + mlen;
+			}
+
+			arglen = rb_sprintf(t, "%s%s!%s@%s", cur_len != mlen ? "," : "",
+					    target_p->name, target_p->username,
+					    target_p->host);
+			cur_len += arglen;
+			t += arglen;
+		}
+
+		if(cur_len != mlen)
+			sendto_one(client_p, "%s", buf);
+	}
+}
+
 void
 clear_monitor(struct Client *client_p)
 {
@@ -817,6 +817,34 @@ conf_begin_class(struct TopConf *tc)
 	return 0;
 }
 
+static void
+add_class_cidr_limit(struct cidr_limit *limits, int *levels, const char *name,
+		     int bitlen, int amount)
+{
+	int i;
+
+	/* a later setting for the same subnet size replaces the earlier */
+	for(i = 0; i < *levels; i++)
+	{
+		if(limits[i].bitlen == bitlen)
+		{
+			limits[i].amount = amount;
+			return;
+		}
+	}
+
+	if(*levels >= CIDR_LEVELS)
+	{
+		conf_report_error("class::%s -- too many subnet sizes (max %d), ignoring /%d.",
+				  name, CIDR_LEVELS, bitlen);
+		return;
+	}
+
+	limits[*levels].bitlen = bitlen;
+	limits[*levels].amount = amount;
+	(*levels)++;
+}
+
 static int
 conf_end_class(struct TopConf *tc)
 {
@@ -829,6 +857,19 @@ conf_end_class(struct TopConf *tc)
 		return 0;
 	}
 
+	/* the old single subnet limit is just another level */
+	if(yy_class->cidr_amount > 0)
+	{
+		if(yy_class->cidr_ipv4_bitlen > 0)
+			add_class_cidr_limit(yy_class->cidr_ipv4_limits, &yy_class->cidr_ipv4_levels,
+					     "cidr_ipv4_bitlen", yy_class->cidr_ipv4_bitlen,
+					     yy_class->cidr_amount);
+		if(yy_class->cidr_ipv6_bitlen > 0)
+			add_class_cidr_limit(yy_class->cidr_ipv6_limits, &yy_class->cidr_ipv6_levels,
+					     "cidr_ipv6_bitlen", yy_class->cidr_ipv6_bitlen,
+					     yy_class->cidr_amount);
+	}
+
 	add_class(yy_class);
 	yy_class = NULL;
 	return 0;
@@ -864,6 +905,42 @@ conf_set_class_cidr_ipv6_bitlen(void *data)
 
 }
 
+static void
+conf_set_class_cidr_limits(conf_parm_t *args, const char *name, unsigned int maxsize,
+			   struct cidr_limit *limits, int *levels)
+{
+	unsigned int bitlen;
+	int amount;
+
+	for(; args; args = args->next)
+	{
+		if(CF_TYPE(args->type) != CF_QSTRING ||
+		   sscanf(args->v.string, "%u:%d", &bitlen, &amount) != 2 ||
+		   bitlen == 0 || bitlen > maxsize || amount <= 0)
+		{
+			conf_report_error("class::%s -- invalid limit %s, expected \"bitlen:number\" - ignoring.",
+					  name, CF_TYPE(args->type) == CF_QSTRING ? args->v.string : "");
+			continue;
+		}
+
+		add_class_cidr_limit(limits, levels, name, bitlen, amount);
+	}
+}
+
+static void
+conf_set_class_cidr_ipv4_limits(void *data)
+{
+	conf_set_class_cidr_limits(data, "cidr_ipv4_limits", 32,
+				   yy_class->cidr_ipv4_limits, &yy_class->cidr_ipv4_levels);
+}
+
+static void
+conf_set_class_cidr_ipv6_limits(void *data)
+{
+	conf_set_class_cidr_limits(data, "cidr_ipv6_limits", 128,
+				   yy_class->cidr_ipv6_limits, &yy_class->cidr_ipv6_levels);
+}
+
 static void
 conf_set_class_number_per_cidr(void *data)
 {
@@ -889,6 +966,12 @@ conf_set_class_number_per_ident(void *data)
 	yy_class->max_ident = *(unsigned int *) data;
 }
 
+static void
+conf_set_class_ident_budget(void *data)
+{
+	yy_class->ident_budget = *(unsigned int *) data;
+}
+
 static void
 conf_set_class_connectfreq(void *data)
 {
@@ -2260,9 +2343,12 @@ static struct ConfEntry conf_class_table[] =
 	{ "cidr_ipv4_bitlen",	CF_INT,  conf_set_class_cidr_ipv4_bitlen,		0, NULL },
 	{ "cidr_ipv6_bitlen",	CF_INT,  conf_set_class_cidr_ipv6_bitlen,		0, NULL },
 	{ "number_per_cidr",	CF_INT,  conf_set_class_number_per_cidr,	0, NULL },
+	{ "cidr_ipv4_limits",	CF_QSTRING | CF_FLIST, conf_set_class_cidr_ipv4_limits, 0, NULL },
+	{ "cidr_ipv6_limits",	CF_QSTRING | CF_FLIST, conf_set_class_cidr_ipv6_limits, 0, NULL },
 	{ "number_per_ip",	CF_INT,  conf_set_class_number_per_ip,		0, NULL },
 	{ "number_per_ip_global", CF_INT,conf_set_class_number_per_ip_global,	0, NULL },
 	{ "number_per_ident", 	CF_INT,  conf_set_class_number_per_ident,	0, NULL },
+	{ "ident_budget",	CF_TIME, conf_set_class_ident_budget,		0, NULL },
 	{ "connectfreq", 	CF_TIME, conf_set_class_connectfreq,		0, NULL },
 	{ "max_number", 	CF_INT,  conf_set_class_max_number,		0, NULL },
 	{ "sendq", 		CF_TIME, conf_set_class_sendq,			0, NULL },
@@ -2333,6 +2419,8 @@ static struct ConfEntry conf_general_table[] =
 
 	{ "anti_nick_flood",	CF_YESNO, NULL, 0, &ConfigFileEntry.anti_nick_flood	},
 	{ "burst_away",		CF_YESNO, NULL, 0, &ConfigFileEntry.burst_away		},
+	{ "burst_cache",	CF_YESNO, NULL, 0, &ConfigFileEntry.burst_cache		},
+	{ "burst_cache_verify",	CF_YESNO, NULL, 0, &ConfigFileEntry.burst_cache_verify	},
 	{ "caller_id_wait",	CF_TIME,  NULL, 0, &ConfigFileEntry.caller_id_wait	},
 	{ "client_exit",	CF_YESNO, NULL, 0, &ConfigFileEntry.client_exit		},
 	{ "collision_fnc",	CF_YESNO, NULL, 0, &ConfigFileEntry.collision_fnc	},
@@ -2354,6 +2442,7 @@ static struct ConfEntry conf_general_table[] =
 	{ "max_targets",	CF_INT,   NULL, 0, &ConfigFileEntry.max_targets		},
 	{ "min_nonwildcard",	CF_INT,   NULL, 0, &ConfigFileEntry.min_nonwildcard	},
 	{ "nick_delay",		CF_TIME,  NULL, 0, &ConfigFileEntry.nick_delay		},
+	{ "netsplit_slice",	CF_INT,   NULL, 0, &ConfigFileEntry.netsplit_slice	},
 	{ "no_oper_flood",	CF_YESNO, NULL, 0, &ConfigFileEntry.no_oper_flood	},
 	{ "true_no_oper_flood", CF_YESNO, NULL, 0, &ConfigFileEntry.true_no_oper_flood  },
 	{ "operspy_admin_only",	CF_YESNO, NULL, 0, &ConfigFileEntry.operspy_admin_only	},
@@ -2367,6 +2456,7 @@ static struct ConfEntry conf_general_table[] =
 	{ "reject_duration",	CF_TIME,  NULL, 0, &ConfigFileEntry.reject_duration	},
 	{ "throttle_count",	CF_INT,   NULL, 0, &ConfigFileEntry.throttle_count	},
 	{ "throttle_duration",	CF_TIME,  NULL, 0, &ConfigFileEntry.throttle_duration	},
+	{ "throttle_sketch",	CF_YESNO, NULL, 0, &ConfigFileEntry.throttle_sketch	},
 	{ "short_motd",		CF_YESNO, NULL, 0, &ConfigFileEntry.short_motd		},
 	{ "stats_c_oper_only",	CF_YESNO, NULL, 0, &ConfigFileEntry.stats_c_oper_only	},
 	{ "stats_e_disabled",	CF_YESNO, NULL, 0, &ConfigFileEntry.stats_e_disabled	},
@@ -40,10 +40,41 @@
 #include "s_conf.h"
 #include "s_serv.h"
 #include "packet.h"
+#include "arena.h"
 
 static struct rb_dictionary *cmd_dict = NULL;
 struct rb_dictionary *alias_dict = NULL;
 
+/*
+ * cmd_dict is the authoritative command list; lookups go through a
+ * perfect hash rebuilt from it whenever a command is added or removed.
+ * Each command's name hashes to a bucket, and each bucket stores the
+ * displacement that sends all of its names to distinct table slots, so
+ * a lookup is one hash, one probe and one compare.
+ */
+#define CMD_HASH_MAXDISP	4096
+
+static struct Message **cmd_hash_table = NULL;
+static uint16_t *cmd_hash_disp = NULL;
+static unsigned int cmd_hash_mask;
+static unsigned int cmd_hash_bucket_mask;
+
+/* hot server-to-server tokens, checked before the hash for servers */
+static struct
+{
+	const char *cmd;
+	size_t len;
+	struct Message *msg;
+} server_fast_cmds[] = {
+	{ "PRIVMSG",	7,	NULL },
+	{ "NOTICE",	6,	NULL },
+	{ "UID",	3,	NULL },
+	{ "SJOIN",	5,	NULL },
+	{ "TMODE",	5,	NULL },
+	{ "PING",	4,	NULL },
+	{ NULL,		0,	NULL }
+};
+
 /* parv[0] is not used, and parv[LAST] == NULL */
 static char *para[MAXPARA + 2];
 
@@ -55,6 +86,10 @@ static void do_alias(struct alias_entry *, struct Client *, char *);
 
 static int handle_command(struct Message *, struct Client *, struct Client *, int, const char **);
 
+static struct Message *find_command(const char *);
+static struct Message *find_server_command(const char *, size_t);
+static void rebuild_cmd_hash(void);
+
 static char buffer[1024];
 
 /* turn a string into a parc/parv pair */
@@ -124,6 +159,8 @@ parse(struct Client *client_p, char *pbuffer, char *bufend)
 	int i = 1;
 	char *numeric = 0;
 	struct Message *mptr;
+	struct arena_mark mark;
+	int ret;
 
 	s_assert(MyConnect(client_p));
 	s_assert(client_p->localClient->F != NULL);
@@ -209,7 +246,11 @@ parse(struct Client *client_p, char *pbuffer, char *bufend)
 		if((s = strchr(ch, ' ')))
 			*s++ = '\0';
 
-		mptr = rb_dictionary_retrieve(cmd_dict, ch);
+		mptr = NULL;
+		if(IsServer(client_p))
+			mptr = find_server_command(ch, s != NULL ? (size_t)(s - ch - 1) : strlen(ch));
+		if(mptr == NULL)
+			mptr = find_command(ch);
 
 		/* no command or its encap only, error */
 		if(!mptr || !mptr->cmd)
@@ -267,8 +308,13 @@ parse(struct Client *client_p, char *pbuffer, char *bufend)
 		return;
 	}
 
-	if(handle_command(mptr, client_p, from, i,	/* XXX discards const!!! */
-			  (const char **) para) < -1)
+	/* whatever the handler puts in the arena only lives for this command */
+	arena_mark(&mark);
+	ret = handle_command(mptr, client_p, from, i,	/* XXX discards const!!! */
+			     (const char **) para);
+	arena_release(&mark);
+
+	if(ret < -1)
 	{
 		char *p;
 		for(p = pbuffer; p <= end; p += 8)
@@ -378,7 +424,7 @@ handle_encap(struct Client *client_p, struct Client *source_p, const char *comma
 
 	parv[0] = source_p->name;
 
-	mptr = rb_dictionary_retrieve(cmd_dict, command);
+	mptr = find_command(command);
 
 	if(mptr == NULL || mptr->cmd == NULL)
 		return;
@@ -432,6 +478,7 @@ mod_add_cmd(struct Message *msg)
 	msg->bytes = 0;
 
 	rb_dictionary_add(cmd_dict, msg->cmd, msg);
+	rebuild_cmd_hash();
 }
 
 /* mod_del_cmd
@@ -448,6 +495,226 @@ mod_del_cmd(struct Message *msg)
 		return;
 
 	rb_dictionary_delete(cmd_dict, msg->cmd);
+	rebuild_cmd_hash();
+}
+
+static inline unsigned int
+cmd_hash_slot(uint32_t hashv, unsigned int disp)
+{
+	hashv ^= disp * 0x9e3779b9U;
+	hashv ^= hashv >> 16;
+	hashv *= 0x85ebca6bU;
+	hashv ^= hashv >> 13;
+	hashv *= 0xc2b2ae35U;
+	hashv ^= hashv >> 16;
+	return hashv & cmd_hash_mask;
+}
+
+/* find_command()
+ *
+ * inputs	- command name, any case
+ * output	- struct Message for the command, or NULL
+ * side effects - NONE
+ */
+static struct Message *
+find_command(const char *name)
+{
+	struct Message *msg;
+	uint32_t hashv;
+
+	if(cmd_hash_table == NULL)
+		return rb_dictionary_retrieve(cmd_dict, name);
+
+	hashv = fnv_hash_upper((const unsigned char *)name, 32);
+	msg = cmd_hash_table[cmd_hash_slot(hashv, cmd_hash_disp[hashv & cmd_hash_bucket_mask])];
+
+	if(msg != NULL && !strcasecmp(msg->cmd, name))
+		return msg;
+
+	return NULL;
+}
+
+/* find_server_command()
+ *
+ * inputs	- command name and its length
+ * output	- struct Message if the name is one of the hot server
+ *		  tokens, exactly as servers send them; NULL otherwise
+ * side effects - NONE
+ */
+static struct Message *
+find_server_command(const char *name, size_t len)
+{
+	int i;
+
+	for(i = 0; server_fast_cmds[i].cmd != NULL; i++)
+	{
+		if(server_fast_cmds[i].len == len && !memcmp(server_fast_cmds[i].cmd, name, len))
+			return server_fast_cmds[i].msg;
+	}
+
+	return NULL;
+}
+
+static int
+cmd_bucket_cmp(const void *a, const void *b)
+{
+	const unsigned int *x = a, *y = b;
+
+	/* largest buckets first, they are the hardest to place */
+	return (int)y[1] - (int)x[1];
+}
+
+/* build_cmd_hash()
+ *
+ * inputs	- number of table slots and buckets, both powers of two
+ * output	- YES if every command was placed in its own slot
+ * side effects - on success the new table replaces the old one
+ */
+static bool
+build_cmd_hash(unsigned int size, unsigned int nbuckets)
+{
+	struct rb_dictionaryIter iter;
+	struct Message *msg;
+	struct Message **table;
+	uint16_t *disp;
+	uint32_t *hashes;
+	struct Message **members;
+	unsigned int *buckets, *start, *placed;
+	unsigned int count = rb_dictionary_size(cmd_dict);
+	unsigned int i, j, b, n, d;
+	bool ok = YES;
+
+	table = rb_malloc(sizeof(struct Message *) * size);
+	disp = rb_malloc(sizeof(uint16_t) * nbuckets);
+	hashes = rb_malloc(sizeof(uint32_t) * count);
+	members = rb_malloc(sizeof(struct Message *) * count);
+	buckets = rb_malloc(sizeof(unsigned int) * 2 * nbuckets);
+	start = rb_malloc(sizeof(unsigned int) * (nbuckets + 1));
+	placed = rb_malloc(sizeof(unsigned int) * count);
+
+	cmd_hash_mask = size - 1;
+
+	/* group the commands by bucket */
+	RB_DICTIONARY_FOREACH(msg, &iter, cmd_dict)
+	{
+		start[(fnv_hash_upper((const unsigned char *)msg->cmd, 32) & (nbuckets - 1)) + 1]++;
+	}
+	for(b = 0; b < nbuckets; b++)
+		start[b + 1] += start[b];
+
+	for(b = 0; b < nbuckets; b++)
+	{
+		buckets[b * 2] = b;
+		buckets[b * 2 + 1] = start[b + 1] - start[b];
+	}
+
+	RB_DICTIONARY_FOREACH(msg, &iter, cmd_dict)
+	{
+		uint32_t hashv = fnv_hash_upper((const unsigned char *)msg->cmd, 32);
+
+		b = hashv & (nbuckets - 1);
+		i = start[b] + --buckets[b * 2 + 1];
+		members[i] = msg;
+		hashes[i] = hashv;
+	}
+
+	for(b = 0; b < nbuckets; b++)
+		buckets[b * 2 + 1] = start[b + 1] - start[b];
+
+	qsort(buckets, nbuckets, sizeof(unsigned int) * 2, cmd_bucket_cmp);
+
+	/* find a displacement for each bucket that lands all of its
+	 * commands on free slots */
+	for(j = 0; j < nbuckets && ok; j++)
+	{
+		b = buckets[j * 2];
+		n = buckets[j * 2 + 1];
+
+		if(n == 0)
+			break;
+
+		for(d = 0; d < CMD_HASH_MAXDISP; d++)
+		{
+			for(i = 0; i < n; i++)
+			{
+				placed[i] = cmd_hash_slot(hashes[start[b] + i], d);
+				if(table[placed[i]] != NULL)
+					break;
+				table[placed[i]] = members[start[b] + i];
+			}
+
+			if(i == n)
+				break;
+
+			while(i-- > 0)
+				table[placed[i]] = NULL;
+		}
+
+		if(d == CMD_HASH_MAXDISP)
+			ok = NO;
+		else
+			disp[b] = d;
+	}
+
+	rb_free(hashes);
+	rb_free(members);
+	rb_free(buckets);
+	rb_free(start);
+	rb_free(placed);
+
+	if(!ok)
+	{
+		rb_free(table);
+		rb_free(disp);
+		return NO;
+	}
+
+	rb_free(cmd_hash_table);
+	rb_free(cmd_hash_disp);
+	cmd_hash_table = table;
+	cmd_hash_disp = disp;
+	cmd_hash_bucket_mask = nbuckets - 1;
+	return YES;
+}
+
+/* rebuild_cmd_hash()
+ *
+ * inputs	- NONE
+ * output	- NONE
+ * side effects - the command hash and the server fast path are
+ *		  regenerated from cmd_dict.  If no perfect hash can be
+ *		  found, lookups fall back to cmd_dict.
+ */
+static void
+rebuild_cmd_hash(void)
+{
+	unsigned int count = rb_dictionary_size(cmd_dict);
+	unsigned int size, nbuckets;
+	int i;
+
+	for(i = 0; server_fast_cmds[i].cmd != NULL; i++)
+		server_fast_cmds[i].msg = rb_dictionary_retrieve(cmd_dict, server_fast_cmds[i].cmd);
+
+	if(count > 0)
+	{
+		for(nbuckets = 1; nbuckets * 2 < count; nbuckets <<= 1)
+			;
+		for(size = 2; size < count * 2; size <<= 1)
+			;
+
+		for(; size <= count * 32; size <<= 1)
+		{
+			if(build_cmd_hash(size, nbuckets))
+				return;
+		}
+
+		ilog(L_MAIN, "Unable to build the command hash for %u commands", count);
+	}
+
+	rb_free(cmd_hash_table);
+	rb_free(cmd_hash_disp);
+	cmd_hash_table = NULL;
+	cmd_hash_disp = NULL;
 }
 
 /*
@@ -64,6 +64,25 @@ typedef struct _throttle
 	int count;
 } throttle_t;
 
+/*
+ * with throttle_sketch enabled, connection counts are kept in a fixed
+ * size count-min sketch, and an address only gets an exact throttle_t
+ * once its estimate crosses throttle_count.  cells reset lazily once
+ * throttle_duration has passed since they were last bumped, mirroring
+ * the expiry of the exact records.
+ */
+#define THROTTLE_SKETCH_DEPTH	4
+#define THROTTLE_SKETCH_WIDTH	16384	/* must be a power of two */
+
+struct sketch_cell
+{
+	uint32_t count;
+	uint32_t last;
+};
+
+static struct sketch_cell throttle_sketch[THROTTLE_SKETCH_DEPTH][THROTTLE_SKETCH_WIDTH];
+static uint32_t throttle_sketch_seed[THROTTLE_SKETCH_DEPTH];
+
 unsigned long
 delay_exit_length(void)
 {
@@ -97,13 +116,14 @@ reject_expires(void *unused)
 	rb_patricia_node_t *pnode;
 	reject_t *rdata;
 
+	/* reject_list is kept in order of last use */
 	RB_DLINK_FOREACH_SAFE(ptr, next, reject_list.head)
 	{
 		pnode = ptr->data;
 		rdata = pnode->data;
 
 		if(rdata->time + ConfigFileEntry.reject_duration > rb_current_time())
-			continue;
+			break;
 
 		rb_dlinkDelete(ptr, &reject_list);
 		rb_free(rdata);
@@ -116,6 +136,10 @@ init_reject(void)
 {
 	reject_tree = rb_new_patricia(PATRICIA_BITS);
 	throttle_tree = rb_new_patricia(PATRICIA_BITS);
+
+	if(rb_get_random(throttle_sketch_seed, sizeof(throttle_sketch_seed)) != 1)
+		rb_get_pseudo_random(throttle_sketch_seed, sizeof(throttle_sketch_seed));
+
 	rb_event_add("reject_exit", reject_exit, NULL, DELAYED_EXIT_TIME);
 	rb_event_add("reject_expires", reject_expires, NULL, 60);
 	rb_event_add("throttle_expires", throttle_expires, NULL, 10);
@@ -164,6 +188,7 @@ add_reject(struct Client *client_p, const char *mask1, const char *mask2)
 		rdata = pnode->data;
 		rdata->time = rb_current_time();
 		rdata->count++;
+		rb_dlinkMoveTail(&rdata->rnode, &reject_list);
 	}
 	else
 	{
@@ -196,6 +221,7 @@ check_reject(rb_fde_t * F, struct sockaddr *addr)
 		rdata = pnode->data;
 
 		rdata->time = rb_current_time();
+		rb_dlinkMoveTail(&rdata->rnode, &reject_list);
 		if(rdata->count > (unsigned long) ConfigFileEntry.reject_after_count)
 		{
 			ddata = rb_malloc(sizeof(delay_t));
@@ -302,11 +328,76 @@ remove_reject_mask(const char *mask1, const char *mask2)
 	return n;
 }
 
+static unsigned int
+sketch_hash(struct sockaddr *addr, uint32_t seed)
+{
+	const unsigned char *p;
+	size_t len;
+	uint32_t h = 2166136261U ^ seed;
+
+	if(GET_SS_FAMILY(addr) == AF_INET6)
+	{
+		p = (const unsigned char *) &((struct sockaddr_in6 *) addr)->sin6_addr;
+		len = sizeof(struct in6_addr);
+	}
+	else
+	{
+		p = (const unsigned char *) &((struct sockaddr_in *) addr)->sin_addr;
+		len = sizeof(struct in_addr);
+	}
+
+	while(len--)
+	{
+		h ^= *p++;
+		h *= 16777619U;
+	}
+
+	return h & (THROTTLE_SKETCH_WIDTH - 1);
+}
+
+/*
+ * sketch_add - count a connection from addr in the sketch
+ * returns the new estimate.  uses conservative update, so only the
+ * cells holding the current minimum are bumped.
+ */
+static uint32_t
+sketch_add(struct sockaddr *addr)
+{
+	struct sketch_cell *cell[THROTTLE_SKETCH_DEPTH];
+	uint32_t now = (uint32_t) rb_current_time();
+	uint32_t est = UINT32_MAX;
+	int i;
+
+	for(i = 0; i < THROTTLE_SKETCH_DEPTH; i++)
+	{
+		cell[i] = &throttle_sketch[i][sketch_hash(addr, throttle_sketch_seed[i])];
+
+		if(now - cell[i]->last >= (uint32_t) ConfigFileEntry.throttle_duration)
+			cell[i]->count = 0;
+
+		if(cell[i]->count < est)
+			est = cell[i]->count;
+	}
+
+	est++;
+	for(i = 0; i < THROTTLE_SKETCH_DEPTH; i++)
+	{
+		if(cell[i]->count < est)
+		{
+			cell[i]->count = est;
+			cell[i]->last = now;
+		}
+	}
+
+	return est;
+}
+
 int
 throttle_add(struct sockaddr *addr)
 {
 	throttle_t *t;
 	rb_patricia_node_t *pnode;
+	int count = 1;
 
 	if((pnode = rb_match_ip(throttle_tree, addr)) != NULL)
 	{
@@ -320,19 +411,25 @@ throttle_add(struct sockaddr *addr)
 		/* Stop penalizing them after they've been throttled */
 		t->last = rb_current_time();
 		t->count++;
-
+		rb_dlinkMoveTail(&t->node, &throttle_list);
 	}
 	else
 	{
 		int bitlen = 32;
+
+		/* only heavy hitters get an exact record */
+		if(ConfigFileEntry.throttle_sketch &&
+		   (count = sketch_add(addr)) <= ConfigFileEntry.throttle_count)
+			return 0;
+
 		if(GET_SS_FAMILY(addr) == AF_INET6)
 			bitlen = 128;
 		t = rb_malloc(sizeof(throttle_t));
 		t->last = rb_current_time();
-		t->count = 1;
+		t->count = count;
 		pnode = make_and_lookup_ip(throttle_tree, addr, bitlen);
 		pnode->data = t;
-		rb_dlinkAdd(pnode, &t->node, &throttle_list);
+		rb_dlinkAddTail(pnode, &t->node, &throttle_list);
 	}
 	return 0;
 }
@@ -372,6 +469,8 @@ flush_throttle(void)
 		rb_free(t);
 		rb_patricia_remove(throttle_tree, pnode);
 	}
+
+	memset(throttle_sketch, 0, sizeof(throttle_sketch));
 }
 
 static void
@@ -381,13 +480,14 @@ throttle_expires(void *unused)
 	rb_patricia_node_t *pnode;
 	throttle_t *t;
 
+	/* throttle_list is kept in order of last use */
 	RB_DLINK_FOREACH_SAFE(ptr, next, throttle_list.head)
 	{
 		pnode = ptr->data;
 		t = pnode->data;
 
 		if(t->last + ConfigFileEntry.throttle_duration > rb_current_time())
-			continue;
+			break;
 
 		rb_dlinkDelete(ptr, &throttle_list);
 		rb_free(t);
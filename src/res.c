@@ -23,6 +23,9 @@
  * 2006 --jilles and nenolod
  */
 
+/* for recvmmsg() */
+#define _GNU_SOURCE 1
+
 #include "stdinc.h"
 #include "ircd_defs.h"
 #include "common.h"
@@ -43,6 +46,13 @@ static PF res_readreply;
 #define RES_MAXALIASES 35	/* maximum aliases allowed */
 #define RES_MAXADDRS   35	/* maximum addresses allowed */
 #define AR_TTL         600	/* TTL in seconds for dns cache entries */
+#define AR_NEG_TTL     300	/* longest we remember a name doesn't exist */
+#define AR_NEG_DEFTTL  30	/* ... when the server doesn't tell us */
+#define AR_CACHE_MAX   8192	/* entries, the oldest go first */
+#define AR_KEYLEN      (IRCD_RES_HOSTLEN + 8)	/* "<qtype> <qname>" */
+#define AR_IDS         65536	/* every possible query id */
+#define AR_WHEEL       64	/* seconds of timeouts, a power of two */
+#define AR_RECV_BATCH  32	/* replies read per recvmmsg() */
 
 /* RFC 1104/1105 wasn't very helpful about what these fields
  * should be named, so for now, we'll just name them this way.
@@ -54,13 +64,19 @@ static PF res_readreply;
 #define RDLENGTH_SIZE     (size_t)2
 #define ANSWER_FIXED_SIZE (TYPE_SIZE + CLASS_SIZE + TTL_SIZE + RDLENGTH_SIZE)
 
+#define T_SOA 6
+#define SOA_MINIMUM_OFFSET 16	/* serial, refresh, retry, expire, minimum */
+
 struct reslist
 {
 	rb_dlink_node node;
+	rb_dlink_node tnode;	/* on timeout_wheel */
+	time_t deadline;	/* sentat + timeout */
 	int id;
 	time_t ttl;
 	char type;
 	char queryname[IRCD_RES_HOSTLEN + 1];	/* name currently being queried */
+	char key[AR_KEYLEN];	/* cache and in-flight key */
 	char retries;		/* retry counter */
 	char sends;		/* number of sends (>1 means resent) */
 	time_t sentat;
@@ -68,16 +84,59 @@ struct reslist
 	unsigned int lastns;	/* index of last server sent to */
 	struct rb_sockaddr_storage addr;
 	char *name;
-	struct DNSQuery *query;	/* query callback for this request */
+	rb_dlink_list waiters;	/* DNSQuery's wanting this answer */
+	bool inflight;		/* listed in inflight_dict */
+	bool cached;		/* answered from the cache, on ready_list */
+	bool answered;		/* cached answer was positive */
+	bool finishing;		/* callbacks are being run */
+};
+
+/* an answer, or the lack of one, we have been given before */
+struct res_cache
+{
+	rb_dlink_node node;	/* on cache_list, oldest first */
+	char *key;
+	time_t expires;
+	bool negative;
+	char *name;		/* PTR answer */
+	struct rb_sockaddr_storage addr;	/* A/AAAA answer */
 };
 
 static rb_fde_t *res_fd;
 static rb_dlink_list request_list = { NULL, NULL, 0 };
 
+/* requests on the wire by id, replies are matched in one step */
+static struct reslist *id_table[AR_IDS];
+
+/* requests by the second they time out in, modulo AR_WHEEL */
+static rb_dlink_list timeout_wheel[AR_WHEEL];
+static time_t timeout_lastrun;
+
+/* requests on the wire, by key, so lookups for the same name share one */
+static struct rb_dictionary *inflight_dict;
+
+static struct rb_dictionary *cache_dict;
+static rb_dlink_list cache_list;
+
+/* cache hits are answered from the event loop, never from inside
+ * gethost_by*(), so callers see the same ordering as a real query */
+static rb_dlink_list ready_list;
+static rb_fde_t *ready_rfd, *ready_wfd;
+
+static struct
+{
+	unsigned long hits;
+	unsigned long negative_hits;
+	unsigned long misses;
+	unsigned long coalesced;
+} res_stats;
+
 static int ns_timeout_count[IRCD_MAXNS];
 
 static void rem_request(struct reslist *request);
-static struct reslist *make_request(struct DNSQuery *query);
+static struct reslist *make_request(void);
+static void res_finish(struct reslist *request, bool success);
+static void res_cache_flush(void);
 static void do_query_name(struct DNSQuery *query, const char *name, struct reslist *request, int);
 static void do_query_number(struct DNSQuery *query, const struct rb_sockaddr_storage *,
 			    struct reslist *request);
@@ -87,7 +146,6 @@ static void resend_query(struct reslist *request);
 static int check_question(struct reslist *request, HEADER * header, char *buf, char *eob);
 static int proc_answer(struct reslist *request, HEADER * header, char *, char *);
 static struct reslist *find_id(int id);
-static struct DNSReply *make_dnsreply(struct reslist *request);
 
 /*
  * int
@@ -147,48 +205,68 @@ res_ourserver(const struct rb_sockaddr_storage *inp)
 	return 0;
 }
 
+/*
+ * schedule_timeout - file a request under the second it times out in
+ */
+static void
+schedule_timeout(struct reslist *request)
+{
+	request->deadline = request->sentat + request->timeout;
+	rb_dlinkAdd(request, &request->tnode,
+		    &timeout_wheel[request->deadline & (AR_WHEEL - 1)]);
+}
+
+static void
+unschedule_timeout(struct reslist *request)
+{
+	rb_dlinkDelete(&request->tnode, &timeout_wheel[request->deadline & (AR_WHEEL - 1)]);
+}
+
 /*
  * timeout_query_list - Remove queries from the list which have been 
- * there too long without being resolved.
+ * there too long without being resolved.  Only the seconds since the
+ * last run are looked at, anything in those slots due on a later
+ * turn of the wheel is left alone.
  */
-static time_t
+static void
 timeout_query_list(time_t now)
 {
 	rb_dlink_node *ptr;
 	rb_dlink_node *next_ptr;
+	rb_dlink_list *slot;
 	struct reslist *request;
-	time_t next_time = 0;
-	time_t timeout = 0;
+	time_t t;
 
-	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, request_list.head)
+	if(timeout_lastrun == 0 || now - timeout_lastrun > AR_WHEEL)
+		timeout_lastrun = now - AR_WHEEL;
+
+	for(t = timeout_lastrun + 1; t <= now; t++)
 	{
-		request = ptr->data;
-		timeout = request->sentat + request->timeout;
+		slot = &timeout_wheel[t & (AR_WHEEL - 1)];
 
-		if(now >= timeout)
+		RB_DLINK_FOREACH_SAFE(ptr, next_ptr, slot->head)
 		{
+			request = ptr->data;
+
+			if(request->deadline > now)
+				continue;
+
 			if(--request->retries <= 0)
 			{
-				(*request->query->callback) (request->query->ptr, NULL);
-				rem_request(request);
+				res_finish(request, NO);
 				continue;
 			}
-			else
-			{
-				ns_timeout_count[request->lastns]++;
-				request->sentat = now;
-				request->timeout += request->timeout;
-				resend_query(request);
-			}
-		}
 
-		if((next_time == 0) || timeout < next_time)
-		{
-			next_time = timeout;
+			ns_timeout_count[request->lastns]++;
+			unschedule_timeout(request);
+			request->sentat = now;
+			request->timeout += request->timeout;
+			schedule_timeout(request);
+			resend_query(request);
 		}
 	}
 
-	return (next_time > now) ? next_time : (now + AR_TTL);
+	timeout_lastrun = now;
 }
 
 /*
@@ -228,6 +306,53 @@ start_resolver(void)
 	}
 }
 
+/*
+ * res_deliver_ready - run the callbacks for lookups answered
+ * from the cache
+ */
+static void
+res_deliver_ready(rb_fde_t *F, void *data)
+{
+	char buf[64];
+	struct reslist *request;
+
+	while(rb_read(F, buf, sizeof(buf)) > 0)
+		;
+
+	while(ready_list.head != NULL)
+	{
+		request = ready_list.head->data;
+		res_finish(request, request->answered);
+	}
+
+	rb_setselect(F, RB_SELECT_READ, res_deliver_ready, NULL);
+}
+
+/*
+ * res_cache_expire - drop cache entries past their ttl, lookups
+ * skip them anyway but this gives the memory back
+ */
+static void
+res_cache_expire(void *unused)
+{
+	rb_dlink_node *ptr, *next_ptr;
+	struct res_cache *entry;
+
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, cache_list.head)
+	{
+		entry = ptr->data;
+
+		if(entry->expires <= rb_current_time())
+		{
+			rb_dictionary_delete(cache_dict, entry->key);
+			rb_dlinkDelete(&entry->node, &cache_list);
+			rb_free(entry->key);
+			rb_free(entry->name);
+			rb_free(entry);
+		}
+	}
+}
+
 /*
  * init_resolver - initialize resolver and resolver library
  */
@@ -237,6 +362,21 @@ init_resolver(void)
 #ifdef HAVE_SRAND48
 	srand48(rb_current_time());
 #endif
+	inflight_dict = rb_dictionary_create(strcasecmp);
+	cache_dict = rb_dictionary_create(strcasecmp);
+
+	if(rb_pipe(&ready_rfd, &ready_wfd, "resolver cache pipe") == -1)
+	{
+		/* we can still resolve, just without the cache */
+		ilog(L_MAIN, "Unable to create resolver cache pipe: %s", strerror(errno));
+		ready_rfd = ready_wfd = NULL;
+	}
+	else
+	{
+		rb_setselect(ready_rfd, RB_SELECT_READ, res_deliver_ready, NULL);
+		rb_event_add("res_cache_expire", res_cache_expire, NULL, 60);
+	}
+
 	start_resolver();
 }
 
@@ -249,6 +389,7 @@ restart_resolver(void)
 	rb_close(res_fd);
 	res_fd = NULL;
 	rb_event_delete(timeout_resolver_ev);	/* -ddosen */
+	res_cache_flush();
 	start_resolver();
 }
 
@@ -283,7 +424,20 @@ add_local_domain(char *hname, size_t size)
 static void
 rem_request(struct reslist *request)
 {
-	rb_dlinkDelete(&request->node, &request_list);
+	if(request->cached)
+		rb_dlinkDelete(&request->node, &ready_list);
+	else
+	{
+		rb_dlinkDelete(&request->node, &request_list);
+		unschedule_timeout(request);
+
+		if(id_table[request->id] == request)
+			id_table[request->id] = NULL;
+	}
+
+	if(request->inflight)
+		rb_dictionary_delete(inflight_dict, request->key);
+
 	rb_free(request->name);
 	rb_free(request);
 }
@@ -292,39 +446,219 @@ rem_request(struct reslist *request)
  * make_request - Create a DNS request record for the server.
  */
 static struct reslist *
-make_request(struct DNSQuery *query)
+make_request(void)
 {
 	struct reslist *request = rb_malloc(sizeof(struct reslist));
 
 	request->sentat = rb_current_time();
 	request->retries = 3;
 	request->timeout = 4;	/* start at 4 and exponential inc. */
-	request->query = query;
 
 	rb_dlinkAdd(request, &request->node, &request_list);
+	schedule_timeout(request);
 
 	return request;
 }
 
+/*
+ * add_waiter - hand the answer to request to query as well
+ */
+static void
+add_waiter(struct reslist *request, struct DNSQuery *query)
+{
+	query->request = request;
+	rb_dlinkAddTail(query, &query->node, &request->waiters);
+}
+
 /*
  * delete_resolver_queries - cleanup outstanding queries 
  * for which there no longer exist clients or conf lines.
+ *
+ * A request nobody is waiting on stays on the wire, its answer
+ * still goes into the cache.
  */
 void
-delete_resolver_queries(const struct DNSQuery *query)
+delete_resolver_queries(struct DNSQuery *query)
+{
+	struct reslist *request = query->request;
+
+	if(request == NULL)
+		return;
+
+	rb_dlinkDelete(&query->node, &request->waiters);
+	query->request = NULL;
+
+	if(request->cached && !request->finishing
+	   && rb_dlink_list_length(&request->waiters) == 0)
+		rem_request(request);
+}
+
+/*
+ * res_cache_add - remember the answer (or lack of one) to request
+ * for ttl seconds
+ */
+static void
+res_cache_add(struct reslist *request, bool negative, time_t ttl)
+{
+	struct res_cache *entry;
+
+	if(ttl <= 0 || ready_wfd == NULL)
+		return;
+
+	if((entry = rb_dictionary_retrieve(cache_dict, request->key)) != NULL)
+	{
+		/* refreshed by a query that went out before it expired */
+		rb_dlinkDelete(&entry->node, &cache_list);
+		rb_free(entry->name);
+	}
+	else
+	{
+		if(rb_dlink_list_length(&cache_list) >= AR_CACHE_MAX)
+		{
+			struct res_cache *oldest = cache_list.head->data;
+
+			rb_dictionary_delete(cache_dict, oldest->key);
+			rb_dlinkDelete(&oldest->node, &cache_list);
+			rb_free(oldest->key);
+			rb_free(oldest->name);
+			rb_free(oldest);
+		}
+
+		entry = rb_malloc(sizeof(struct res_cache));
+		entry->key = rb_strdup(request->key);
+		rb_dictionary_add(cache_dict, entry->key, entry);
+	}
+
+	entry->expires = rb_current_time() + ttl;
+	entry->negative = negative;
+	entry->name = NULL;
+
+	if(!negative)
+	{
+		if(request->type == T_PTR)
+			entry->name = rb_strdup(request->name);
+		else
+			memcpy(&entry->addr, &request->addr, sizeof(entry->addr));
+	}
+
+	rb_dlinkAddTail(entry, &entry->node, &cache_list);
+}
+
+static void
+res_cache_flush(void)
+{
+	rb_dlink_node *ptr, *next_ptr;
+	struct res_cache *entry;
+
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, cache_list.head)
+	{
+		entry = ptr->data;
+		rb_dictionary_delete(cache_dict, entry->key);
+		rb_dlinkDelete(&entry->node, &cache_list);
+		rb_free(entry->key);
+		rb_free(entry->name);
+		rb_free(entry);
+	}
+}
+
+/*
+ * res_lookup - find something to answer query from, before a new
+ * request is sent.  name is the name for A/AAAA lookups, addr the
+ * address for PTR ones.  Returns YES if query has been taken care of.
+ */
+static bool
+res_lookup(struct DNSQuery *query, const char *key, int type, const char *name,
+	   const struct rb_sockaddr_storage *addr)
 {
-	rb_dlink_node *ptr;
-	rb_dlink_node *next_ptr;
 	struct reslist *request;
+	struct res_cache *entry;
+
+	if((request = rb_dictionary_retrieve(inflight_dict, key)) != NULL)
+	{
+		res_stats.coalesced++;
+		add_waiter(request, query);
+		return YES;
+	}
+
+	entry = rb_dictionary_retrieve(cache_dict, key);
+
+	if(entry == NULL || entry->expires <= rb_current_time())
+	{
+		res_stats.misses++;
+		return NO;
+	}
+
+	if(entry->negative)
+		res_stats.negative_hits++;
+	else
+		res_stats.hits++;
+
+	request = rb_malloc(sizeof(struct reslist));
+	request->type = type;
+	request->cached = YES;
+	request->answered = !entry->negative;
+	rb_strlcpy(request->key, key, sizeof(request->key));
+
+	if(type == T_PTR)
+	{
+		memcpy(&request->addr, addr, sizeof(request->addr));
+		request->name = rb_strdup(entry->negative ? "" : entry->name);
+	}
+	else
+	{
+		memcpy(&request->addr, &entry->addr, sizeof(request->addr));
+		request->name = rb_strdup(name);
+	}
+
+	add_waiter(request, query);
+
+	if(rb_dlink_list_length(&ready_list) == 0)
+		rb_write(ready_wfd, "", 1);
+
+	rb_dlinkAddTail(request, &request->node, &ready_list);
+	return YES;
+}
+
+/*
+ * res_finish - hand the result of request to everyone waiting on it,
+ * then get rid of it.  A PTR answer is not the end, the name it gave
+ * has to resolve back to the address first.
+ */
+static void
+res_finish(struct reslist *request, bool success)
+{
+	struct DNSQuery *query;
+	struct DNSReply reply;
+
+	/* lookups started from the callbacks must not join this one */
+	if(request->inflight)
+	{
+		rb_dictionary_delete(inflight_dict, request->key);
+		request->inflight = NO;
+	}
+
+	request->finishing = YES;
 
-	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, request_list.head)
+	while(request->waiters.head != NULL)
 	{
-		if((request = ptr->data) != NULL)
+		query = request->waiters.head->data;
+		rb_dlinkDelete(&query->node, &request->waiters);
+		query->request = NULL;
+
+		if(!success)
+			(*query->callback) (query->ptr, NULL);
+		else if(request->type == T_PTR)
+			gethost_byname_type(request->name, query,
+					    request->addr.ss_family == AF_INET6 ? T_AAAA : T_A);
+		else
 		{
-			if(query == request->query)
-				rem_request(request);
+			reply.h_name = request->name;
+			memcpy(&reply.addr, &request->addr, sizeof(reply.addr));
+			(*query->callback) (query->ptr, &reply);
 		}
 	}
+
+	rem_request(request);
 }
 
 /*
@@ -397,18 +731,7 @@ send_res_msg(const char *msg, int len, int rcount)
 static struct reslist *
 find_id(int id)
 {
-	rb_dlink_node *ptr;
-	struct reslist *request;
-
-	RB_DLINK_FOREACH(ptr, request_list.head)
-	{
-		request = ptr->data;
-
-		if(request->id == id)
-			return (request);
-	}
-
-	return (NULL);
+	return id_table[id & (AR_IDS - 1)];
 }
 
 /* 
@@ -439,14 +762,24 @@ do_query_name(struct DNSQuery *query, const char *name, struct reslist *request,
 {
 	char host_name[IRCD_RES_HOSTLEN + 1];
 
+	char key[AR_KEYLEN];
+
 	rb_strlcpy(host_name, name, IRCD_RES_HOSTLEN + 1);
 	add_local_domain(host_name, IRCD_RES_HOSTLEN);
 
 	if(request == NULL)
 	{
-		request = make_request(query);
-		request->name = (char *) rb_malloc(strlen(host_name) + 1);
-		strcpy(request->name, host_name);
+		rb_snprintf(key, sizeof(key), "%d %s", type, host_name);
+
+		if(res_lookup(query, key, type, host_name, NULL))
+			return;
+
+		request = make_request();
+		request->name = rb_strdup(host_name);
+		rb_strlcpy(request->key, key, sizeof(request->key));
+		rb_dictionary_add(inflight_dict, request->key, request);
+		request->inflight = YES;
+		add_waiter(request, query);
 	}
 
 	rb_strlcpy(request->queryname, host_name, sizeof(request->queryname));
@@ -461,21 +794,18 @@ static void
 do_query_number(struct DNSQuery *query, const struct rb_sockaddr_storage *addr,
 		struct reslist *request)
 {
+	char queryname[IRCD_RES_HOSTLEN + 1];
+	char key[AR_KEYLEN];
 	const unsigned char *cp;
 
-	if(request == NULL)
-	{
-		request = make_request(query);
-		memcpy(&request->addr, addr, sizeof(struct rb_sockaddr_storage));
-		request->name = (char *) rb_malloc(IRCD_RES_HOSTLEN + 1);
-	}
+	queryname[0] = '\0';
 
 	if(addr->ss_family == AF_INET)
 	{
 		const struct sockaddr_in *v4 = (const struct sockaddr_in *) addr;
 		cp = (const unsigned char *) &v4->sin_addr.s_addr;
 
-		rb_sprintf(request->queryname, "%u.%u.%u.%u.in-addr.arpa", (unsigned int) (cp[3]),
+		rb_sprintf(queryname, "%u.%u.%u.%u.in-addr.arpa", (unsigned int) (cp[3]),
 			   (unsigned int) (cp[2]), (unsigned int) (cp[1]), (unsigned int) (cp[0]));
 	}
 	else if(addr->ss_family == AF_INET6)
@@ -483,7 +813,7 @@ do_query_number(struct DNSQuery *query, const struct rb_sockaddr_storage *addr,
 		const struct sockaddr_in6 *v6 = (const struct sockaddr_in6 *) addr;
 		cp = (const unsigned char *) &v6->sin6_addr.s6_addr;
 
-		(void) sprintf(request->queryname,
+		(void) sprintf(queryname,
 			       "%x.%x.%x.%x.%x.%x.%x.%x.%x.%x.%x.%x.%x.%x.%x.%x.%x."
 			       "%x.%x.%x.%x.%x.%x.%x.%x.%x.%x.%x.%x.%x.%x.%x.ip6.arpa",
 			       (unsigned int) (cp[15] & 0xf), (unsigned int) (cp[15] >> 4),
@@ -504,6 +834,23 @@ do_query_number(struct DNSQuery *query, const struct rb_sockaddr_storage *addr,
 			       (unsigned int) (cp[0] & 0xf), (unsigned int) (cp[0] >> 4));
 	}
 
+	if(request == NULL)
+	{
+		rb_snprintf(key, sizeof(key), "%d %s", T_PTR, queryname);
+
+		if(res_lookup(query, key, T_PTR, NULL, addr))
+			return;
+
+		request = make_request();
+		memcpy(&request->addr, addr, sizeof(struct rb_sockaddr_storage));
+		request->name = (char *) rb_malloc(IRCD_RES_HOSTLEN + 1);
+		rb_strlcpy(request->key, key, sizeof(request->key));
+		rb_dictionary_add(inflight_dict, request->key, request);
+		request->inflight = YES;
+		add_waiter(request, query);
+	}
+
+	rb_strlcpy(request->queryname, queryname, sizeof(request->queryname));
 	request->type = T_PTR;
 	query_name(request);
 }
@@ -550,7 +897,13 @@ query_name(struct reslist *request)
 		}
 		while(find_id(header->id));
 #endif /* HAVE_LRAND48 */
+		/* a resend goes out under a new id, late replies to the
+		 * old one are ignored */
+		if(id_table[request->id] == request)
+			id_table[request->id] = NULL;
+
 		request->id = header->id;
+		id_table[request->id] = request;
 		++request->sends;
 
 		ns = send_res_msg(buf, request_len, request->sends);
@@ -732,38 +1085,88 @@ proc_answer(struct reslist *request, HEADER * header, char *buf, char *eob)
 		}
 	}
 
-	return (1);
+	/* nothing we asked for */
+	return (0);
 }
 
 /*
- * res_read_single_reply - read a dns reply from the nameserver and process it.
- * Return value: 1 if a packet was read, 0 otherwise
+ * proc_negative_ttl - how long the server says a name that doesn't
+ * exist (or has no records of the type we want) stays that way,
+ * the lesser of the ttl and minimum of the SOA in the authority
+ * section (rfc2308).
+ */
+static time_t
+proc_negative_ttl(HEADER * header, char *buf, char *eob)
+{
+	unsigned char *current = (unsigned char *) buf + sizeof(HEADER);
+	unsigned char *rdata;
+	int count = header->qdcount + header->ancount + header->nscount;
+	int i, n;
+	int type;
+	int rd_length;
+	time_t ttl, minimum;
+
+	for(i = 0; i < count; i++)
+	{
+		if((n = irc_dn_skipname(current, (unsigned char *) eob)) < 0)
+			return 0;
+
+		current += (size_t) n;
+
+		/* the question has no ttl or data */
+		if(i < header->qdcount)
+		{
+			current += QFIXEDSZ;
+			continue;
+		}
+
+		if(current + ANSWER_FIXED_SIZE > (unsigned char *) eob)
+			return 0;
+
+		type = irc_ns_get16(current);
+		ttl = irc_ns_get32(current + TYPE_SIZE + CLASS_SIZE);
+		rd_length = irc_ns_get16(current + TYPE_SIZE + CLASS_SIZE + TTL_SIZE);
+		current += ANSWER_FIXED_SIZE;
+		rdata = current;
+		current += rd_length;
+
+		if(current > (unsigned char *) eob)
+			return 0;
+
+		if(i < header->qdcount + header->ancount || type != T_SOA)
+			continue;
+
+		/* skip the primary server and contact names */
+		if((n = irc_dn_skipname(rdata, current)) < 0)
+			return 0;
+		rdata += n;
+		if((n = irc_dn_skipname(rdata, current)) < 0)
+			return 0;
+		rdata += n;
+
+		if(rdata + SOA_MINIMUM_OFFSET + NS_INT32SZ > current)
+			return 0;
+
+		minimum = irc_ns_get32(rdata + SOA_MINIMUM_OFFSET);
+		if(minimum < ttl)
+			ttl = minimum;
+
+		return ttl < AR_NEG_TTL ? ttl : AR_NEG_TTL;
+	}
+
+	return AR_NEG_DEFTTL;
+}
+
+/*
+ * res_process_reply - process a dns reply of rc bytes from lsin
+ * Return value: always 1, for res_read_single_reply
  */
 static int
-res_read_single_reply(rb_fde_t * F, void *data)
+res_process_reply(char *buf, int rc, struct rb_sockaddr_storage *lsin)
 {
-	char buf[sizeof(HEADER) + MAXPACKET]
-		/* Sparc and alpha need 16bit-alignment for accessing header->id 
-		 * (which is uint16_t). Because of the header = (HEADER*) buf; 
-		 * lateron, this is neeeded. --FaUl
-		 */
-#if defined(__sparc__) || defined(__alpha__)
-		__attribute__ ((aligned(16)))
-#endif
-		;
 	HEADER *header;
 	struct reslist *request = NULL;
-	struct DNSReply *reply = NULL;
-	int rc;
 	int answer_count;
-	socklen_t len = sizeof(struct rb_sockaddr_storage);
-	struct rb_sockaddr_storage lsin;
-
-	rc = recvfrom(rb_get_fd(F), buf, sizeof(buf), 0, (struct sockaddr *) &lsin, &len);
-
-	/* No packet */
-	if(rc == 0 || rc == -1)
-		return 0;
 
 	/* Too small */
 	if(rc <= (int) (sizeof(HEADER)))
@@ -788,7 +1191,7 @@ res_read_single_reply(rb_fde_t * F, void *data)
 	/*
 	 * check against possibly fake replies
 	 */
-	if(!res_ourserver(&lsin))
+	if(!res_ourserver(lsin))
 		return 1;
 
 	if(!check_question(request, header, buf, buf + rc))
@@ -796,20 +1199,15 @@ res_read_single_reply(rb_fde_t * F, void *data)
 
 	if((header->rcode != NO_ERRORS) || (header->ancount == 0))
 	{
-		if(NXDOMAIN == header->rcode)
-		{
-			(*request->query->callback) (request->query->ptr, NULL);
-			rem_request(request);
-		}
-		else
-		{
-			/*
-			 * If a bad error was returned, we stop here and dont send
-			 * send any more (no retries granted).
-			 */
-			(*request->query->callback) (request->query->ptr, NULL);
-			rem_request(request);
-		}
+		/*
+		 * The name doesn't exist, or has nothing of this type,
+		 * which is worth remembering.  If a bad error was returned,
+		 * we stop here and dont send any more (no retries granted).
+		 */
+		if(header->rcode == NXDOMAIN || header->rcode == NO_ERRORS)
+			res_cache_add(request, YES, proc_negative_ttl(header, buf, buf + rc));
+
+		res_finish(request, NO);
 		return 1;
 	}
 	/*
@@ -820,69 +1218,112 @@ res_read_single_reply(rb_fde_t * F, void *data)
 
 	if(answer_count)
 	{
-		if(request->type == T_PTR)
-		{
-			if(request->name == NULL)
-			{
-				/*
-				 * got a PTR response with no name, something bogus is happening
-				 * don't bother trying again, the client address doesn't resolve
-				 */
-				(*request->query->callback) (request->query->ptr, reply);
-				rem_request(request);
-				return 1;
-			}
-
-			/*
-			 * Lookup the 'authoritative' name that we were given for the
-			 * ip#. 
-			 *
-			 */
-			if(request->addr.ss_family == AF_INET6)
-				gethost_byname_type(request->name, request->query, T_AAAA);
-			else
-				gethost_byname_type(request->name, request->query, T_A);
-			rem_request(request);
-		}
-		else
-		{
-			/*
-			 * got a name and address response, client resolved
-			 */
-			reply = make_dnsreply(request);
-			(*request->query->callback) (request->query->ptr, reply);
-			rb_free(reply);
-			rem_request(request);
-		}
+		/*
+		 * got a name and address response, client resolved, or
+		 * the name for a PTR, which res_finish() looks up the
+		 * 'authoritative' address for.
+		 */
+		res_cache_add(request, NO, request->ttl < AR_TTL ? request->ttl : AR_TTL);
+		res_finish(request, YES);
 	}
 	else
 	{
 		/* couldn't decode, give up -- jilles */
-		(*request->query->callback) (request->query->ptr, NULL);
-		rem_request(request);
+		res_finish(request, NO);
 	}
 	return 1;
 }
 
+/* Sparc and alpha need 16bit-alignment for accessing header->id 
+ * (which is uint16_t). Because of the header = (HEADER*) buf; 
+ * lateron, this is neeeded. --FaUl
+ */
+typedef char res_packet[sizeof(HEADER) + MAXPACKET]
+#if defined(__sparc__) || defined(__alpha__)
+	__attribute__ ((aligned(16)))
+#endif
+	;
+
+/*
+ * res_read_single_reply - read a dns reply from the nameserver and process it.
+ * Return value: 1 if a packet was read, 0 otherwise
+ */
+static int
+res_read_single_reply(rb_fde_t * F, void *data)
+{
+	res_packet buf;
+	int rc;
+	socklen_t len = sizeof(struct rb_sockaddr_storage);
+	struct rb_sockaddr_storage lsin;
+
+	rc = recvfrom(rb_get_fd(F), buf, sizeof(buf), 0, (struct sockaddr *) &lsin, &len);
+
+	/* No packet */
+	if(rc == 0 || rc == -1)
+		return 0;
+
+	return res_process_reply(buf, rc, &lsin);
+}
+
+#ifdef MSG_WAITFORONE
+/*
+ * res_read_batch - read up to AR_RECV_BATCH replies in one system call
+ * Return value: number of packets read, -1 if recvmmsg() isn't there
+ */
+static int
+res_read_batch(rb_fde_t * F)
+{
+	static res_packet bufs[AR_RECV_BATCH];
+	static struct rb_sockaddr_storage from[AR_RECV_BATCH];
+	struct mmsghdr msgs[AR_RECV_BATCH];
+	struct iovec iov[AR_RECV_BATCH];
+	int i, n;
+
+	for(i = 0; i < AR_RECV_BATCH; i++)
+	{
+		iov[i].iov_base = bufs[i];
+		iov[i].iov_len = sizeof(bufs[i]);
+		memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+		msgs[i].msg_hdr.msg_name = &from[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof(from[i]);
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	n = recvmmsg(rb_get_fd(F), msgs, AR_RECV_BATCH, MSG_DONTWAIT, NULL);
+
+	if(n == -1)
+		return (errno == ENOSYS) ? -1 : 0;
+
+	for(i = 0; i < n; i++)
+	{
+		if(msgs[i].msg_len > 0)
+			res_process_reply(bufs[i], msgs[i].msg_len, &from[i]);
+	}
+
+	return n;
+}
+#endif
+
 static void
 res_readreply(rb_fde_t * F, void *data)
 {
-	while(res_read_single_reply(F, data))
+#ifdef MSG_WAITFORONE
+	static bool no_recvmmsg = NO;
+	int n = 0;
+
+	while(!no_recvmmsg && (n = res_read_batch(F)) == AR_RECV_BATCH)
 		;
-	rb_setselect(F, RB_SELECT_READ, res_readreply, NULL);
-}
 
-static struct DNSReply *
-make_dnsreply(struct reslist *request)
-{
-	struct DNSReply *cp;
-	s_assert(request != 0);
+	if(n == -1)
+		no_recvmmsg = YES;
 
-	cp = (struct DNSReply *) rb_malloc(sizeof(struct DNSReply));
+	if(no_recvmmsg)
+#endif
+		while(res_read_single_reply(F, data))
+			;
 
-	cp->h_name = request->name;
-	memcpy(&cp->addr, &request->addr, sizeof(cp->addr));
-	return (cp);
+	rb_setselect(F, RB_SELECT_READ, res_readreply, NULL);
 }
 
 void
@@ -900,4 +1341,9 @@ report_dns_servers(struct Client *source_p)
 		sendto_one_numeric(source_p, RPL_STATSDEBUG, "A %s %d", ipaddr,
 				   ns_timeout_count[i]);
 	}
+
+	sendto_one_numeric(source_p, RPL_STATSDEBUG,
+			   "A cache: %lu entries, %lu hits, %lu negative hits, %lu misses, %lu coalesced",
+			   rb_dlink_list_length(&cache_list), res_stats.hits,
+			   res_stats.negative_hits, res_stats.misses, res_stats.coalesced);
 }
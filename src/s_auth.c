@@ -48,6 +48,9 @@
 #include "send.h"
 #include "hook.h"
 #include "blacklist.h"
+#include "class.h"
+#include "hostmask.h"
+#include "intern.h"
 
 struct AuthRequest
 {
@@ -56,7 +59,9 @@ struct AuthRequest
 	struct DNSQuery dns_query;	/* DNS Query */
 	unsigned int flags;	/* current state of request */
 	rb_fde_t *F;		/* file descriptor for auth queries */
+	time_t started;		/* time the client connected */
 	time_t timeout;		/* time when query expires */
+	time_t deadline;	/* wheel slot we are queued on */
 	uint16_t lport;
 	uint16_t rport;
 };
@@ -78,7 +83,7 @@ struct AuthRequest
 #define IsAuthConnect(x)     ((x)->flags &  AM_AUTH_CONNECTING)
 
 #define SetAuthPending(x)    ((x)->flags |= AM_AUTH_PENDING)
-#define ClearAuthPending(x)  ((x)->flags &= AM_AUTH_PENDING)
+#define ClearAuthPending(x)  ((x)->flags &= ~AM_AUTH_PENDING)
 #define IsAuthPending(x)     ((x)->flags &  AM_AUTH_PENDING)
 
 #define ClearAuth(x)         ((x)->flags &= ~(AM_AUTH_PENDING | AM_AUTH_CONNECTING))
@@ -117,12 +122,39 @@ ReportType;
 
 #define sendheader(c, r) sendto_one_notice(c, HeaderMessages[(r)])
 
-static rb_dlink_list auth_poll_list;
+/*
+ * pending requests are kept on a timer wheel indexed by the second at
+ * which they next need attention (connect_timeout, or the class ident
+ * budget), so the timeout event only ever looks at requests that are due.
+ */
+#define AUTH_WHEEL	64	/* must be a power of two */
+#define AUTH_SLOT(t)	(&auth_wheel[(t) & (AUTH_WHEEL - 1)])
+
+static rb_dlink_list auth_wheel[AUTH_WHEEL];
+static time_t auth_lastrun;
 static rb_bh *auth_heap;
 static EVH timeout_auth_queries_event;
 
+/*
+ * addresses whose identd did not answer at all (refused, or timed out)
+ * are remembered for a while so reconnects from them skip straight to
+ * registration instead of waiting on port 113 again.
+ */
+#define IDENT_FAIL_CACHE_TIME	300
+
+struct ident_fail
+{
+	rb_dlink_node node;
+	time_t expires;
+};
+
+static rb_patricia_tree_t *ident_fail_tree;
+static rb_dlink_list ident_fail_list;
+static EVH ident_fail_expires;
+
 static PF read_auth_reply;
 static CNCB auth_connect_callback;
+static void auth_ident_budget(struct AuthRequest *);
 
 /*
  * init_auth()
@@ -132,10 +164,91 @@ static CNCB auth_connect_callback;
 void
 init_auth(void)
 {
-	/* This hook takes a struct Client for its argument */
-	memset(&auth_poll_list, 0, sizeof(auth_poll_list));
+	memset(auth_wheel, 0, sizeof(auth_wheel));
+	auth_lastrun = rb_current_time();
 	rb_event_addish("timeout_auth_queries_event", timeout_auth_queries_event, NULL, 1);
 	auth_heap = rb_bh_create(sizeof(struct AuthRequest), LCLIENT_HEAP_SIZE, "auth_heap");
+
+	ident_fail_tree = rb_new_patricia(PATRICIA_BITS);
+	rb_event_add("ident_fail_expires", ident_fail_expires, NULL, 60);
+}
+
+/*
+ * auth_schedule - (re)queue an auth request on the timer wheel
+ */
+static void
+auth_schedule(struct AuthRequest *auth, time_t deadline)
+{
+	if(deadline <= auth_lastrun)
+		deadline = auth_lastrun + 1;
+
+	rb_dlinkDelete(&auth->node, AUTH_SLOT(auth->deadline));
+	auth->deadline = deadline;
+	rb_dlinkAdd(auth, &auth->node, AUTH_SLOT(deadline));
+}
+
+static void
+ident_fail_expires(void *unused)
+{
+	rb_dlink_node *ptr, *next;
+	rb_patricia_node_t *pnode;
+	struct ident_fail *fail;
+
+	/* entries share a lifetime, so the list is in expiry order */
+	RB_DLINK_FOREACH_SAFE(ptr, next, ident_fail_list.head)
+	{
+		pnode = ptr->data;
+		fail = pnode->data;
+
+		if(fail->expires > rb_current_time())
+			break;
+
+		rb_dlinkDelete(ptr, &ident_fail_list);
+		rb_free(fail);
+		rb_patricia_remove(ident_fail_tree, pnode);
+	}
+}
+
+/*
+ * ident_fail_add - remember that the client's address had no identd
+ */
+static void
+ident_fail_add(struct Client *client)
+{
+	rb_patricia_node_t *pnode;
+	struct ident_fail *fail;
+	int bitlen = 32;
+
+	if((pnode = rb_match_ip(ident_fail_tree, (struct sockaddr *) &client->localClient->ip)) != NULL)
+	{
+		fail = pnode->data;
+		rb_dlinkDelete(&fail->node, &ident_fail_list);
+	}
+	else
+	{
+		if(GET_SS_FAMILY(&client->localClient->ip) == AF_INET6)
+			bitlen = 128;
+		pnode = make_and_lookup_ip(ident_fail_tree,
+					   (struct sockaddr *) &client->localClient->ip, bitlen);
+		pnode->data = fail = rb_malloc(sizeof(struct ident_fail));
+	}
+
+	fail->expires = rb_current_time() + IDENT_FAIL_CACHE_TIME;
+	rb_dlinkAddTail(pnode, &fail->node, &ident_fail_list);
+}
+
+static int
+ident_fail_cached(struct Client *client)
+{
+	rb_patricia_node_t *pnode;
+	struct ident_fail *fail;
+
+	pnode = rb_match_ip(ident_fail_tree, (struct sockaddr *) &client->localClient->ip);
+	if(pnode == NULL)
+		return 0;
+
+	fail = pnode->data;
+	return fail->expires > rb_current_time();
 }
 
 /*
@@ -148,7 +261,13 @@ make_auth_request(struct Client *client)
 	client->localClient->auth_request = request;
 	request->F = NULL;
 	request->client = client;
-	request->timeout = rb_current_time() + ConfigFileEntry.connect_timeout;
+	request->started = rb_current_time();
+	request->timeout = request->started + ConfigFileEntry.connect_timeout;
+
+	request->deadline = request->timeout;
+	if(request->deadline <= auth_lastrun)
+		request->deadline = auth_lastrun + 1;
+	rb_dlinkAdd(request, &request->node, AUTH_SLOT(request->deadline));
 	return request;
 }
 
@@ -175,7 +294,7 @@ release_auth_client(struct AuthRequest *auth)
 		return;
 
 	client->localClient->auth_request = NULL;
-	rb_dlinkDelete(&auth->node, &auth_poll_list);
+	rb_dlinkDelete(&auth->node, AUTH_SLOT(auth->deadline));
 	free_auth_request(auth);
 
 	/*
@@ -208,7 +327,7 @@ auth_dns_callback(void *vptr, struct DNSReply *reply)
 				       "auth_dns_callback(): auth->client->localClient (%s) is NULL",
 				       get_client_name(auth->client, HIDE_IP));
 
-		rb_dlinkDelete(&auth->node, &auth_poll_list);
+		rb_dlinkDelete(&auth->node, AUTH_SLOT(auth->deadline));
 		free_auth_request(auth);
 
 		/* and they will silently drop through and all will hopefully be ok... -nenolod */
@@ -253,7 +372,7 @@ auth_dns_callback(void *vptr, struct DNSReply *reply)
 
 		if(good && strlen(reply->h_name) <= HOSTLEN)
 		{
-			rb_strlcpy(auth->client->host, reply->h_name, sizeof(auth->client->host));
+			intern_set(&auth->client->host, reply->h_name, HOSTLEN);
 			sendheader(auth->client, REPORT_FIN_DNS);
 		}
 		else if(strlen(reply->h_name) > HOSTLEN)
@@ -262,26 +381,72 @@ auth_dns_callback(void *vptr, struct DNSReply *reply)
 	else
 		sendheader(auth->client, REPORT_FAIL_DNS);
 
+	auth_ident_budget(auth);
 	release_auth_client(auth);
 }
 
 /*
- * authsenderr - handle auth send errors
+ * auth_abandon - give up on the ident query without releasing the client
  */
 static void
-auth_error(struct AuthRequest *auth)
+auth_abandon(struct AuthRequest *auth)
 {
 	++ServerStats.is_abad;
 
-	rb_close(auth->F);
-	auth->F = NULL;
+	if(auth->F != NULL)
+	{
+		rb_close(auth->F);
+		auth->F = NULL;
+	}
 
 	ClearAuth(auth);
 	sendheader(auth->client, REPORT_FAIL_ID);
+}
 
+/*
+ * authsenderr - handle auth send errors
+ */
+static void
+auth_error(struct AuthRequest *auth)
+{
+	auth_abandon(auth);
 	release_auth_client(auth);
 }
 
+/*
+ * auth_ident_budget - called once dns is done.  if the class this
+ * client would land in has an ident budget, stop waiting on identd
+ * when it is spent rather than holding the client until connect_timeout.
+ */
+static void
+auth_ident_budget(struct AuthRequest *auth)
+{
+	struct Client *client = auth->client;
+	struct ConfItem *aconf;
+	time_t deadline;
+
+	if(!IsDoingAuth(auth))
+		return;
+
+	/* neither the username nor an auth_user is known yet, so this
+	 * only finds auth blocks that would take the client without them
+	 */
+	aconf = find_conf_by_address(client->host, client->sockhost, NULL,
+				     (struct sockaddr *) &client->localClient->ip,
+				     CONF_CLIENT, client->localClient->ip.ss_family,
+				     NULL, NULL);
+
+	if(aconf == NULL || ClassPtr(aconf) == NULL || ConfIdentBudget(aconf) <= 0)
+		return;
+
+	deadline = auth->started + ConfIdentBudget(aconf);
+
+	if(deadline <= rb_current_time())
+		auth_abandon(auth);
+	else if(deadline < auth->deadline)
+		auth_schedule(auth, deadline);
+}
+
 /*
  * start_auth_query - Flag the client to show that an attempt to 
  * contact the ident server on
@@ -444,15 +609,20 @@ start_auth(struct Client *client)
 
 	sendheader(client, REPORT_DO_DNS);
 
-	/* No DNS cache now, remember? -- adrian */
 	gethost_byaddr(&client->localClient->ip, &auth->dns_query);
 
 	SetDNSPending(auth);
 
 	if(ConfigFileEntry.disable_auth == 0)
-		start_auth_query(auth);
-
-	rb_dlinkAdd(auth, &auth->node, &auth_poll_list);
+	{
+		if(ident_fail_cached(client))
+		{
+			++ServerStats.is_abad;
+			sendheader(client, REPORT_FAIL_ID);
+		}
+		else
+			start_auth_query(auth);
+	}
 }
 
 /*
@@ -465,22 +635,38 @@ timeout_auth_queries_event(void *notused)
 	rb_dlink_node *ptr;
 	rb_dlink_node *next_ptr;
 	struct AuthRequest *auth;
+	time_t now = rb_current_time();
+	time_t t;
 
-	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, auth_poll_list.head)
-	{
-		auth = ptr->data;
+	/* a whole lap covers every slot */
+	if(now - auth_lastrun > AUTH_WHEEL)
+		auth_lastrun = now - AUTH_WHEEL;
 
-		if(auth->timeout < rb_current_time())
+	for(t = auth_lastrun + 1; t <= now; t++)
+	{
+		RB_DLINK_FOREACH_SAFE(ptr, next_ptr, AUTH_SLOT(t)->head)
 		{
-			if(auth->F != NULL)
-				rb_close(auth->F);
+			auth = ptr->data;
+
+			/* due on a later lap */
+			if(auth->deadline > now)
+				continue;
+
+			if(auth->timeout > now)
+			{
+				/* class ident budget spent, dns already done */
+				auth_schedule(auth, auth->timeout);
+				if(IsDoingAuth(auth))
+					auth_abandon(auth);
+				release_auth_client(auth);
+				continue;
+			}
 
 			if(IsDoingAuth(auth))
 			{
-				ClearAuth(auth);
-				++ServerStats.is_abad;
-				sendheader(auth->client, REPORT_FAIL_ID);
-				auth->client->localClient->auth_request = NULL;
+				/* identd never answered at all */
+				ident_fail_add(auth->client);
+				auth_abandon(auth);
 			}
 			if(IsDNSPending(auth))
 			{
@@ -493,6 +679,8 @@ timeout_auth_queries_event(void *notused)
 			release_auth_client(auth);
 		}
 	}
+
+	auth_lastrun = now;
 }
 
 /*
@@ -515,6 +703,10 @@ auth_connect_callback(rb_fde_t * F, int error, void *data)
 	/* Check the error */
 	if(error != RB_OK)
 	{
+		/* nothing listening on 113, don't bother next time */
+		if(error == RB_ERR_CONNECT || error == RB_ERR_TIMEOUT)
+			ident_fail_add(auth->client);
+
 		/* We had an error during connection :( */
 		auth_error(auth);
 		return;
@@ -629,6 +821,6 @@ delete_auth_queries(struct Client *target_p)
 	if(auth->F != NULL)
 		rb_close(auth->F);
 
-	rb_dlinkDelete(&auth->node, &auth_poll_list);
+	rb_dlinkDelete(&auth->node, AUTH_SLOT(auth->deadline));
 	free_auth_request(auth);
 }
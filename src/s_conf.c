@@ -54,6 +54,7 @@
 #include "chmode.h"
 #include "supported.h"
 #include "parse.h"
+#include "intern.h"
 
 struct config_server_hide ConfigServerHide;
 
@@ -379,12 +380,11 @@ verify_access(struct Client *client_p, const char *username)
 
 				rb_strlcpy(client_p->username, aconf->info.name,
 					   sizeof(client_p->username));
-				rb_strlcpy(client_p->host, host, sizeof(client_p->host));
+				intern_set(&client_p->host, host, HOSTLEN);
 				*p = '@';
 			}
 			else
-				rb_strlcpy(client_p->host, aconf->info.name,
-					   sizeof(client_p->host));
+				intern_set(&client_p->host, aconf->info.name, HOSTLEN);
 		}
 		return (attach_iline(client_p, aconf));
 	}
@@ -407,46 +407,42 @@ verify_access(struct Client *client_p, const char *username)
  * Returns 1 if successful 0 if not
  *
  * This checks if the user has exceed the limits for their class
- * unless of course they are exempt..
+ * unless of course they are exempt..  Every subnet size the class
+ * limits is checked before the client is counted at any of them.
  */
 
 static int
 add_ip_limit(struct Client *client_p, struct ConfItem *aconf)
 {
-	rb_patricia_node_t *pnode;
-	int bitlen;
+	rb_patricia_node_t *pnode[CIDR_LEVELS];
+	struct sockaddr *addr = (struct sockaddr *) &client_p->localClient->ip;
+	struct cidr_limit *limits;
+	int levels, i;
+
+	limits = get_cidr_limits(ClassPtr(aconf), GET_SS_FAMILY(addr), &levels);
 
 	/* If the limits are 0 don't do anything.. */
-	if(ConfCidrAmount(aconf) == 0 ||
-	   (ConfCidrIpv4Bitlen(aconf) == 0 && ConfCidrIpv6Bitlen(aconf) == 0))
+	if(levels == 0)
 		return -1;
 
-	pnode = rb_match_ip(ConfIpLimits(aconf), (struct sockaddr *) &client_p->localClient->ip);
-
-	if(GET_SS_FAMILY(&client_p->localClient->ip) == AF_INET)
-		bitlen = ConfCidrIpv4Bitlen(aconf);
-	else
-		bitlen = ConfCidrIpv6Bitlen(aconf);
-
-	if(pnode == NULL)
-		pnode = make_and_lookup_ip(ConfIpLimits(aconf),
-					   (struct sockaddr *) &client_p->localClient->ip, bitlen);
+	for(i = 0; i < levels; i++)
+	{
+		pnode[i] = rb_match_ip_exact(ConfIpLimits(aconf), addr, limits[i].bitlen);
 
-	s_assert(pnode != NULL);
+		if(pnode[i] != NULL && ((intptr_t) pnode[i]->data) >= limits[i].amount &&
+		   !IsConfExemptLimits(aconf))
+			return (0);
+	}
 
-	if(pnode != NULL)
+	for(i = 0; i < levels; i++)
 	{
-		if(((intptr_t) pnode->data) >= ConfCidrAmount(aconf) && !IsConfExemptLimits(aconf))
-		{
-			/* This should only happen if the limits are set to 0 */
-			if((intptr_t) pnode->data == 0)
-			{
-				rb_patricia_remove(ConfIpLimits(aconf), pnode);
-			}
-			return (0);
-		}
+		if(pnode[i] == NULL)
+			pnode[i] = make_and_lookup_ip(ConfIpLimits(aconf), addr, limits[i].bitlen);
+
+		s_assert(pnode[i] != NULL);
 
-		pnode->data = (void *) (((intptr_t) pnode->data) + 1);
+		if(pnode[i] != NULL)
+			pnode[i]->data = (void *) (((intptr_t) pnode[i]->data) + 1);
 	}
 	return 1;
 }
@@ -455,22 +451,24 @@ static void
 remove_ip_limit(struct Client *client_p, struct ConfItem *aconf)
 {
 	rb_patricia_node_t *pnode;
+	struct sockaddr *addr = (struct sockaddr *) &client_p->localClient->ip;
+	struct cidr_limit *limits;
+	int levels, i;
 
-	/* If the limits are 0 don't do anything.. */
-	if(ConfCidrAmount(aconf) == 0 ||
-	   (ConfCidrIpv4Bitlen(aconf) == 0 && ConfCidrIpv6Bitlen(aconf) == 0))
-		return;
-
-	pnode = rb_match_ip(ConfIpLimits(aconf), (struct sockaddr *) &client_p->localClient->ip);
-	if(pnode == NULL)
-		return;
+	limits = get_cidr_limits(ClassPtr(aconf), GET_SS_FAMILY(addr), &levels);
 
-	pnode->data = (void *) (((intptr_t) pnode->data) - 1);
-	if(((intptr_t) pnode->data) == 0)
+	for(i = 0; i < levels; i++)
 	{
-		rb_patricia_remove(ConfIpLimits(aconf), pnode);
-	}
+		pnode = rb_match_ip_exact(ConfIpLimits(aconf), addr, limits[i].bitlen);
+		if(pnode == NULL)
+			continue;
 
+		pnode->data = (void *) (((intptr_t) pnode->data) - 1);
+		if(((intptr_t) pnode->data) == 0)
+		{
+			rb_patricia_remove(ConfIpLimits(aconf), pnode);
+		}
+	}
 }
 
 /*
@@ -503,7 +501,9 @@ attach_iline(struct Client *client_p, struct ConfItem *aconf)
 	{
 		target_p = ptr->data;
 
-		if(irccmp(client_p->host, target_p->orighost) != 0)
+		/* interned, so the same pointer is the common case */
+		if(client_p->host != target_p->orighost &&
+		   irccmp(client_p->host, target_p->orighost) != 0)
 			continue;
 
 		if(MyConnect(target_p))
@@ -643,9 +643,9 @@ rehash(int sig)
 	read_conf_files(NO);
 
 	if(ServerInfo.description != NULL)
-		rb_strlcpy(me.info, ServerInfo.description, sizeof(me.info));
+		intern_set(&me.info, ServerInfo.description, REALLEN);
 	else
-		rb_strlcpy(me.info, "unknown", sizeof(me.info));
+		intern_set(&me.info, "unknown", REALLEN);
 
 	open_logfiles();
 
@@ -711,6 +711,7 @@ set_default_conf(void)
 	ConfigFileEntry.max_accept = 20;
 	ConfigFileEntry.max_monitor = 60;
 	ConfigFileEntry.nick_delay = 900;	/* 15 minutes */
+	ConfigFileEntry.netsplit_slice = 0;
 	ConfigFileEntry.target_change = YES;
 	ConfigFileEntry.anti_spam_exit_message_time = 0;
 	ConfigFileEntry.use_part_messages = YES;
@@ -754,6 +755,8 @@ set_default_conf(void)
 	ConfigFileEntry.egdpool_path = NULL;
 	ConfigFileEntry.use_whois_actually = YES;
 	ConfigFileEntry.burst_away = NO;
+	ConfigFileEntry.burst_cache = YES;
+	ConfigFileEntry.burst_cache_verify = NO;
 	ConfigFileEntry.collision_fnc = YES;
 	ConfigFileEntry.global_snotices = YES;
 	ConfigFileEntry.operspy_dont_care_user_info = NO;
@@ -814,6 +817,7 @@ set_default_conf(void)
 	ConfigFileEntry.reject_duration = 120;
 	ConfigFileEntry.throttle_count = 4;
 	ConfigFileEntry.throttle_duration = 60;
+	ConfigFileEntry.throttle_sketch = NO;
 
 	ConfigFileEntry.client_flood_max_lines = CLIENT_FLOOD_DEFAULT;
 	ConfigFileEntry.client_flood_burst_rate = 40;
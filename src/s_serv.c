@@ -55,6 +55,7 @@
 #include "msg.h"
 #include "reject.h"
 #include "sslproc.h"
+#include "intern.h"
 
 #ifndef INADDR_NONE
 #define INADDR_NONE ((unsigned int) 0xffffffff)
@@ -65,6 +66,7 @@ int MaxClientCount = 1;
 int refresh_user_links = 0;
 
 static char buf[BUFSIZE];
+static char digests[BUFSIZE - 100];
 
 /*
  * list of recognized server capabilities.  "TS" is not on the list
@@ -448,7 +450,29 @@ send_capabilities(struct Client *client_p, int cap_can_send)
 
 	build_capab_list(msgbuf, cap_can_send);
 
-	sendto_one(client_p, "CAPAB :%s", msgbuf);
+	/* not a capability, tells the remote how many users we will burst */
+	sendto_one(client_p, "CAPAB :%s USERS=%d", msgbuf, Count.total);
+}
+
+/*
+ * capab_users
+ *
+ * inputs	- CAPAB line a server sent
+ * output	- number of users it said it would burst, 0 if it did not
+ * side effects	-
+ */
+static unsigned long
+capab_users(const char *fullcaps)
+{
+	const char *s;
+
+	for(s = fullcaps; (s = strstr(s, "USERS=")) != NULL; s += 6)
+	{
+		if(s == fullcaps || s[-1] == ' ')
+			return strtoul(s + 6, NULL, 10);
+	}
+
+	return 0;
 }
 
 void
@@ -597,198 +621,771 @@ burst_modes_TS6(struct Client *client_p, struct Channel *chptr, rb_dlink_list *
 }
 
 /*
- * burst_TS6
- * 
- * inputs	- client (server) to send nick towards
- * 		- client to send nick for
+ * Serialized user introductions.
+ *
+ * Each user keeps the text burst_user() produced for it, one copy for
+ * each capability variant a link asked for, along with the fields it
+ * was built from.  Later bursts copy the text as long as those fields
+ * are unchanged, so introducing a user is mostly a memcpy.  Metadata
+ * and certfp changes drop the record through burst_record_clear();
+ * away messages are not part of it.
+ */
+#define BURST_VAR_EUID	0x1
+#define BURST_VAR_ENCAP	0x2
+#define BURST_VARIANTS	4
+
+struct burst_record
+{
+	unsigned long generation;
+	time_t tsinfo;
+	unsigned int umodes;
+	unsigned int spoof;
+	const char *host;		/* interned and referenced, compared by address */
+	const char *orighost;
+	const char *info;
+	char name[NICKLEN + 1];
+	char username[USERLEN + 1];
+	char suser[NICKLEN + 1];
+	char *text[BURST_VARIANTS];
+	unsigned short len[BURST_VARIANTS];
+};
+
+/* bumped whenever every record must be rebuilt, eg the umode table changed */
+unsigned long burst_generation;
+
+static size_t burst_records;
+static size_t burst_record_mem;
+static unsigned long burst_records_reused;
+static unsigned long burst_records_built;
+
+static char *burst_text;
+static size_t burst_text_size;
+static size_t burst_text_len;
+
+static void burst_text_add(const char *, ...) AFP(1, 2);
+
+static void
+burst_text_add(const char *pattern, ...)
+{
+	char line[BUFSIZE];
+	va_list args;
+	int len;
+
+	va_start(args, pattern);
+	len = rb_vsnprintf(line, sizeof(line) - 2, pattern, args);
+	va_end(args);
+
+	/* match the truncation sendto_one() would do */
+	if(len > (int) sizeof(line) - 3)
+		len = sizeof(line) - 3;
+	line[len++] = '\r';
+	line[len++] = '\n';
+
+	if(burst_text_len + len > burst_text_size)
+	{
+		burst_text_size = (burst_text_len + len) * 2;
+		burst_text = rb_realloc(burst_text, burst_text_size);
+	}
+
+	memcpy(burst_text + burst_text_len, line, len);
+	burst_text_len += len;
+}
+
+/*
+ * burst_user_text()
+ *
+ * inputs	- client to introduce, capability variant, whether to use
+ *		  its UID as its nick
  * output	- NONE
- * side effects	- NICK message is sent towards given client_p
+ * side effects	- the lines introducing target_p to a server of the
+ *		  given variant are left in burst_text
  */
 static void
-burst_TS6(struct Client *client_p)
+burst_user_text(struct Client *target_p, int variant, bool by_uid)
 {
+	const char *name = by_uid ? target_p->id : target_p->name;
+	long ts = by_uid ? SAVE_NICKTS : (long) target_p->tsinfo;
 	static char ubuf[12];
-	struct Client *target_p;
-	struct Channel *chptr;
-	struct membership *msptr;
+	struct Metadata *md;
+	struct rb_dictionaryIter iter;
+
+	burst_text_len = 0;
+
+	send_umode(NULL, target_p, 0, 0, ubuf);
+	if(!*ubuf)
+	{
+		ubuf[0] = '+';
+		ubuf[1] = '\0';
+	}
+
+	if(variant & BURST_VAR_EUID)
+		burst_text_add(":%s EUID %s %d %ld %s %s %s %s %s %s %s :%s",
+			   target_p->servptr->id, name,
+			   target_p->hopcount + 1, ts, ubuf,
+			   target_p->username, target_p->host,
+			   IsIPSpoof(target_p) ? "0" : target_p->sockhost,
+			   target_p->id, IsDynSpoof(target_p) ? target_p->orighost : "*",
+			   EmptyString(target_p->user->suser) ? "*" : target_p->user->suser,
+			   target_p->info);
+	else
+		burst_text_add(":%s UID %s %d %ld %s %s %s %s %s :%s",
+			   target_p->servptr->id, name,
+			   target_p->hopcount + 1, ts, ubuf, target_p->username,
+			   target_p->host, IsIPSpoof(target_p) ? "0" : target_p->sockhost,
+			   target_p->id, target_p->info);
+
+	if(!(variant & BURST_VAR_ENCAP))
+		return;
+
+	if(!EmptyString(target_p->certfp))
+		burst_text_add(":%s ENCAP * CERTFP :%s", use_id(target_p),
+			   target_p->certfp);
+
+	if(!(variant & BURST_VAR_EUID))
+	{
+		if(IsDynSpoof(target_p))
+			burst_text_add(":%s ENCAP * REALHOST %s", use_id(target_p),
+				   target_p->orighost);
+		if(!EmptyString(target_p->user->suser))
+			burst_text_add(":%s ENCAP * LOGIN %s", use_id(target_p),
+				   target_p->user->suser);
+	}
+
+	RB_DICTIONARY_FOREACH(md, &iter, target_p->user->metadata)
+	{
+		burst_text_add(":%s ENCAP * METADATA ADD %s %s :%s",
+			   use_id(&me), use_id(target_p), md->name, md->value);
+	}
+}
+
+static unsigned int
+burst_record_spoof(struct Client *target_p)
+{
+	return (IsDynSpoof(target_p) ? 1 : 0) | (IsIPSpoof(target_p) ? 2 : 0);
+}
+
+/*
+ * burst_record_current()
+ *
+ * inputs	- record, the client it belongs to
+ * output	- YES if the record still describes the client
+ * side effects	- NONE
+ */
+static bool
+burst_record_current(struct burst_record *rec, struct Client *target_p)
+{
+	return rec->generation == burst_generation &&
+		rec->tsinfo == target_p->tsinfo &&
+		rec->umodes == target_p->umodes &&
+		rec->spoof == burst_record_spoof(target_p) &&
+		rec->host == target_p->host &&
+		rec->orighost == target_p->orighost &&
+		rec->info == target_p->info &&
+		!strcmp(rec->name, target_p->name) &&
+		!strcmp(rec->username, target_p->username) &&
+		!strcmp(rec->suser, target_p->user->suser);
+}
+
+static void
+burst_record_reset(struct burst_record *rec)
+{
+	int i;
+
+	/* the references keep these addresses from being reused for
+	 * another string while the record compares against them
+	 */
+	intern_del(rec->host);
+	intern_del(rec->orighost);
+	intern_del(rec->info);
+	rec->host = rec->orighost = rec->info = NULL;
+
+	for(i = 0; i < BURST_VARIANTS; i++)
+	{
+		if(rec->text[i] == NULL)
+			continue;
+
+		burst_record_mem -= rec->len[i];
+		rb_free(rec->text[i]);
+		rec->text[i] = NULL;
+		rec->len[i] = 0;
+	}
+}
+
+/*
+ * burst_record_clear()
+ *
+ * inputs	- client whose state changed
+ * output	- NONE
+ * side effects	- its serialized introductions are dropped, the next
+ *		  burst rebuilds them
+ */
+void
+burst_record_clear(struct Client *target_p)
+{
+	if(target_p->user != NULL && target_p->user->burst != NULL)
+		burst_record_reset(target_p->user->burst);
+}
+
+void
+burst_record_free(struct User *user)
+{
+	if(user->burst == NULL)
+		return;
+
+	burst_record_reset(user->burst);
+	rb_free(user->burst);
+	user->burst = NULL;
+	burst_records--;
+	burst_record_mem -= sizeof(struct burst_record);
+}
+
+void
+count_burst_records(size_t *count, size_t *mem, unsigned long *reused,
+		    unsigned long *built)
+{
+	*count = burst_records;
+	*mem = burst_record_mem;
+	*reused = burst_records_reused;
+	*built = burst_records_built;
+}
+
+/*
+ * burst_user_record()
+ *
+ * inputs	- client to introduce, capability variant
+ * output	- the record holding the lines for that variant, NULL if
+ *		  they were left in burst_text instead
+ * side effects	- the record is created or brought up to date
+ */
+static struct burst_record *
+burst_user_record(struct Client *target_p, int variant)
+{
+	struct burst_record *rec = target_p->user->burst;
+
+	if(!ConfigFileEntry.burst_cache)
+	{
+		burst_record_free(target_p->user);
+		burst_user_text(target_p, variant, NO);
+		return NULL;
+	}
+
+	if(rec == NULL)
+	{
+		rec = target_p->user->burst = rb_malloc(sizeof(struct burst_record));
+		burst_records++;
+		burst_record_mem += sizeof(struct burst_record);
+	}
+	else if(!burst_record_current(rec, target_p))
+		burst_record_reset(rec);
+	else if(rec->text[variant] != NULL)
+	{
+		burst_records_reused++;
+
+		if(!ConfigFileEntry.burst_cache_verify)
+			return rec;
+
+		burst_user_text(target_p, variant, NO);
+		if(burst_text_len == rec->len[variant] &&
+		   !memcmp(burst_text, rec->text[variant], burst_text_len))
+			return rec;
+
+		sendto_realops_snomask(SNO_DEBUG, L_ALL,
+				       "Stale burst record for %s (variant %d), rebuilding",
+				       target_p->name, variant);
+		ilog(L_MAIN, "Stale burst record for %s (variant %d): %.*s",
+		     target_p->name, variant, (int) rec->len[variant],
+		     rec->text[variant]);
+		burst_record_reset(rec);
+	}
+
+	/* a record that is still current only lacks this variant */
+	if(rec->host == NULL)
+	{
+		rec->generation = burst_generation;
+		rec->tsinfo = target_p->tsinfo;
+		rec->umodes = target_p->umodes;
+		rec->spoof = burst_record_spoof(target_p);
+		rec->host = intern_add(target_p->host, strlen(target_p->host));
+		rec->orighost = intern_add(target_p->orighost, strlen(target_p->orighost));
+		rec->info = intern_add(target_p->info, strlen(target_p->info));
+		rb_strlcpy(rec->name, target_p->name, sizeof(rec->name));
+		rb_strlcpy(rec->username, target_p->username, sizeof(rec->username));
+		rb_strlcpy(rec->suser, target_p->user->suser, sizeof(rec->suser));
+	}
+
+	burst_user_text(target_p, variant, NO);
+
+	/* too long to keep, send it as built */
+	if(burst_text_len > USHRT_MAX)
+		return NULL;
+
+	rec->text[variant] = rb_malloc(burst_text_len);
+	memcpy(rec->text[variant], burst_text, burst_text_len);
+	rec->len[variant] = burst_text_len;
+	burst_record_mem += burst_text_len;
+	burst_records_built++;
+
+	return rec;
+}
+
+/*
+ * burst_user()
+ *
+ * inputs	- server to burst to, client to introduce
+ * output	- NONE
+ * side effects	- the client and its state are sent to client_p
+ */
+static void
+burst_user(struct Client *client_p, struct Client *target_p)
+{
+	struct rb_dictionary *freed = client_p->localClient->burst->freed;
 	hook_data_client hclientinfo;
+	struct burst_record *rec;
+	int variant = 0;
+
+	if(IsCapable(client_p, CAP_EUID))
+		variant |= BURST_VAR_EUID;
+	if(IsCapable(client_p, CAP_ENCAP))
+		variant |= BURST_VAR_ENCAP;
+
+	if(freed != NULL && rb_dictionary_find(freed, target_p->name) != NULL)
+	{
+		/* target_p took this nick during the burst, so the remote may
+		 * still have it on another user until the held traffic
+		 * arrives.  Introduce target_p under its UID, as a saved user
+		 * would be; the held NICK that gave it the nick renames it.
+		 */
+		burst_user_text(target_p, variant, YES);
+		sendto_one_buffer(client_p, burst_text, burst_text_len);
+	}
+	else if((rec = burst_user_record(target_p, variant)) != NULL)
+		sendto_one_buffer(client_p, rec->text[variant], rec->len[variant]);
+	else
+		sendto_one_buffer(client_p, burst_text, burst_text_len);
+
+	if(ConfigFileEntry.burst_away && !EmptyString(target_p->user->away))
+		sendto_one(client_p, ":%s AWAY :%s", use_id(target_p),
+			   target_p->user->away);
+
+	hclientinfo.client = client_p;
+	hclientinfo.target = target_p;
+	call_hook(h_burst_client, &hclientinfo);
+}
+
+/* lists shorter than this are sent whole, a digest would save nothing */
+#define BURST_DIGEST_MIN	4
+
+/*
+ * burst_mask_list()
+ *
+ * inputs	- server to burst to, channel, list and its mode letter,
+ *		  end of the digests so far, salt for them
+ * output	- new end of the digests
+ * side effects	- the list is sent with BMASK, or its digest added for
+ *		  BDIG, in which case the remote asks for it with BREQ if
+ *		  its own list differs
+ */
+static char *
+burst_mask_list(struct Client *client_p, struct Channel *chptr, rb_dlink_list *list,
+		char flag, char *d, uint64_t salt)
+{
+	if(rb_dlink_list_length(list) == 0)
+		return d;
+
+	if(IsCapable(client_p, CAP_BDIG) && rb_dlink_list_length(list) >= BURST_DIGEST_MIN &&
+	   d + 19 < digests + sizeof(digests))
+		return d + rb_sprintf(d, "%c%016llx ", flag,
+				      (unsigned long long) channel_list_digest(list, salt));
+
+	burst_modes_TS6(client_p, chptr, list, flag);
+	return d;
+}
+
+/*
+ * burst_channel()
+ *
+ * inputs	- server to burst to, channel to send, clients introduced
+ *		  after this mark are left out, salt for list digests
+ * output	- NONE
+ * side effects	- the channel, its members and its modes are sent to client_p
+ */
+static void
+burst_channel(struct Client *client_p, struct Channel *chptr, unsigned long mark,
+	      uint64_t salt)
+{
+	struct membership *msptr;
 	hook_data_channel hchaninfo;
-	rb_dlink_node *ptr;
 	rb_dlink_node *uptr;
 	char *t;
 	int tlen, mlen;
 	int cur_len = 0;
+	int members = 0;
 	int i;
 	struct Metadata *md;
 	struct rb_dictionaryIter iter;
+	char *d = digests;
 
-	hclientinfo.client = hchaninfo.client = client_p;
+	cur_len = mlen =
+		rb_sprintf(buf, ":%s SJOIN %ld %s %s :", me.id, (long) chptr->channelts,
+			   chptr->chname, channel_modes(chptr, client_p));
 
-	RB_DLINK_FOREACH(ptr, global_client_list.head)
+	t = buf + mlen;
+
+	RB_DLINK_FOREACH(uptr, chptr->members.head)
 	{
-		target_p = ptr->data;
+		msptr = uptr->data;
 
-		if(!IsPerson(target_p))
+		/* introduced while we were bursting, the held JOIN covers it */
+		if(msptr->client_p->introduced > mark)
 			continue;
 
-		send_umode(NULL, target_p, 0, 0, ubuf);
-		if(!*ubuf)
+		tlen = strlen(use_id(msptr->client_p)) + 1;
+		if(is_founder(msptr))
+			tlen++;
+		if(is_admin(msptr))
+			tlen++;
+		if(is_chanop(msptr))
+			tlen++;
+		if(is_halfop(msptr))
+			tlen++;
+		if(is_voiced(msptr))
+			tlen++;
+
+		if(cur_len + tlen >= BUFSIZE - 3)
 		{
-			ubuf[0] = '+';
-			ubuf[1] = '\0';
+			*(t - 1) = '\0';
+			sendto_one(client_p, "%s", buf);
+			cur_len = mlen;
+			t = buf + mlen;
 		}
 
-		if(IsCapable(client_p, CAP_EUID))
-			sendto_one(client_p, ":%s EUID %s %d %ld %s %s %s %s %s %s %s :%s",
-				   target_p->servptr->id, target_p->name,
-				   target_p->hopcount + 1,
-				   (long) target_p->tsinfo, ubuf,
-				   target_p->username, target_p->host,
-				   IsIPSpoof(target_p) ? "0" : target_p->sockhost,
-				   target_p->id, IsDynSpoof(target_p) ? target_p->orighost : "*",
-				   EmptyString(target_p->user->suser) ? "*" : target_p->user->suser,
-				   target_p->info);
-		else
-			sendto_one(client_p, ":%s UID %s %d %ld %s %s %s %s %s :%s",
-				   target_p->servptr->id, target_p->name,
-				   target_p->hopcount + 1,
-				   (long) target_p->tsinfo, ubuf, target_p->username,
-				   target_p->host, IsIPSpoof(target_p) ? "0" : target_p->sockhost,
-				   target_p->id, target_p->info);
-
-		if(!EmptyString(target_p->certfp) && IsCapable(client_p, CAP_ENCAP))
-			sendto_one(client_p, ":%s ENCAP * CERTFP :%s", use_id(target_p),
-				   target_p->certfp);
-
-		if(!IsCapable(client_p, CAP_EUID) && IsCapable(client_p, CAP_ENCAP))
-		{
-			if(IsDynSpoof(target_p))
-				sendto_one(client_p, ":%s ENCAP * REALHOST %s", use_id(target_p),
-					   target_p->orighost);
-			if(!EmptyString(target_p->user->suser))
-				sendto_one(client_p, ":%s ENCAP * LOGIN %s", use_id(target_p),
-					   target_p->user->suser);
-		}
+		rb_sprintf(t, "%s%s ", find_channel_status(msptr, 1),
+			   use_id(msptr->client_p));
 
-		RB_DICTIONARY_FOREACH(md, &iter, target_p->user->metadata)
-		{
-			if(IsCapable(client_p, CAP_ENCAP))
-				sendto_one(client_p, ":%s ENCAP * METADATA ADD %s %s :%s",
-					   use_id(&me), use_id(target_p), md->name, md->value);
-		}
+		cur_len += tlen;
+		t += tlen;
+		members++;
+	}
 
-		if(ConfigFileEntry.burst_away && !EmptyString(target_p->user->away))
-			sendto_one(client_p, ":%s AWAY :%s", use_id(target_p),
-				   target_p->user->away);
+	if(members > 0)
+	{
+		/* remove trailing space */
+		*(t - 1) = '\0';
+	}
+	sendto_one(client_p, "%s", buf);
 
-		hclientinfo.target = target_p;
-		call_hook(h_burst_client, &hclientinfo);
+	RB_DICTIONARY_FOREACH(md, &iter, chptr->metadata)
+	{
+		/* don't bother bursting +J metadata */
+		if(!(md->name[0] == 'K'))
+			sendto_one(client_p, ":%s ENCAP * METADATA ADD %s %s :%s",
+				   use_id(&me), chptr->chname, md->name, md->value);
 	}
 
-	RB_DLINK_FOREACH(ptr, global_channel_list.head)
+	d = burst_mask_list(client_p, chptr, &chptr->banlist, 'b', d, salt);
+
+	if(IsCapable(client_p, CAP_EX))
+		d = burst_mask_list(client_p, chptr, &chptr->exceptlist, 'e', d, salt);
+
+	if(IsCapable(client_p, CAP_IE))
+		d = burst_mask_list(client_p, chptr, &chptr->invexlist, 'I', d, salt);
+
+	d = burst_mask_list(client_p, chptr, &chptr->quietlist, 'q', d, salt);
+
+	/* Burst the rest. --Elizabeth */
+	for(i = 0; i < 128; i++)
 	{
-		chptr = ptr->data;
+		struct list_mode *mode = listmodes[i];
 
-		if(*chptr->chname != '#')
+		if (!mode)
 			continue;
 
-		cur_len = mlen =
-			rb_sprintf(buf, ":%s SJOIN %ld %s %s :", me.id, (long) chptr->channelts,
-				   chptr->chname, channel_modes(chptr, client_p));
+		d = burst_mask_list(client_p, chptr, get_channel_list(chptr, mode->c), mode->c, d, salt);
+	}
 
-		t = buf + mlen;
+	if(d != digests)
+	{
+		*(d - 1) = '\0';
+		sendto_one(client_p, ":%s BDIG %ld %s %016llx :%s",
+			   me.id, (long) chptr->channelts, chptr->chname,
+			   (unsigned long long) salt, digests);
+	}
 
-		RB_DLINK_FOREACH(uptr, chptr->members.head)
-		{
-			msptr = uptr->data;
-
-			tlen = strlen(use_id(msptr->client_p)) + 1;
-			if(is_founder(msptr))
-				tlen++;
-			if(is_admin(msptr))
-				tlen++;
-			if(is_chanop(msptr))
-				tlen++;
-			if(is_halfop(msptr))
-				tlen++;
-			if(is_voiced(msptr))
-				tlen++;
-
-			if(cur_len + tlen >= BUFSIZE - 3)
-			{
-				*(t - 1) = '\0';
-				sendto_one(client_p, "%s", buf);
-				cur_len = mlen;
-				t = buf + mlen;
-			}
+	if(IsCapable(client_p, CAP_TB) && chptr->topic != NULL)
+		sendto_one(client_p, ":%s TB %s %ld %s%s:%s",
+			   me.id, chptr->chname, (long) chptr->topic_time,
+			   ConfigChannel.burst_topicwho ? chptr->topic_info : "",
+			   ConfigChannel.burst_topicwho ? " " : "", chptr->topic);
+
+	if(IsCapable(client_p, CAP_MLOCK))
+		sendto_one(client_p, ":%s MLOCK %ld %s :%s", me.id, (long) chptr->channelts,
+			   chptr->chname,
+			   EmptyString(chptr->mode_lock) ? "" : chptr->mode_lock);
+
+	hchaninfo.client = client_p;
+	hchaninfo.chptr = chptr;
+	hchaninfo.cmd = 0;
+	hchaninfo.data = NULL;
+	call_hook(h_burst_channel, &hchaninfo);
+}
+
+/*
+ * Bursts are streamed.  burst_TS6() only sets up cursors over
+ * global_client_list and global_channel_list; burst_continue() writes
+ * users and then channels from them while the link's sendq holds less
+ * than BURST_SENDQ_MAX, and is called again from send_queued() as the
+ * link drains.  Lines are queued without trying to write each one, and
+ * flushed once per step.
+ *
+ * Everything else sent to the link meanwhile is held back in
+ * burst->held and queued after the burst, so the remote never hears of a
+ * client or channel before its introduction.  Clients that become users
+ * after the burst began are skipped, and left out of the SJOINs: their
+ * UID and JOINs are in the held queue.  Channels created since are added
+ * at the head of global_channel_list, behind the cursor.
+ *
+ * A nick change or quit held back can leave the remote with a nick that
+ * a user not yet sent has taken meanwhile.  Nicks given up during the
+ * burst are kept in burst->freed, and a user holding one of them is
+ * introduced under its UID instead, see burst_user().
+ */
+rb_dlink_list burst_list;
 
-			rb_sprintf(t, "%s%s ", find_channel_status(msptr, 1),
-				   use_id(msptr->client_p));
+static unsigned long
+burst_limit(struct Client *client_p)
+{
+	unsigned long limit = get_sendq(client_p) / 2;
 
-			cur_len += tlen;
-			t += tlen;
-		}
+	return limit < BURST_SENDQ_MAX ? limit : BURST_SENDQ_MAX;
+}
+
+/*
+ * burst_TS6
+ * 
+ * inputs	- client (server) to burst to
+ * output	- NONE
+ * side effects	- a burst is started towards client_p
+ */
+static void
+burst_TS6(struct Client *client_p)
+{
+	struct burst_state *burst;
+
+	burst = rb_malloc(sizeof(struct burst_state));
+	burst->client_p = client_p;
+	burst->user_ptr = global_client_list.head;
+	burst->chan_ptr = global_channel_list.head;
+	burst->mark = introduce_count;
+	burst->total_users = Count.total;
+	burst->total_channels = rb_dlink_list_length(&global_channel_list);
+	burst->started = rb_current_time();
+	rb_get_pseudo_random(&burst->salt, sizeof(burst->salt));
+	rb_linebuf_newbuf(&burst->held);
+
+	client_p->localClient->burst = burst;
+	rb_dlinkAdd(burst, &burst->node, &burst_list);
+
+	burst_continue(client_p);
+}
+
+static void
+burst_freed_destroy(struct rb_dictionaryElement *elem, void *unused)
+{
+	rb_free((char *) elem->key);
+}
+
+static void
+burst_free(struct burst_state *burst)
+{
+	rb_linebuf_donebuf(&burst->held);
+
+	if(burst->freed != NULL)
+		rb_dictionary_destroy(burst->freed, burst_freed_destroy, NULL);
+
+	rb_free(burst);
+}
+
+/*
+ * burst_nick_freed()
+ *
+ * inputs	- nick a user has just given up
+ * output	- NONE
+ * side effects	- the nick is remembered by every burst in progress
+ */
+void
+burst_nick_freed(const char *name)
+{
+	struct burst_state *burst;
+	rb_dlink_node *ptr;
+	char *key;
+
+	RB_DLINK_FOREACH(ptr, burst_list.head)
+	{
+		burst = ptr->data;
+
+		/* nobody left to introduce under it */
+		if(burst->user_ptr == NULL)
+			continue;
+
+		if(burst->freed == NULL)
+			burst->freed = rb_dictionary_create(irccmp);
+		else if(rb_dictionary_find(burst->freed, name) != NULL)
+			continue;
+
+		key = rb_strdup(name);
+		rb_dictionary_add(burst->freed, key, key);
+	}
+}
+
+/*
+ * burst_finish()
+ *
+ * inputs	- server whose burst has been sent
+ * output	- NONE
+ * side effects	- the held traffic is queued and the end of burst PING sent
+ */
+static void
+burst_finish(struct Client *client_p)
+{
+	struct burst_state *burst = client_p->localClient->burst;
+	hook_data_client hclientinfo;
+
+	hclientinfo.client = client_p;
+	hclientinfo.target = NULL;
+
+	burst->generating = YES;
+	call_hook(h_burst_finished, &hclientinfo);
+
+	/* Always send a PING after connect burst is done, queued as part
+	 * of the burst so it cannot overtake it
+	 */
+	sendto_one(client_p, "PING :%s", get_id(&me, client_p));
+	burst->generating = NO;
+
+	client_p->localClient->burst = NULL;
+	rb_dlinkDelete(&burst->node, &burst_list);
+
+	rb_linebuf_attach(&client_p->localClient->buf_sendq, &burst->held);
+	burst_free(burst);
+}
+
+/*
+ * burst_continue()
+ *
+ * inputs	- server being burst to
+ * output	- NONE
+ * side effects	- the burst is written out until the sendq is full
+ *		  enough, and finished if nothing is left
+ */
+void
+burst_continue(struct Client *client_p)
+{
+	struct burst_state *burst = client_p->localClient->burst;
+	struct Client *target_p;
+	struct Channel *chptr;
+	unsigned long limit;
+
+	if(burst == NULL || burst->generating)
+		return;
 
-		if(rb_dlink_list_length(&chptr->members) > 0)
+	limit = burst_limit(client_p);
+	burst->generating = YES;
+
+	while(!IsAnyDead(client_p) &&
+	      rb_linebuf_len(&client_p->localClient->buf_sendq) < limit &&
+	      (burst->user_ptr != NULL || burst->chan_ptr != NULL))
+	{
+		while(burst->user_ptr != NULL &&
+		      rb_linebuf_len(&client_p->localClient->buf_sendq) < limit)
 		{
-			/* remove trailing space */
-			*(t - 1) = '\0';
+			target_p = burst->user_ptr->data;
+			burst->user_ptr = burst->user_ptr->next;
+
+			if(!IsPerson(target_p) || target_p->introduced > burst->mark)
+				continue;
+
+			burst_user(client_p, target_p);
+			burst->users++;
 		}
-		sendto_one(client_p, "%s", buf);
 
-		RB_DICTIONARY_FOREACH(md, &iter, chptr->metadata)
+		/* every user is out before the first SJOIN */
+		while(burst->user_ptr == NULL && burst->chan_ptr != NULL &&
+		      rb_linebuf_len(&client_p->localClient->buf_sendq) < limit)
 		{
-			/* don't bother bursting +J metadata */
-			if(!(md->name[0] == 'K'))
-				sendto_one(client_p, ":%s ENCAP * METADATA ADD %s %s :%s",
-					   use_id(&me), chptr->chname, md->name, md->value);
+			chptr = burst->chan_ptr->data;
+			burst->chan_ptr = burst->chan_ptr->next;
+
+			if(*chptr->chname != '#')
+				continue;
+
+			burst_channel(client_p, chptr, burst->mark, burst->salt);
+			burst->channels++;
 		}
 
-		if(rb_dlink_list_length(&chptr->banlist) > 0)
-			burst_modes_TS6(client_p, chptr, &chptr->banlist, 'b');
+		send_queued(client_p);
+	}
 
-		if(IsCapable(client_p, CAP_EX) && rb_dlink_list_length(&chptr->exceptlist) > 0)
-			burst_modes_TS6(client_p, chptr, &chptr->exceptlist, 'e');
+	burst->generating = NO;
 
-		if(IsCapable(client_p, CAP_IE) && rb_dlink_list_length(&chptr->invexlist) > 0)
-			burst_modes_TS6(client_p, chptr, &chptr->invexlist, 'I');
+	if(IsAnyDead(client_p))
+		return;
 
-		if(rb_dlink_list_length(&chptr->quietlist) > 0)
-			burst_modes_TS6(client_p, chptr, &chptr->quietlist, 'q');
+	if(burst->user_ptr == NULL && burst->chan_ptr == NULL)
+	{
+		burst_finish(client_p);
+		send_pop_queue(client_p);
+	}
+}
 
-		/* Burst the rest. --Elizabeth */
-		for(i = 0; i < 128; i++)
-		{
-			struct list_mode *mode = listmodes[i];
-			rb_dlink_list *clist;
+/*
+ * burst_cancel()
+ *
+ * inputs	- server that is going away
+ * output	- NONE
+ * side effects	- any burst to it is dropped
+ */
+void
+burst_cancel(struct Client *client_p)
+{
+	struct burst_state *burst = client_p->localClient->burst;
 
-			if (!mode)
-				continue;
+	if(burst == NULL)
+		return;
 
-			clist = get_channel_list(chptr, mode->c);
-			if(rb_dlink_list_length(clist) > 0)
-				burst_modes_TS6(client_p, chptr, clist, mode->c);
-		}
+	client_p->localClient->burst = NULL;
+	rb_dlinkDelete(&burst->node, &burst_list);
+	burst_free(burst);
+}
 
-		if(IsCapable(client_p, CAP_TB) && chptr->topic != NULL)
-			sendto_one(client_p, ":%s TB %s %ld %s%s:%s",
-				   me.id, chptr->chname, (long) chptr->topic_time,
-				   ConfigChannel.burst_topicwho ? chptr->topic_info : "",
-				   ConfigChannel.burst_topicwho ? " " : "", chptr->topic);
-
-		if(IsCapable(client_p, CAP_MLOCK))
-			sendto_one(client_p, ":%s MLOCK %ld %s :%s", me.id, (long) chptr->channelts,
-				   chptr->chname,
-				   EmptyString(chptr->mode_lock) ? "" : chptr->mode_lock);
-
-		hchaninfo.chptr = chptr;
-		hchaninfo.cmd = 0;
-		hchaninfo.data = NULL;
-		call_hook(h_burst_channel, &hchaninfo);
+/* the burst cursors must not be left on a client or channel that goes away */
+void
+burst_client_removed(struct Client *target_p)
+{
+	struct burst_state *burst;
+	rb_dlink_node *ptr;
+
+	RB_DLINK_FOREACH(ptr, burst_list.head)
+	{
+		burst = ptr->data;
+
+		if(burst->user_ptr == &target_p->node)
+			burst->user_ptr = target_p->node.next;
 	}
+}
 
-	hclientinfo.target = NULL;
-	call_hook(h_burst_finished, &hclientinfo);
+void
+burst_channel_removed(struct Channel *chptr)
+{
+	struct burst_state *burst;
+	rb_dlink_node *ptr;
+
+	RB_DLINK_FOREACH(ptr, burst_list.head)
+	{
+		burst = ptr->data;
+
+		if(burst->chan_ptr == &chptr->node)
+			burst->chan_ptr = chptr->node.next;
+	}
 }
 
 /*
@@ -898,9 +1495,6 @@ server_estab(struct Client *client_p)
 			   (me.info[0]) ? (me.info) : "IRCers United");
 	}
 
-	if(!rb_set_buffers(client_p->localClient->F, READBUF_SIZE))
-		ilog_error("rb_set_buffers failed for server");
-
 	/* Enable compression now */
 	if(IsCapable(client_p, CAP_ZIP))
 	{
@@ -943,6 +1537,9 @@ server_estab(struct Client *client_p)
 
 	if(client_p->localClient->fullcaps)
 	{
+		/* make room for its users before they arrive */
+		reserve_id_hash(capab_users(client_p->localClient->fullcaps));
+
 		client_p->serv->fullcaps = rb_strdup(client_p->localClient->fullcaps);
 		rb_free(client_p->localClient->fullcaps);
 		client_p->localClient->fullcaps = NULL;
@@ -1048,13 +1645,11 @@ server_estab(struct Client *client_p)
 	if(IsCapable(client_p, CAP_BAN))
 		burst_ban(client_p);
 
-	burst_TS6(client_p);
-
-	/* Always send a PING after connect burst is done */
-	sendto_one(client_p, "PING :%s", get_id(&me, client_p));
-
 	free_pre_client(client_p);
 
+	/* the end of burst PING is sent once the burst is complete */
+	burst_TS6(client_p);
+
 	send_pop_queue(client_p);
 
 	return 0;
@@ -1247,22 +1842,11 @@ serv_connect(struct server_conf *server_p, struct Client *by)
 	 * -- jilles
 	 */
 	rb_strlcpy(client_p->name, server_p->name, sizeof(client_p->name));
-	rb_strlcpy(client_p->host, server_p->host, sizeof(client_p->host));
+	intern_set(&client_p->host, server_p->host, HOSTLEN);
 	rb_strlcpy(client_p->sockhost, server_p->host, sizeof(client_p->sockhost));
 	client_p->localClient->F = F;
 	add_to_cli_fd_hash(client_p);
 
-	/*
-	 * Set up the initial server evilness, ripped straight from
-	 * connect_server(), so don't blame me for it being evil.
-	 *   -- adrian
-	 */
-
-	if(!rb_set_buffers(client_p->localClient->F, READBUF_SIZE))
-	{
-		ilog_error("setting the buffer size for a server connection");
-	}
-
 	/*
 	 * Attach config entries to client here rather than in
 	 * serv_connect_callback(). This to avoid null pointer references.
@@ -53,6 +53,7 @@
 #include "blacklist.h"
 #include "substitution.h"
 #include "chmode.h"
+#include "intern.h"
 
 static void report_and_set_user_flags(struct Client *, struct ConfItem *);
 void user_welcome(struct Client *source_p);
@@ -292,7 +293,7 @@ register_local_user(struct Client *client_p, struct Client *source_p, const char
 		sendto_one_notice(source_p,
 				  ":*** Notice -- You have an illegal character in your hostname");
 
-		rb_strlcpy(source_p->host, source_p->sockhost, sizeof(source_p->host));
+		intern_set(&source_p->host, source_p->sockhost, HOSTLEN);
 	}
 
 
@@ -491,15 +492,16 @@ register_local_user(struct Client *client_p, struct Client *source_p, const char
 	/* end of valid user name check */
 
 	/* Store original hostname -- jilles */
-	rb_strlcpy(source_p->orighost, source_p->host, HOSTLEN + 1);
+	intern_set(&source_p->orighost, source_p->host, HOSTLEN);
 
 	/* Spoof user@host */
 	if(*source_p->preClient->spoofuser)
 		rb_strlcpy(source_p->username, source_p->preClient->spoofuser, USERLEN + 1);
 	if(*source_p->preClient->spoofhost)
 	{
-		rb_strlcpy(source_p->host, source_p->preClient->spoofhost, HOSTLEN + 1);
-		if(irccmp(source_p->host, source_p->orighost))
+		intern_set(&source_p->host, source_p->preClient->spoofhost, HOSTLEN);
+		if(source_p->host != source_p->orighost &&
+		   irccmp(source_p->host, source_p->orighost))
 			SetDynSpoof(source_p);
 	}
 
@@ -553,6 +555,7 @@ register_local_user(struct Client *client_p, struct Client *source_p, const char
 	s_assert(!IsClient(source_p));
 	rb_dlinkMoveNode(&source_p->localClient->tnode, &unknown_list, &lclient_list);
 	SetClient(source_p);
+	source_p->introduced = ++introduce_count;
 
 	source_p->servptr = &me;
 	rb_dlinkAdd(source_p, &source_p->lnode, &source_p->servptr->serv->users);
@@ -1455,6 +1458,9 @@ construct_umodebuf(void)
 	char *ptr = umodebuf;
 	static int prev_user_modes[128];
 
+	/* serialized introductions carry the old letters */
+	burst_generation++;
+
 	*ptr = '\0';
 
 	for(i = 0; i < 128; i++)
@@ -1587,7 +1593,7 @@ change_nick_user_host(struct Client *target_p, const char *nick, const char *use
 	}
 
 	rb_strlcpy(target_p->username, user, sizeof target_p->username);
-	rb_strlcpy(target_p->host, host, sizeof target_p->host);
+	intern_set(&target_p->host, host, HOSTLEN);
 
 	if(changed)
 		add_history(target_p, 1);
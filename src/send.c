@@ -50,6 +50,56 @@ unsigned long current_serial = 0L;
 
 struct Client *remote_rehash_oper_p;
 
+#define CONTROL_NONE	0
+#define CONTROL_LINE	1	/* PING or ERROR */
+#define CONTROL_PONG	2
+
+/* is_control_line()
+ *
+ * inputs	- linebuf about to be queued for a server
+ * outputs	- CONTROL_LINE for a PING or ERROR of our own, CONTROL_PONG
+ *		  for a PONG of our own, else CONTROL_NONE
+ * side effects - 
+ *
+ * These carry no network state, so they may overtake whatever is
+ * queued for the link.  Anything that names a client or server (KILL,
+ * SQUIT, ...) could overtake its introduction and has to stay in order.
+ * PONGs are special: the remote takes our first one as our end of
+ * burst, so that one has to stay behind the burst.
+ */
+static int
+is_control_line(buf_head_t *linebuf)
+{
+	buf_line_t *bufline;
+	const char *p;
+	size_t len;
+
+	if(linebuf->numlines != 1)
+		return CONTROL_NONE;
+
+	bufline = linebuf->list.head->data;
+	p = bufline->buf;
+
+	if(*p == ':')
+	{
+		p++;
+		len = strlen(me.id);
+		if(strncmp(p, me.id, len) || p[len] != ' ')
+		{
+			len = strlen(me.name);
+			if(strncmp(p, me.name, len) || p[len] != ' ')
+				return CONTROL_NONE;
+		}
+		p += len + 1;
+	}
+
+	if(!strncmp(p, "PING ", 5) || !strncmp(p, "ERROR ", 6))
+		return CONTROL_LINE;
+	if(!strncmp(p, "PONG ", 5))
+		return CONTROL_PONG;
+	return CONTROL_NONE;
+}
+
 /* send_linebuf()
  *
  * inputs	- client to send to, linebuf to attach
@@ -59,6 +109,11 @@ struct Client *remote_rehash_oper_p;
 static int
 _send_linebuf(struct Client *to, buf_head_t * linebuf)
 {
+	struct burst_state *burst;
+	unsigned int len;
+	int kind = CONTROL_NONE;
+	bool control = NO;
+
 	if(IsMe(to))
 	{
 		sendto_realops_snomask(SNO_GENERAL, L_ALL, "Trying to send message to myself!");
@@ -68,30 +123,61 @@ _send_linebuf(struct Client *to, buf_head_t * linebuf)
 	if(!MyConnect(to) || IsIOError(to))
 		return 0;
 
-	if(rb_linebuf_len(&to->localClient->buf_sendq) > get_sendq(to))
+	burst = to->localClient->burst;
+	len = rb_linebuf_len(&to->localClient->buf_sendq) +
+		rb_linebuf_len(&to->localClient->buf_sendq_control);
+	if(burst != NULL)
+		len += rb_linebuf_len(&burst->held);
+
+	if(len > get_sendq(to))
 	{
 		if(IsServer(to))
 		{
 			sendto_realops_snomask(SNO_GENERAL, L_ALL,
 					       "Max SendQ limit exceeded for %s: %u > %lu",
-					       to->name,
-					       rb_linebuf_len(&to->localClient->buf_sendq),
-					       get_sendq(to));
+					       to->name, len, get_sendq(to));
 
 			ilog(L_SERVER, "Max SendQ limit exceeded for %s: %u > %lu",
-			     log_client_name(to, SHOW_IP),
-			     rb_linebuf_len(&to->localClient->buf_sendq), get_sendq(to));
+			     log_client_name(to, SHOW_IP), len, get_sendq(to));
 		}
 
 		dead_link(to, 1);
 		return -1;
 	}
+
+	if(IsServer(to) && (burst == NULL || !burst->generating))
+		kind = is_control_line(linebuf);
+
+	if(kind == CONTROL_LINE || (kind == CONTROL_PONG && IsEobPongSent(to)))
+	{
+		/* keep pings flowing while a large sendq drains */
+		rb_linebuf_attach(&to->localClient->buf_sendq_control, linebuf);
+		control = YES;
+	}
+	else if(burst != NULL && !burst->generating)
+	{
+		/* a burst is being streamed to this server, anything else
+		 * waits until it is complete
+		 */
+		rb_linebuf_attach(&burst->held, linebuf);
+		to->localClient->sendM += 1;
+		me.localClient->sendM += 1;
+		return 0;
+	}
 	else
 	{
 		/* just attach the linebuf to the sendq instead of
 		 * generating a new one
 		 */
 		rb_linebuf_attach(&to->localClient->buf_sendq, linebuf);
+
+		/* later PONGs may overtake once this one is written */
+		if(kind == CONTROL_PONG && !IsEobPong(to))
+		{
+			SetEobPong(to);
+			to->localClient->eob_pong_left = rb_linebuf_len(&to->localClient->buf_sendq) -
+				to->localClient->buf_sendq.writeofs;
+		}
 	}
 
 	/*
@@ -101,7 +187,12 @@ _send_linebuf(struct Client *to, buf_head_t * linebuf)
 	 */
 	to->localClient->sendM += 1;
 	me.localClient->sendM += 1;
-	if(rb_linebuf_len(&to->localClient->buf_sendq) > 0)
+
+	/* burst_continue() flushes once it has queued a block */
+	if(burst != NULL && !control)
+		return 0;
+
+	if(rb_linebuf_len(&to->localClient->buf_sendq) > 0 || control)
 		send_queued(to);
 	return 0;
 }
@@ -124,6 +215,25 @@ send_linebuf_remote(struct Client *to, struct Client *from, buf_head_t * linebuf
 	return;
 }
 
+/* next_sendq()
+ *
+ * inputs	- client being written to
+ * outputs	- the queue to write from next
+ * side effects - 
+ *
+ * Control lines go first, but never into the middle of a line of the
+ * main sendq that has been partly written.
+ */
+static buf_head_t *
+next_sendq(struct Client *to)
+{
+	if(rb_linebuf_len(&to->localClient->buf_sendq_control) &&
+	   to->localClient->buf_sendq.writeofs == 0)
+		return &to->localClient->buf_sendq_control;
+
+	return &to->localClient->buf_sendq;
+}
+
 /* send_queued_write()
  *
  * inputs	- fd to have queue sent, client we're sending to
@@ -137,6 +247,7 @@ send_queued(struct Client *to)
 #ifdef USE_IODEBUG_HOOKS
 	hook_data_int hd;
 #endif
+	buf_head_t *sendq;
 	rb_fde_t *F = to->localClient->F;
 	if(!F)
 		return;
@@ -153,32 +264,36 @@ send_queued(struct Client *to)
 	if(IsFlush(to))
 		return;
 
+	sendq = next_sendq(to);
+
 #ifdef USE_IODEBUG_HOOKS
 	hd.client = to;
-	if(to->localClient->buf_sendq.list.head)
-		hd.arg1 =
-			((buf_line_t *) to->localClient->buf_sendq.list.head->data)->buf +
-			to->localClient->buf_sendq.writeofs;
+	if(sendq->list.head)
+		hd.arg1 = ((buf_line_t *) sendq->list.head->data)->buf + sendq->writeofs;
 #endif
 
-	if(rb_linebuf_len(&to->localClient->buf_sendq))
+	if(rb_linebuf_len(sendq))
 	{
-		while((retlen = rb_linebuf_flush(F, &to->localClient->buf_sendq)) > 0)
+		while((retlen = rb_linebuf_flush(F, sendq)) > 0)
 		{
 			/* We have some data written .. update counters */
 #ifdef USE_IODEBUG_HOOKS
 			hd.arg2 = retlen;
 			call_hook(h_iosend_id, &hd);
-
-			if(to->localClient->buf_sendq.list.head)
-				hd.arg1 =
-					((buf_line_t *) to->localClient->buf_sendq.list.head->
-					 data)->buf + to->localClient->buf_sendq.writeofs;
 #endif
 
 
 			ClearFlush(to);
 
+			if(sendq == &to->localClient->buf_sendq && IsEobPong(to) &&
+			   !IsEobPongSent(to))
+			{
+				if((unsigned int) retlen >= to->localClient->eob_pong_left)
+					SetEobPongSent(to);
+				else
+					to->localClient->eob_pong_left -= retlen;
+			}
+
 			to->localClient->sendB += retlen;
 			me.localClient->sendB += retlen;
 			if(to->localClient->sendB > 1023)
@@ -191,6 +306,13 @@ send_queued(struct Client *to)
 				me.localClient->sendK += (me.localClient->sendB >> 10);
 				me.localClient->sendB &= 0x03ff;
 			}
+
+			sendq = next_sendq(to);
+#ifdef USE_IODEBUG_HOOKS
+			if(sendq->list.head)
+				hd.arg1 = ((buf_line_t *) sendq->list.head->data)->buf +
+					sendq->writeofs;
+#endif
 		}
 
 		if(retlen == 0 || (retlen < 0 && !rb_ignore_errno(errno)))
@@ -200,7 +322,12 @@ send_queued(struct Client *to)
 		}
 	}
 
-	if(rb_linebuf_len(&to->localClient->buf_sendq))
+	if(to->localClient->burst != NULL &&
+	   rb_linebuf_len(&to->localClient->buf_sendq) < BURST_SENDQ_MAX)
+		burst_continue(to);
+
+	if(rb_linebuf_len(&to->localClient->buf_sendq) ||
+	   rb_linebuf_len(&to->localClient->buf_sendq_control))
 	{
 		SetFlush(to);
 		rb_setselect(to->localClient->F, RB_SELECT_WRITE, send_queued_write, to);
@@ -265,6 +392,47 @@ sendto_one(struct Client *target_p, const char *pattern, ...)
 
 }
 
+/* sendto_one_linebuf()
+ *
+ * inputs	- client to send to, prepared linebuf
+ * outputs	- client has every line of the linebuf put into its queue
+ * side effects - used to hand a block of lines built once to many clients
+ */
+void
+sendto_one_linebuf(struct Client *target_p, buf_head_t *linebuf)
+{
+	if(target_p->from != NULL)
+		target_p = target_p->from;
+
+	if(IsIOError(target_p))
+		return;
+
+	_send_linebuf(target_p, linebuf);
+}
+
+/* sendto_one_buffer()
+ *
+ * inputs	- client to send to, CRLF terminated lines and their length
+ * outputs	- client has the lines put into its queue
+ * side effects - used to send text that was serialized ahead of time
+ */
+void
+sendto_one_buffer(struct Client *target_p, char *data, int len)
+{
+	buf_head_t linebuf;
+
+	if(target_p->from != NULL)
+		target_p = target_p->from;
+
+	if(IsIOError(target_p))
+		return;
+
+	rb_linebuf_newbuf(&linebuf);
+	rb_linebuf_parse(&linebuf, data, len, 1);
+	_send_linebuf(target_p, &linebuf);
+	rb_linebuf_donebuf(&linebuf);
+}
+
 /* sendto_one_prefix()
  *
  * inputs	- client to send to, va_args
@@ -418,9 +586,6 @@ sendto_server(struct Client *one, struct Channel *chptr, unsigned long caps, uns
 		return;
 
 	rb_linebuf_newbuf(&linebuf);
-	va_start(args, format);
-	rb_linebuf_putmsg(&linebuf, format, &args, NULL);
-	va_end(args);
 
 	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, serv_list.head)
 	{
@@ -438,6 +603,16 @@ sendto_server(struct Client *one, struct Channel *chptr, unsigned long caps, uns
 		if(!NotCapable(target_p, nocaps))
 			continue;
 
+		/* only built once someone takes it: a netjoin calls this
+		 * with both the UID and EUID form of every user
+		 */
+		if(rb_linebuf_len(&linebuf) == 0)
+		{
+			va_start(args, format);
+			rb_linebuf_putmsg(&linebuf, format, &args, NULL);
+			va_end(args);
+		}
+
 		_send_linebuf(target_p, &linebuf);
 	}
 
@@ -45,6 +45,11 @@ static char nul = '\0';
 
 #define MAXPASSFD 4
 #define READSIZE 1024
+
+/* control messages from ssld are handled as soon as they are read, so a
+ * single receive buffer does for all of them (+1 for a terminating \0)
+ */
+static char ctl_readbuf[READSIZE + 1];
 typedef struct _ssl_ctl_buf
 {
 	rb_dlink_node node;
@@ -62,7 +67,6 @@ struct _ssl_ctl
 	rb_fde_t *F;
 	rb_fde_t *P;
 	pid_t pid;
-	rb_dlink_list readq;
 	rb_dlink_list writeq;
 	uint8_t dead;
 };
@@ -125,29 +129,18 @@ allocate_ssl_daemon(rb_fde_t * F, rb_fde_t * P, int pid)
 static void
 free_ssl_daemon(ssl_ctl_t * ctl)
 {
-	rb_dlink_node *ptr;
+	rb_dlink_node *ptr, *next;
 	ssl_ctl_buf_t *ctl_buf;
 	int x;
 	if(ctl->cli_count)
 		return;
 
-	RB_DLINK_FOREACH(ptr, ctl->readq.head)
-	{
-		ctl_buf = ptr->data;
-		for(x = 0; x < ctl_buf->nfds; x++)
-			rb_close(ctl_buf->F[x]);
-
-		rb_free(ctl_buf->buf);
-		rb_free(ctl_buf);
-	}
-
-	RB_DLINK_FOREACH(ptr, ctl->writeq.head)
+	RB_DLINK_FOREACH_SAFE(ptr, next, ctl->writeq.head)
 	{
 		ctl_buf = ptr->data;
 		for(x = 0; x < ctl_buf->nfds; x++)
 			rb_close(ctl_buf->F[x]);
 
-		rb_free(ctl_buf->buf);
 		rb_free(ctl_buf);
 	}
 	rb_close(ctl->F);
@@ -432,83 +425,77 @@ ssl_process_certfp(ssl_ctl_t * ctl, ssl_ctl_buf_t * ctl_buf)
 }
 
 static void
-ssl_process_cmd_recv(ssl_ctl_t * ctl)
+ssl_process_cmd_recv(ssl_ctl_t * ctl, ssl_ctl_buf_t * ctl_buf)
 {
 	static const char *cannot_setup_ssl =
 		"ssld cannot setup ssl, check your certificates and private key";
 	static const char *no_ssl_or_zlib =
 		"ssld has neither SSL/TLS or zlib support killing all sslds";
-	rb_dlink_node *ptr, *next;
-	ssl_ctl_buf_t *ctl_buf;
-	if(ctl->dead)
-		return;
-	RB_DLINK_FOREACH_SAFE(ptr, next, ctl->readq.head)
+
+	switch (*ctl_buf->buf)
 	{
-		ctl_buf = ptr->data;
-		switch (*ctl_buf->buf)
-		{
-		case 'N':
-			ssl_ok = 0;	/* ssld says it can't do ssl/tls */
-			break;
-		case 'D':
-			ssl_process_dead_fd(ctl, ctl_buf);
-			break;
-		case 'F':
-			ssl_process_certfp(ctl, ctl_buf);
-			break;
-		case 'S':
-			ssl_process_zipstats(ctl, ctl_buf);
-			break;
-		case 'I':
-			ssl_ok = 0;
-			ilog(L_MAIN, cannot_setup_ssl);
-			sendto_realops_snomask(SNO_GENERAL, L_ALL, cannot_setup_ssl);
-		case 'U':
-			zlib_ok = 0;
-			ssl_ok = 0;
-			ilog(L_MAIN, no_ssl_or_zlib);
-			sendto_realops_snomask(SNO_GENERAL, L_ALL, no_ssl_or_zlib);
-			ssl_killall();
-			break;
-		case 'z':
-			zlib_ok = 0;
-			break;
-		default:
-			ilog(L_MAIN, "Received invalid command from ssld: %s", ctl_buf->buf);
-			sendto_realops_snomask(SNO_GENERAL, L_ALL,
-					       "Received invalid command from ssld");
-			break;
-		}
-		rb_dlinkDelete(ptr, &ctl->readq);
-		rb_free(ctl_buf->buf);
-		rb_free(ctl_buf);
+	case 'N':
+		ssl_ok = 0;	/* ssld says it can't do ssl/tls */
+		break;
+	case 'D':
+		ssl_process_dead_fd(ctl, ctl_buf);
+		break;
+	case 'F':
+		ssl_process_certfp(ctl, ctl_buf);
+		break;
+	case 'S':
+		ssl_process_zipstats(ctl, ctl_buf);
+		break;
+	case 'I':
+		ssl_ok = 0;
+		ilog(L_MAIN, cannot_setup_ssl);
+		sendto_realops_snomask(SNO_GENERAL, L_ALL, cannot_setup_ssl);
+	case 'U':
+		zlib_ok = 0;
+		ssl_ok = 0;
+		ilog(L_MAIN, no_ssl_or_zlib);
+		sendto_realops_snomask(SNO_GENERAL, L_ALL, no_ssl_or_zlib);
+		ssl_killall();
+		break;
+	case 'z':
+		zlib_ok = 0;
+		break;
+	default:
+		ilog(L_MAIN, "Received invalid command from ssld: %s", ctl_buf->buf);
+		sendto_realops_snomask(SNO_GENERAL, L_ALL,
+				       "Received invalid command from ssld");
+		break;
 	}
-
 }
 
 
 static void
 ssl_read_ctl(rb_fde_t * F, void *data)
 {
-	ssl_ctl_buf_t *ctl_buf;
+	ssl_ctl_buf_t ctl_buf;
 	ssl_ctl_t *ctl = data;
-	int retlen;
+	int retlen, x;
 
 	if(ctl->dead)
 		return;
 	do
 	{
-		ctl_buf = rb_malloc(sizeof(ssl_ctl_buf_t));
-		ctl_buf->buf = rb_malloc(READSIZE);
-		retlen = rb_recv_fd_buf(ctl->F, ctl_buf->buf, READSIZE, ctl_buf->F, 4);
-		ctl_buf->buflen = retlen;
-		if(retlen <= 0)
+		memset(ctl_buf.F, 0, sizeof(ctl_buf.F));
+		ctl_buf.buf = ctl_readbuf;
+		retlen = rb_recv_fd_buf(ctl->F, ctl_buf.buf, READSIZE, ctl_buf.F, MAXPASSFD);
+		if(retlen > 0)
 		{
-			rb_free(ctl_buf->buf);
-			rb_free(ctl_buf);
+			ctl_buf.buflen = retlen;
+			ctl_buf.buf[retlen] = '\0';
+
+			/* ssld never passes us descriptors, don't leak any */
+			for(x = 0; x < MAXPASSFD && ctl_buf.F[x] != NULL; x++)
+				rb_close(ctl_buf.F[x]);
+
+			ssl_process_cmd_recv(ctl, &ctl_buf);
+			if(ctl->dead)
+				return;
 		}
-		else
-			rb_dlinkAddTail(ctl_buf, &ctl_buf->node, &ctl->readq);
 	}
 	while(retlen > 0);
 
@@ -517,7 +504,6 @@ ssl_read_ctl(rb_fde_t * F, void *data)
 		ssl_dead(ctl);
 		return;
 	}
-	ssl_process_cmd_recv(ctl);
 	rb_setselect(ctl->F, RB_SELECT_READ, ssl_read_ctl, ctl);
 }
 
@@ -565,38 +551,65 @@ ssl_write_ctl(rb_fde_t * F, void *data)
 			rb_dlinkDelete(ptr, &ctl->writeq);
 			for(x = 0; x < ctl_buf->nfds; x++)
 				rb_close(ctl_buf->F[x]);
-			rb_free(ctl_buf->buf);
 			rb_free(ctl_buf);
-
+			continue;
 		}
-		if(retlen == 0 || (retlen < 0 && !rb_ignore_errno(errno)))
+		if(retlen == 0 || !rb_ignore_errno(errno))
 		{
 			ssl_dead(ctl);
 			return;
 		}
-		else
-		{
-			rb_setselect(ctl->F, RB_SELECT_WRITE, ssl_write_ctl, ctl);
-		}
+		break;
 	}
+	if(rb_dlink_list_length(&ctl->writeq) > 0)
+		rb_setselect(ctl->F, RB_SELECT_WRITE, ssl_write_ctl, ctl);
 }
 
+/*
+ * ssl_cmd_write_queue - send a control message (and optionally some
+ * descriptors) to an ssld.
+ *
+ * If nothing is queued the message is sent straight away from the
+ * caller's buffer; a copy is only made when the socket would block.
+ * The queued copy is a single allocation holding both header and data.
+ */
 static void
 ssl_cmd_write_queue(ssl_ctl_t * ctl, rb_fde_t ** F, int count, const void *buf, size_t buflen)
 {
 	ssl_ctl_buf_t *ctl_buf;
-	int x;
+	int retlen, x;
 
 	/* don't bother */
 	if(ctl->dead)
 		return;
 
-	ctl_buf = rb_malloc(sizeof(ssl_ctl_buf_t));
-	ctl_buf->buf = rb_malloc(buflen);
+	if(count > MAXPASSFD)
+		count = MAXPASSFD;
+
+	if(rb_dlink_list_length(&ctl->writeq) == 0)
+	{
+		retlen = rb_send_fd_buf(ctl->F, F, count, (void *) buf, buflen, ctl->pid);
+		if(retlen > 0)
+		{
+			for(x = 0; x < count; x++)
+				rb_close(F[x]);
+			return;
+		}
+		if(retlen == 0 || !rb_ignore_errno(errno))
+		{
+			for(x = 0; x < count; x++)
+				rb_close(F[x]);
+			ssl_dead(ctl);
+			return;
+		}
+	}
+
+	ctl_buf = rb_malloc(sizeof(ssl_ctl_buf_t) + buflen);
+	ctl_buf->buf = (char *) (ctl_buf + 1);
 	memcpy(ctl_buf->buf, buf, buflen);
 	ctl_buf->buflen = buflen;
 
-	for(x = 0; x < count && x < MAXPASSFD; x++)
+	for(x = 0; x < count; x++)
 	{
 		ctl_buf->F[x] = F[x];
 	}
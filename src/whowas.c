@@ -38,6 +38,9 @@
 #include "send.h"
 #include "s_conf.h"
 #include "scache.h"
+#include "logger.h"
+
+#include <sys/mman.h>
 
 /* internally defined function */
 static void add_whowas_to_clist(struct Whowas **, struct Whowas *);
@@ -45,9 +48,28 @@ static void del_whowas_from_clist(struct Whowas **, struct Whowas *);
 static void add_whowas_to_list(struct Whowas **, struct Whowas *);
 static void del_whowas_from_list(struct Whowas **, struct Whowas *);
 
-struct Whowas WHOWAS[NICKNAMEHISTORYLENGTH];
+/*
+ * whowas.db is this header followed by NICKNAMEHISTORYLENGTH records.
+ * it is mapped shared, so whatever was written survives the ircd dying;
+ * a record is only marked in use once it has been filled in.
+ */
+#define WHOWAS_MAGIC	"SPKWW001"
+
+struct whowas_header
+{
+	char magic[8];
+	uint32_t recsize;
+	uint32_t length;
+	uint32_t next;
+	uint32_t unused[3];
+};
+
+struct Whowas *WHOWAS;
 struct Whowas *WHOWASHASH[WW_MAX];
 
+static struct whowas_header *whowas_header;
+static size_t whowas_maplen;
+static int whowas_fd = -1;
 static int whowas_next = 0;
 
 unsigned int
@@ -71,8 +93,8 @@ add_history(struct Client *client_p, int online)
 		if(who->online)
 			del_whowas_from_clist(&(who->online->whowas), who);
 		del_whowas_from_list(&WHOWASHASH[who->hashv], who);
+		who->hashv = -1;
 	}
-	who->hashv = hash_whowas_name(client_p->name);
 	who->logoff = rb_current_time();
 	/*
 	 * NOTE: strcpy ok here, the sizes in the client struct MUST
@@ -89,7 +111,11 @@ add_history(struct Client *client_p, int online)
 	else
 		who->sockhost[0] = '\0';
 
-	who->servername = scache_get_name(client_p->servptr->serv->nameinfo);
+	rb_strlcpy(who->servername, scache_get_name(client_p->servptr->serv->nameinfo),
+		   sizeof(who->servername));
+
+	/* the record is complete, it's safe to use after a crash now */
+	who->hashv = hash_whowas_name(who->name);
 
 	if(online)
 	{
@@ -102,6 +128,7 @@ add_history(struct Client *client_p, int online)
 	whowas_next++;
 	if(whowas_next == NICKNAMEHISTORYLENGTH)
 		whowas_next = 0;
+	whowas_header->next = whowas_next;
 }
 
 void
@@ -144,18 +171,108 @@ count_whowas_memory(size_t * wwu, size_t * wwum)
 	*wwum = NICKNAMEHISTORYLENGTH * sizeof(struct Whowas);
 }
 
+/*
+ * whowas_map - map WWPATH, creating or resizing it as needed
+ * returns 0 if the history has to be kept in memory instead
+ */
+static int
+whowas_map(void)
+{
+	struct stat st;
+	void *map;
+	int fd;
+
+	if((fd = open(WWPATH, O_RDWR | O_CREAT, 0600)) == -1)
+	{
+		ilog(L_MAIN, "Unable to open whowas history %s: %s", WWPATH, strerror(errno));
+		return 0;
+	}
+
+	/* another ircd running from the same prefix owns it */
+	if(lockf(fd, F_TLOCK, 0) == -1)
+	{
+		ilog(L_MAIN, "Whowas history %s is in use, not saving history", WWPATH);
+		close(fd);
+		return 0;
+	}
+
+	if(fstat(fd, &st) == -1 ||
+	   ((size_t) st.st_size != whowas_maplen && ftruncate(fd, whowas_maplen) == -1))
+	{
+		ilog(L_MAIN, "Unable to size whowas history %s: %s", WWPATH, strerror(errno));
+		close(fd);
+		return 0;
+	}
+
+	map = mmap(NULL, whowas_maplen, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(map == MAP_FAILED)
+	{
+		ilog(L_MAIN, "Unable to map whowas history %s: %s", WWPATH, strerror(errno));
+		close(fd);
+		return 0;
+	}
+
+	whowas_fd = fd;
+	whowas_header = map;
+	return 1;
+}
+
 void
 initwhowas()
 {
+	struct Whowas *who;
 	int i;
 
+	whowas_maplen = sizeof(struct whowas_header) +
+		sizeof(struct Whowas) * NICKNAMEHISTORYLENGTH;
+
+	if(testing_conf || !whowas_map())
+		whowas_header = rb_malloc(whowas_maplen);
+
+	WHOWAS = (struct Whowas *) (whowas_header + 1);
+
+	for(i = 0; i < WW_MAX; i++)
+		WHOWASHASH[i] = NULL;
+
+	/* built by a different binary, or not at all */
+	if(memcmp(whowas_header->magic, WHOWAS_MAGIC, sizeof(whowas_header->magic)) ||
+	   whowas_header->recsize != sizeof(struct Whowas) ||
+	   whowas_header->length != NICKNAMEHISTORYLENGTH ||
+	   whowas_header->next >= NICKNAMEHISTORYLENGTH)
+	{
+		memset(whowas_header, 0, whowas_maplen);
+		memcpy(whowas_header->magic, WHOWAS_MAGIC, sizeof(whowas_header->magic));
+		whowas_header->recsize = sizeof(struct Whowas);
+		whowas_header->length = NICKNAMEHISTORYLENGTH;
+
+		for(i = 0; i < NICKNAMEHISTORYLENGTH; i++)
+			WHOWAS[i].hashv = -1;
+		return;
+	}
+
+	/* relink oldest first, so the newest entry ends up at the head */
+	whowas_next = whowas_header->next;
 	for(i = 0; i < NICKNAMEHISTORYLENGTH; i++)
 	{
-		memset((void *) &WHOWAS[i], 0, sizeof(struct Whowas));
-		WHOWAS[i].hashv = -1;
+		who = &WHOWAS[(whowas_next + i) % NICKNAMEHISTORYLENGTH];
+
+		who->online = NULL;
+		who->cnext = who->cprev = NULL;
+
+		if(who->hashv == -1)
+			continue;
+
+		who->name[sizeof(who->name) - 1] = '\0';
+		who->username[sizeof(who->username) - 1] = '\0';
+		who->hostname[sizeof(who->hostname) - 1] = '\0';
+		who->sockhost[sizeof(who->sockhost) - 1] = '\0';
+		who->realname[sizeof(who->realname) - 1] = '\0';
+		who->suser[sizeof(who->suser) - 1] = '\0';
+		who->servername[sizeof(who->servername) - 1] = '\0';
+
+		who->hashv = hash_whowas_name(who->name);
+		add_whowas_to_list(&WHOWASHASH[who->hashv], who);
 	}
-	for(i = 0; i < WW_MAX; i++)
-		WHOWASHASH[i] = NULL;
 }
 
 
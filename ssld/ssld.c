@@ -66,6 +66,7 @@ uint16_to_buf(char *buf, uint16_t x)
 
 
 static char inbuf[READBUF_SIZE];
+static char ctlbuf[READBUF_SIZE];
 #ifdef HAVE_LIBZ
 static char outbuf[READBUF_SIZE];
 #endif
@@ -85,7 +86,6 @@ typedef struct _mod_ctl
 	int cli_count;
 	rb_fde_t *F;
 	rb_fde_t *F_pipe;
-	rb_dlink_list readq;
 	rb_dlink_list writeq;
 } mod_ctl_t;
 
@@ -390,12 +390,28 @@ conn_plain_write(conn_t * conn, void *data, size_t len)
 	rb_rawbuf_append(conn->plainbuf_out, data, len);
 }
 
+/*
+ * Messages to the ircd go out directly when nothing is queued ahead of
+ * them; only a blocked socket costs a copy, and then just the one
+ * allocation for header and data together.
+ */
 static void
 mod_cmd_write_queue(mod_ctl_t * ctl, const void *data, size_t len)
 {
 	mod_ctl_buf_t *ctl_buf;
-	ctl_buf = rb_malloc(sizeof(mod_ctl_buf_t));
-	ctl_buf->buf = rb_malloc(len);
+	int retlen;
+
+	if(rb_dlink_list_length(&ctl->writeq) == 0)
+	{
+		retlen = rb_send_fd_buf(ctl->F, NULL, 0, (void *) data, len, ppid);
+		if(retlen > 0)
+			return;
+		if(retlen == 0 || !rb_ignore_errno(errno))
+			exit(0);
+	}
+
+	ctl_buf = rb_malloc(sizeof(mod_ctl_buf_t) + len);
+	ctl_buf->buf = (char *) (ctl_buf + 1);
 	ctl_buf->buflen = len;
 	memcpy(ctl_buf->buf, data, len);
 	ctl_buf->nfds = 0;
@@ -959,134 +975,121 @@ send_nozlib_support(mod_ctl_t * ctl, mod_ctl_buf_t * ctlb)
 }
 
 static void
-mod_process_cmd_recv(mod_ctl_t * ctl)
+mod_process_cmd_recv(mod_ctl_t * ctl, mod_ctl_buf_t * ctl_buf)
 {
-	rb_dlink_node *ptr, *next;
-	mod_ctl_buf_t *ctl_buf;
-
-	RB_DLINK_FOREACH_SAFE(ptr, next, ctl->readq.head)
+	switch (*ctl_buf->buf)
 	{
-		ctl_buf = ptr->data;
-
-		switch (*ctl_buf->buf)
+	case 'A':
 		{
-		case 'A':
+			if (ctl_buf->nfds != 2 || ctl_buf->buflen != 5)
 			{
-				if (ctl_buf->nfds != 2 || ctl_buf->buflen != 5)
-				{
-					cleanup_bad_message(ctl, ctl_buf);
-					break;
-				}
-
-				if(!ssl_ok)
-				{
-					send_nossl_support(ctl, ctl_buf);
-					break;
-				}
-				ssl_process_accept(ctl, ctl_buf);
+				cleanup_bad_message(ctl, ctl_buf);
 				break;
 			}
-		case 'C':
+
+			if(!ssl_ok)
 			{
-				if (ctl_buf->nfds != 2 || ctl_buf->buflen != 5)
-				{
-					cleanup_bad_message(ctl, ctl_buf);
-					break;
-				}
-
-				if(!ssl_ok)
-				{
-					send_nossl_support(ctl, ctl_buf);
-					break;
-				}
-				ssl_process_connect(ctl, ctl_buf);
+				send_nossl_support(ctl, ctl_buf);
 				break;
 			}
-
-		case 'K':
+			ssl_process_accept(ctl, ctl_buf);
+			break;
+		}
+	case 'C':
+		{
+			if (ctl_buf->nfds != 2 || ctl_buf->buflen != 5)
 			{
-				if(!ssl_ok)
-				{
-					send_nossl_support(ctl, ctl_buf);
-					break;
-				}
-				ssl_new_keys(ctl, ctl_buf);
+				cleanup_bad_message(ctl, ctl_buf);
 				break;
 			}
-		case 'I':
-			init_prng(ctl, ctl_buf);
-			break;
-		case 'S':
+
+			if(!ssl_ok)
 			{
-				process_stats(ctl, ctl_buf);
+				send_nossl_support(ctl, ctl_buf);
 				break;
 			}
-		case 'Y':
+			ssl_process_connect(ctl, ctl_buf);
+			break;
+		}
+
+	case 'K':
+		{
+			if(!ssl_ok)
 			{
-				change_connid(ctl, ctl_buf);
+				send_nossl_support(ctl, ctl_buf);
 				break;
 			}
+			ssl_new_keys(ctl, ctl_buf);
+			break;
+		}
+	case 'I':
+		init_prng(ctl, ctl_buf);
+		break;
+	case 'S':
+		{
+			process_stats(ctl, ctl_buf);
+			break;
+		}
+	case 'Y':
+		{
+			change_connid(ctl, ctl_buf);
+			break;
+		}
 
 #ifdef HAVE_LIBZ
-		case 'Z':
+	case 'Z':
+		{
+			if (ctl_buf->nfds != 2 || ctl_buf->buflen < 6)
 			{
-				if (ctl_buf->nfds != 2 || ctl_buf->buflen < 6)
-				{
-					cleanup_bad_message(ctl, ctl_buf);
-					break;
-				}
-
-				/* just zlib only */
-				zlib_process(ctl, ctl_buf);
+				cleanup_bad_message(ctl, ctl_buf);
 				break;
 			}
-#else
-			
-		case 'Z':
-			send_nozlib_support(ctl, ctl_buf);
-			break;
 
-#endif
-		default:
+			/* just zlib only */
+			zlib_process(ctl, ctl_buf);
 			break;
-			/* Log unknown commands */
 		}
-		rb_dlinkDelete(ptr, &ctl->readq);
-		rb_free(ctl_buf->buf);
-		rb_free(ctl_buf);
-	}
+#else
+		
+	case 'Z':
+		send_nozlib_support(ctl, ctl_buf);
+		break;
 
+#endif
+	default:
+		break;
+		/* Log unknown commands */
+	}
 }
 
 
 
+/*
+ * Each control message is dispatched as soon as it has been received.
+ * None of the handlers hang on to the message buffer, so one static
+ * buffer serves every message rather than a fresh READBUF_SIZE allocation.
+ */
 static void
 mod_read_ctl(rb_fde_t *F, void *data)
 {
-	mod_ctl_buf_t *ctl_buf;
+	mod_ctl_buf_t ctl_buf;
 	mod_ctl_t *ctl = data;
 	int retlen;
 	int i;
 
 	do
 	{
-		ctl_buf = rb_malloc(sizeof(mod_ctl_buf_t));
-		ctl_buf->buf = rb_malloc(READBUF_SIZE);
-		ctl_buf->buflen = READBUF_SIZE;
-		retlen = rb_recv_fd_buf(ctl->F, ctl_buf->buf, ctl_buf->buflen, ctl_buf->F,
+		memset(ctl_buf.F, 0, sizeof(ctl_buf.F));
+		ctl_buf.buf = ctlbuf;
+		retlen = rb_recv_fd_buf(ctl->F, ctl_buf.buf, sizeof(ctlbuf), ctl_buf.F,
 					MAXPASSFD);
-		if(retlen <= 0)
-		{
-			rb_free(ctl_buf->buf);
-			rb_free(ctl_buf);
-		}
-		else
+		if(retlen > 0)
 		{
-			ctl_buf->buflen = retlen;
-			rb_dlinkAddTail(ctl_buf, &ctl_buf->node, &ctl->readq);
-			for (i = 0; i < MAXPASSFD && ctl_buf->F[i] != NULL; i++)
+			ctl_buf.buflen = retlen;
+			for (i = 0; i < MAXPASSFD && ctl_buf.F[i] != NULL; i++)
 				;
-			ctl_buf->nfds = i;
+			ctl_buf.nfds = i;
+			mod_process_cmd_recv(ctl, &ctl_buf);
 		}
 	}
 	while(retlen > 0);
@@ -1094,7 +1097,6 @@ mod_read_ctl(rb_fde_t *F, void *data)
 	if(retlen == 0 || (retlen < 0 && !rb_ignore_errno(errno)))
 		exit(0);
 
-	mod_process_cmd_recv(ctl);
 	rb_setselect(ctl->F, RB_SELECT_READ, mod_read_ctl, ctl);
 }
 
@@ -1116,13 +1118,12 @@ mod_write_ctl(rb_fde_t *F, void *data)
 			rb_dlinkDelete(ptr, &ctl->writeq);
 			for(x = 0; x < ctl_buf->nfds; x++)
 				rb_close(ctl_buf->F[x]);
-			rb_free(ctl_buf->buf);
 			rb_free(ctl_buf);
-
+			continue;
 		}
-		if(retlen == 0 || (retlen < 0 && !rb_ignore_errno(errno)))
+		if(retlen == 0 || !rb_ignore_errno(errno))
 			exit(0);
-
+		break;
 	}
 	if(rb_dlink_list_length(&ctl->writeq) > 0)
 		rb_setselect(ctl->F, RB_SELECT_WRITE, mod_write_ctl, ctl);